@@ -0,0 +1,852 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "BVH.h"
+#include "RayCastStats.h"
+#include "UniformRays.h"
+
+/**
+ * Creates an empty box, one that any point grows it to.
+ */
+AABB::AABB()
+    : minX(std::numeric_limits<float>::infinity()), minY(std::numeric_limits<float>::infinity()),
+      maxX(-std::numeric_limits<float>::infinity()), maxY(-std::numeric_limits<float>::infinity()) {}
+
+/**
+ * Grows the box to contain the point.
+ */
+void AABB::grow(const Point p)
+{
+    minX = std::min(minX, p.x);
+    minY = std::min(minY, p.y);
+    maxX = std::max(maxX, p.x);
+    maxY = std::max(maxY, p.y);
+}
+
+/**
+ * Grows the box to contain the other box.
+ */
+void AABB::grow(const AABB& other)
+{
+    minX = std::min(minX, other.minX);
+    minY = std::min(minY, other.minY);
+    maxX = std::max(maxX, other.maxX);
+    maxY = std::max(maxY, other.maxY);
+}
+
+/**
+ * Half the perimeter of the box, the 2D stand-in for surface area in the SAH.
+ *
+ * Returns 0 for an empty box.
+ */
+float AABB::halfPerimeter() const
+{
+    if (minX > maxX)
+    {
+        return 0;
+    }
+
+    return (maxX - minX) + (maxY - minY);
+}
+
+/**
+ * Slab test of a ray, given by its base and direction, against the box.
+ *
+ * Only the part of the ray with parameter in [0, maxT] counts. Sets tEntry to the
+ * ray parameter at which the ray enters the box (0 if the base is inside).
+ * A small slack is allowed, so rays grazing a flat box (axis-aligned segment) are not lost to rounding.
+ *
+ * Returns true if the ray hits the box, else false.
+ */
+bool AABB::intersectRay(const Point base, const Point invDir, const Point dir, const float maxT, float& tEntry) const
+{
+    float tMin = 0;
+    float tMax = maxT;
+
+    if (dir.x == 0)
+    {
+        if (base.x < minX || base.x > maxX)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        float t1 = (minX - base.x) * invDir.x;
+        float t2 = (maxX - base.x) * invDir.x;
+        tMin = std::max(tMin, std::min(t1, t2));
+        tMax = std::min(tMax, std::max(t1, t2));
+    }
+
+    if (dir.y == 0)
+    {
+        if (base.y < minY || base.y > maxY)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        float t1 = (minY - base.y) * invDir.y;
+        float t2 = (maxY - base.y) * invDir.y;
+        tMin = std::max(tMin, std::min(t1, t2));
+        tMax = std::min(tMax, std::max(t1, t2));
+    }
+
+    if (tMin > tMax + 1e-5f * (std::fabs(tMax) + 1))
+    {
+        return false;
+    }
+
+    tEntry = tMin;
+    return true;
+}
+
+/**
+ * Creates an empty BVH.
+ */
+BVH::BVH() {}
+
+/**
+ * Creates a BVH over the given line segments.
+ */
+BVH::BVH(const std::vector<LineSegment>& lineSegments)
+{
+    build(lineSegments);
+}
+
+/**
+ * Builds the tree from scratch with binned SAH.
+ *
+ * Segment indices returned by queries are indices into lineSegments.
+ */
+void BVH::build(const std::vector<LineSegment>& lineSegments)
+{
+    this->lineSegments = lineSegments;
+
+    nodes.clear();
+    primitives.clear();
+
+    const int n = lineSegments.size();
+    if (n == 0)
+    {
+        return;
+    }
+
+    std::vector<AABB> boxes(n);
+    std::vector<Point> centroids(n);
+    primitives.resize(n);
+
+    for (int i = 0; i < n; i++)
+    {
+        boxes[i].grow(lineSegments[i].a);
+        boxes[i].grow(lineSegments[i].b);
+        centroids[i] = Point((lineSegments[i].a.x + lineSegments[i].b.x) / 2, (lineSegments[i].a.y + lineSegments[i].b.y) / 2);
+        primitives[i] = i;
+    }
+
+    nodes.reserve(2 * n);
+    buildNode(boxes, centroids, 0, n, 0);
+}
+
+/**
+ * Builds the node over primitives [first, first + count), and its children.
+ *
+ * Past MAX_SAH_DEPTH it only splits in half, which bounds the depth for the traversal stack.
+ * Returns the index of the node. Children always have a higher index than their parent,
+ * which refit() relies on.
+ */
+int BVH::buildNode(const std::vector<AABB>& boxes, const std::vector<Point>& centroids, const int first, const int count, const int depth)
+{
+    const int index = nodes.size();
+    nodes.push_back(BVHNode());
+
+    AABB box;
+    AABB centroidBox;
+    for (int i = first; i < first + count; i++)
+    {
+        box.grow(boxes[primitives[i]]);
+        centroidBox.grow(centroids[primitives[i]]);
+    }
+
+    nodes[index].box = box;
+    nodes[index].left = -1;
+    nodes[index].right = -1;
+    nodes[index].first = first;
+    nodes[index].count = count;
+
+    if (count <= MAX_LEAF_SIZE)
+    {
+        return index;
+    }
+
+    // Split along the axis with the widest spread of centroids
+    const bool splitX = (centroidBox.maxX - centroidBox.minX) >= (centroidBox.maxY - centroidBox.minY);
+    const float cMin = splitX ? centroidBox.minX : centroidBox.minY;
+    const float extent = splitX ? centroidBox.maxX - centroidBox.minX : centroidBox.maxY - centroidBox.minY;
+
+    int mid = first + count / 2;
+
+    if (extent > 0 && depth < MAX_SAH_DEPTH)
+    {
+        auto binOf = [&](const int primitive)
+        {
+            const float c = splitX ? centroids[primitive].x : centroids[primitive].y;
+            const int bin = (int) ((c - cMin) / extent * SAH_BINS);
+            return bin < SAH_BINS ? bin : SAH_BINS - 1;
+        };
+
+        int  binCount[SAH_BINS] = {};
+        AABB binBox[SAH_BINS];
+        for (int i = first; i < first + count; i++)
+        {
+            const int bin = binOf(primitives[i]);
+            binCount[bin]++;
+            binBox[bin].grow(boxes[primitives[i]]);
+        }
+
+        // Sweep from the right to get the cost of everything right of each plane
+        float rightCost[SAH_BINS];
+        AABB rightBox;
+        int rightCount = 0;
+        for (int bin = SAH_BINS - 1; bin > 0; bin--)
+        {
+            rightBox.grow(binBox[bin]);
+            rightCount += binCount[bin];
+            rightCost[bin] = rightCount * rightBox.halfPerimeter();
+        }
+
+        // Sweep from the left, plane k splits bins [0, k) and [k, SAH_BINS)
+        float bestCost = std::numeric_limits<float>::infinity();
+        int bestPlane = -1;
+        AABB leftBox;
+        int leftCount = 0;
+        for (int plane = 1; plane < SAH_BINS; plane++)
+        {
+            leftBox.grow(binBox[plane - 1]);
+            leftCount += binCount[plane - 1];
+
+            const float cost = leftCount * leftBox.halfPerimeter() + rightCost[plane];
+            if (leftCount > 0 && leftCount < count && cost < bestCost)
+            {
+                bestCost = cost;
+                bestPlane = plane;
+            }
+        }
+
+        if (bestPlane > 0)
+        {
+            auto middle = std::partition(primitives.begin() + first, primitives.begin() + first + count, [&](const int primitive)
+            {
+                return binOf(primitive) < bestPlane;
+            });
+            mid = middle - primitives.begin();
+        }
+    }
+
+    // Degenerate split (all centroids in one spot), fall back to splitting in half
+    if (mid == first || mid == first + count)
+    {
+        mid = first + count / 2;
+        std::nth_element(primitives.begin() + first, primitives.begin() + mid, primitives.begin() + first + count, [&](const int a, const int b)
+        {
+            return splitX ? centroids[a].x < centroids[b].x : centroids[a].y < centroids[b].y;
+        });
+    }
+
+    const int left = buildNode(boxes, centroids, first, mid - first, depth + 1);
+    const int right = buildNode(boxes, centroids, mid, first + count - mid, depth + 1);
+
+    nodes[index].left = left;
+    nodes[index].right = right;
+    nodes[index].count = 0;
+
+    return index;
+}
+
+/**
+ * Updates the boxes for moved segments, keeping the tree's shape.
+ *
+ * Use after Map::moveEndPoint(), which moves endpoints in place. Adding or removing
+ * segments changes the indices, so those need a build() instead.
+ *
+ * Returns true if refitted, else false if the segment count changed and nothing was done.
+ */
+bool BVH::refit(const std::vector<LineSegment>& lineSegments)
+{
+    if (lineSegments.size() != this->lineSegments.size())
+    {
+        return false;
+    }
+
+    this->lineSegments = lineSegments;
+
+    // Children come after their parent, so walking backwards visits them first
+    for (int i = nodes.size() - 1; i >= 0; i--)
+    {
+        AABB box;
+
+        if (nodes[i].count > 0)
+        {
+            for (int p = nodes[i].first; p < nodes[i].first + nodes[i].count; p++)
+            {
+                box.grow(lineSegments[primitives[p]].a);
+                box.grow(lineSegments[primitives[p]].b);
+            }
+        }
+        else
+        {
+            box.grow(nodes[nodes[i].left].box);
+            box.grow(nodes[nodes[i].right].box);
+        }
+
+        nodes[i].box = box;
+    }
+
+    return true;
+}
+
+/**
+ * Takes a tree built earlier, as saved in a map file, instead of building one.
+ *
+ * nodes and primitives are what getNodes() and getPrimitives() returned for the same
+ * line segments. They are checked to form a tree the queries can walk safely: children
+ * after their parent, leaves within the primitives, and not too deep for the traversal stack.
+ *
+ * Returns true if restored, else false and the BVH is left empty.
+ */
+bool BVH::restore(const std::vector<LineSegment>& lineSegments, const BVHNode* nodes, const int nodeCount, const int* primitives)
+{
+    this->lineSegments.clear();
+    this->nodes.clear();
+    this->primitives.clear();
+
+    const int n = lineSegments.size();
+    if (n == 0 || nodeCount == 0)
+    {
+        return n == 0 && nodeCount == 0;
+    }
+
+    const int maxDepth = 100; // the traversal stacks hold 128 entries
+    std::vector<int> depth(nodeCount, 0);
+    for (int i = 0; i < nodeCount; i++)
+    {
+        const BVHNode& node = nodes[i];
+        if (node.count > 0)
+        {
+            if (node.first < 0 || node.count > n || node.first > n - node.count)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            if (node.left <= i || node.right <= i || node.left >= nodeCount || node.right >= nodeCount || depth[i] >= maxDepth)
+            {
+                return false;
+            }
+            depth[node.left] = std::max(depth[node.left], depth[i] + 1);
+            depth[node.right] = std::max(depth[node.right], depth[i] + 1);
+        }
+    }
+
+    for (int p = 0; p < n; p++)
+    {
+        if (primitives[p] < 0 || primitives[p] >= n)
+        {
+            return false;
+        }
+    }
+
+    this->lineSegments = lineSegments;
+    this->nodes.assign(nodes, nodes + nodeCount);
+    this->primitives.assign(primitives, primitives + n);
+
+    return true;
+}
+
+/**
+ * Count of line segments.
+ */
+int BVH::size() const
+{
+    return lineSegments.size();
+}
+
+/**
+ * Count of nodes in the tree.
+ */
+int BVH::nodeCount() const
+{
+    return nodes.size();
+}
+
+/**
+ * The line segments the tree was built over, in their original order.
+ */
+const std::vector<LineSegment>& BVH::getLineSegments() const
+{
+    return lineSegments;
+}
+
+const std::vector<BVHNode>& BVH::getNodes() const
+{
+    return nodes;
+}
+
+const std::vector<int>& BVH::getPrimitives() const
+{
+    return primitives;
+}
+
+/**
+ * Finds the segment whose hit is closest to the base of the ray, given by its base and unit direction.
+ *
+ * Visits nodes front to back, and skips any node the ray enters after the best hit so far.
+ * Sets t to the ray parameter of that hit and index to the segment's index.
+ *
+ * Returns true if the ray hits any segment, else false and t and index are meaningless.
+ */
+bool BVH::closestHit(const Point base, const Point dir, float& t, int& index) const
+{
+    return closestHit(base, dir, -1, t, index);
+}
+
+/**
+ * Same as closestHit(), but the segment at hint is tested first, the one the ray hit last
+ * frame (-1 for none). Its hit bounds the ray from the start, so the walk skips every node
+ * past it instead of narrowing down front to back. Same result whatever the hint.
+ */
+bool BVH::closestHit(const Point base, const Point dir, const int hint, float& t, int& index) const
+{
+    return closestHit(base, dir, hint, std::numeric_limits<float>::infinity(), t, index);
+}
+
+/**
+ * Same as closestHit() with a hint, but only hits before maxT count, e.g. the hit a ray
+ * already found in another tree. The walk skips every node past maxT from the start.
+ *
+ * Returns true if the ray hits a segment before maxT, else false and t and index are
+ * meaningless.
+ */
+bool BVH::closestHit(const Point base, const Point dir, const int hint, const float maxT, float& t, int& index) const
+{
+    if (nodes.empty())
+    {
+        return false;
+    }
+
+    const Point invDir = Point(1 / dir.x, 1 / dir.y);
+
+    float bestT = maxT;
+    int bestIndex = -1;
+
+    float hintT;
+    Point hintHit;
+    if (hint >= 0 && hint < (int) lineSegments.size() && closestIntersectionOfRayAndLineSegment(base, dir, lineSegments[hint], hintT, hintHit) && hintT < bestT)
+    {
+        bestT = hintT;
+        bestIndex = hint;
+    }
+
+    struct Entry
+    {
+        int node;
+        float tEntry;
+    };
+
+    // Depth is at most MAX_SAH_DEPTH plus log2 of the segment count, well under this
+    Entry stack[128];
+    int top = 0;
+
+    float tRoot;
+    if (nodes[0].box.intersectRay(base, invDir, dir, bestT, tRoot))
+    {
+        stack[top++] = { 0, tRoot };
+    }
+
+    while (top > 0)
+    {
+        const Entry entry = stack[--top];
+        if (entry.tEntry > bestT)
+        {
+            continue;
+        }
+
+        const BVHNode& node = nodes[entry.node];
+
+        if (node.count > 0)
+        {
+            for (int p = node.first; p < node.first + node.count; p++)
+            {
+                const int i = primitives[p];
+                if (i == hint)
+                {
+                    continue;
+                }
+
+                float hitT;
+                Point hit;
+                if (closestIntersectionOfRayAndLineSegment(base, dir, lineSegments[i], hitT, hit))
+                {
+                    if (hitT < bestT || (hitT == bestT && i < bestIndex))
+                    {
+                        bestT = hitT;
+                        bestIndex = i;
+                    }
+                }
+            }
+            continue;
+        }
+
+        float tLeft, tRight;
+        const bool hitLeft = nodes[node.left].box.intersectRay(base, invDir, dir, bestT, tLeft);
+        const bool hitRight = nodes[node.right].box.intersectRay(base, invDir, dir, bestT, tRight);
+
+        // Push the far child first, so the near one is popped first
+        if (hitLeft && hitRight)
+        {
+            if (tLeft <= tRight)
+            {
+                stack[top++] = { node.right, tRight };
+                stack[top++] = { node.left, tLeft };
+            }
+            else
+            {
+                stack[top++] = { node.left, tLeft };
+                stack[top++] = { node.right, tRight };
+            }
+        }
+        else if (hitLeft)
+        {
+            stack[top++] = { node.left, tLeft };
+        }
+        else if (hitRight)
+        {
+            stack[top++] = { node.right, tRight };
+        }
+    }
+
+    if (bestIndex < 0)
+    {
+        return false;
+    }
+
+    t = bestT;
+    index = bestIndex;
+    return true;
+}
+
+/**
+ * Checks if any line segment blocks the view from a to b, see blocksLineOfSight().
+ *
+ * Unlike closestHit() the order of the visit does not matter, so children are pushed
+ * as they come and the walk stops at the first blocking line segment.
+ */
+bool BVH::anyHit(const Point a, const Point b) const
+{
+    if (nodes.empty())
+    {
+        return false;
+    }
+
+    const Point dir = Point(b.x - a.x, b.y - a.y);
+    const Point invDir = Point(1 / dir.x, 1 / dir.y);
+
+    int stack[128];
+    int top = 0;
+
+    float tEntry;
+    if (!nodes[0].box.intersectRay(a, invDir, dir, 1, tEntry))
+    {
+        return false;
+    }
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        const BVHNode& node = nodes[stack[--top]];
+
+        if (node.count > 0)
+        {
+            for (int p = node.first; p < node.first + node.count; p++)
+            {
+                if (blocksLineOfSight(a, b, lineSegments[primitives[p]]))
+                {
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        if (nodes[node.right].box.intersectRay(a, invDir, dir, 1, tEntry))
+        {
+            stack[top++] = node.right;
+        }
+        if (nodes[node.left].box.intersectRay(a, invDir, dir, 1, tEntry))
+        {
+            stack[top++] = node.left;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Appends the index of every line segment whose bounding box overlaps box, in no
+ * particular order.
+ */
+void BVH::query(const AABB& box, std::vector<int>& indices) const
+{
+    if (nodes.empty())
+    {
+        return;
+    }
+
+    auto overlaps = [&](const AABB& other)
+    {
+        return other.minX <= box.maxX && other.maxX >= box.minX && other.minY <= box.maxY && other.maxY >= box.minY;
+    };
+
+    int stack[128];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        const BVHNode& node = nodes[stack[--top]];
+        if (!overlaps(node.box))
+        {
+            continue;
+        }
+
+        if (node.count > 0)
+        {
+            for (int p = node.first; p < node.first + node.count; p++)
+            {
+                const LineSegment& ls = lineSegments[primitives[p]];
+                AABB bounds;
+                bounds.grow(ls.a);
+                bounds.grow(ls.b);
+                if (overlaps(bounds))
+                {
+                    indices.push_back(primitives[p]);
+                }
+            }
+            continue;
+        }
+
+        stack[top++] = node.right;
+        stack[top++] = node.left;
+    }
+}
+
+/**
+ * Calculates the closest intersection of ray and sets it to result.
+ *
+ * Returns true if intersection found, else false if no intersection was found.
+ */
+bool getClosestIntersection(const Ray r, const BVH& bvh, Point& result)
+{
+    return getClosestIntersection(r.base, r.direction(), bvh, result);
+}
+
+/**
+ * Same as getClosestIntersection(), for the ray given by its base and unit direction.
+ */
+bool getClosestIntersection(const Point rayBase, const Point dir, const BVH& bvh, Point& result)
+{
+    RAYCAST_COUNT(raysCast, 1);
+
+    float t;
+    int index;
+    if (!bvh.closestHit(rayBase, dir, t, index))
+    {
+        return false;
+    }
+
+    return closestIntersectionOfRayAndLineSegment(rayBase, dir, bvh.getLineSegments()[index], t, result);
+}
+
+/**
+ * Same as getClosestIntersection(), with the hint of BVH::closestHit(). Sets hint to the
+ * index of the line segment hit, or -1 if none was.
+ */
+bool getClosestIntersection(const Ray r, const BVH& bvh, Point& result, int& hint)
+{
+    return getClosestIntersection(r.base, r.direction(), bvh, result, hint);
+}
+
+/**
+ * Same as the hinted getClosestIntersection(), for the ray given by its base and unit direction.
+ */
+bool getClosestIntersection(const Point rayBase, const Point dir, const BVH& bvh, Point& result, int& hint)
+{
+    RAYCAST_COUNT(raysCast, 1);
+
+    float t;
+    if (!bvh.closestHit(rayBase, dir, hint, t, hint))
+    {
+        hint = -1;
+        return false;
+    }
+
+    return closestIntersectionOfRayAndLineSegment(rayBase, dir, bvh.getLineSegments()[hint], t, result);
+}
+
+/**
+ * Calculates the CLOSEST intersection point for each ray. Essentially, the triangle fan.
+ *
+ * Rays are cast at equally spaced angled intervals starting from angle 0 radian.
+ */
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const BVH& bvh, std::vector<Point>& closestIntersections)
+{
+    if (rayCount == 0)
+    {
+        return;
+    }
+    if (getClosestIntersectionsOfTabledRays(rayBase, rayCount, bvh, closestIntersections))
+    {
+        return;
+    }
+
+    float angleBetweenRays = 2 * PI / rayCount;
+    for (int i = 0; i < rayCount; i++)
+    {
+        Point closest;
+        if (getClosestIntersection(Ray(angleBetweenRays * i, rayBase), bvh, closest))
+        {
+            closestIntersections.push_back(closest);
+        }
+    }
+}
+
+/**
+ * Same as getClosestIntersectionsOfRays(), with each ray hinted by the line segment it hit
+ * in the last call. Hints of another size than rayCount are reset.
+ */
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const BVH& bvh, std::vector<Point>& closestIntersections, std::vector<int>& hints)
+{
+    if (rayCount == 0)
+    {
+        return;
+    }
+    if ((int) hints.size() != rayCount)
+    {
+        hints.assign(rayCount, -1);
+    }
+    if (getClosestIntersectionsOfTabledRays(rayBase, rayCount, bvh, closestIntersections, hints))
+    {
+        return;
+    }
+
+    float angleBetweenRays = 2 * PI / rayCount;
+    for (int i = 0; i < rayCount; i++)
+    {
+        Point closest;
+        if (getClosestIntersection(Ray(angleBetweenRays * i, rayBase), bvh, closest, hints[i]))
+        {
+            closestIntersections.push_back(closest);
+        }
+    }
+}
+
+/**
+ * Casts 3 rays at each vertex of each line segment, with the closest hits found through the BVH.
+ *
+ * Same fan as the line segment version.
+ */
+void getClosestIntersectionOfRays(const Point rayBase, const BVH& bvh, std::vector<Point>& closestIntersections)
+{
+    std::vector<Point> vertices;
+
+    getVertices(bvh.getLineSegments(), vertices);
+
+    getClosestIntersectionOfRays(rayBase, vertices, [&](const Ray r, Point& result)
+    {
+        return getClosestIntersection(r, bvh, result);
+    }, closestIntersections);
+}
+
+/**
+ * Fan of a light that reaches only radius far, into the arc counterclockwise from startAngle
+ * to endAngle, see getClosestIntersectionOfClippedRays().
+ *
+ * Only line segments near the light's lit area are visited, so the cost follows the size
+ * of the light rather than of the map.
+ */
+void getClosestIntersectionOfRays(const Point rayBase, const BVH& bvh, const float radius, const float startAngle, const float endAngle, std::vector<Point>& closestIntersections, RayCastScratch& scratch)
+{
+    const std::vector<LineSegment>& lineSegments = bvh.getLineSegments();
+
+    scratch.indices.clear();
+    if (std::isinf(radius))
+    {
+        for (int i = 0; i < (int) lineSegments.size(); i++)
+        {
+            scratch.indices.push_back(i);
+        }
+    }
+    else
+    {
+        // Box around the base, the ends of the arc, and the points of the arc furthest along each axis
+        const float span = lightSpan(startAngle, endAngle);
+        AABB box;
+        box.grow(rayBase);
+        for (int k = 0; k < 4; k++)
+        {
+            const float angle = k * PI / 2;
+            float fromStart = std::fmod(angle - startAngle, 2 * PI);
+            if (fromStart < 0)
+            {
+                fromStart += 2 * PI;
+            }
+            if (fromStart <= span)
+            {
+                box.grow(Point(rayBase.x + radius * std::cos(angle), rayBase.y + radius * std::sin(angle)));
+            }
+        }
+        box.grow(Point(rayBase.x + radius * std::cos(startAngle), rayBase.y + radius * std::sin(startAngle)));
+        box.grow(Point(rayBase.x + radius * std::cos(startAngle + span), rayBase.y + radius * std::sin(startAngle + span)));
+
+        bvh.query(box, scratch.indices);
+
+        // Same order as the line segment list, so the fan is the same as from the list
+        std::sort(scratch.indices.begin(), scratch.indices.end());
+    }
+
+    scratch.clipped.clear();
+    LineSegment clipped;
+    for (const int i : scratch.indices)
+    {
+        if (clipToLight(rayBase, lineSegments[i], radius, startAngle, endAngle, clipped))
+        {
+            scratch.clipped.push_back(clipped);
+        }
+    }
+
+    getClosestIntersectionOfClippedRays(rayBase, scratch.clipped, radius, startAngle, endAngle, closestIntersections, scratch);
+}
+
+/**
+ * Checks if b can be seen from a, with the line segments of the BVH in the way.
+ */
+bool hasLineOfSight(const Point a, const Point b, const BVH& bvh)
+{
+    RAYCAST_COUNT(sightQueries, 1);
+
+    return !bvh.anyHit(a, b);
+}
+
+/**
+ * Checks each line of sight, a sight line from ls.a to ls.b, and sets visible[i] to 1 if
+ * the i-th one is clear, else 0.
+ */
+void hasLineOfSight(const std::vector<LineSegment>& sightLines, const BVH& bvh, std::vector<char>& visible)
+{
+    visible.resize(sightLines.size());
+    for (int i = 0; i < (int) sightLines.size(); i++)
+    {
+        visible[i] = hasLineOfSight(sightLines[i].a, sightLines[i].b, bvh);
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include "RayCasting.h"
+
+struct AABB
+{
+    float minX, minY, maxX, maxY;
+
+    AABB();
+
+    void  grow(const Point p);
+    void  grow(const AABB& other);
+    float halfPerimeter() const;
+    bool  intersectRay(const Point base, const Point invDir, const Point dir, const float maxT, float& tEntry) const;
+};
+
+struct BVHNode
+{
+    AABB box;
+    int  left, right; // child nodes, -1 for leaves
+    int  first, count; // range in primitive index list, count is 0 for internal nodes
+};
+
+class BVH
+{
+private:
+    std::vector<BVHNode> nodes;
+    std::vector<int> primitives; // segment indices, grouped by leaf
+    std::vector<LineSegment> lineSegments;
+
+    int  buildNode(const std::vector<AABB>& boxes, const std::vector<Point>& centroids, const int first, const int count, const int depth);
+
+public:
+    static const int MAX_LEAF_SIZE = 4;
+    static const int SAH_BINS = 16;
+    static const int MAX_SAH_DEPTH = 48;
+
+    BVH();
+    BVH(const std::vector<LineSegment>& lineSegments);
+
+    void build(const std::vector<LineSegment>& lineSegments);
+    bool refit(const std::vector<LineSegment>& lineSegments);
+    bool restore(const std::vector<LineSegment>& lineSegments, const BVHNode* nodes, const int nodeCount, const int* primitives);
+    int  size() const;
+    int  nodeCount() const;
+    const std::vector<LineSegment>& getLineSegments() const;
+    const std::vector<BVHNode>& getNodes() const;
+    const std::vector<int>& getPrimitives() const;
+    bool closestHit(const Point base, const Point dir, float& t, int& index) const;
+    bool closestHit(const Point base, const Point dir, const int hint, float& t, int& index) const;
+    bool closestHit(const Point base, const Point dir, const int hint, const float maxT, float& t, int& index) const;
+    bool anyHit(const Point a, const Point b) const;
+    void query(const AABB& box, std::vector<int>& indices) const;
+};
+
+bool getClosestIntersection(const Ray r, const BVH& bvh, Point& result);
+
+bool getClosestIntersection(const Point rayBase, const Point dir, const BVH& bvh, Point& result);
+
+bool getClosestIntersection(const Ray r, const BVH& bvh, Point& result, int& hint);
+
+bool getClosestIntersection(const Point rayBase, const Point dir, const BVH& bvh, Point& result, int& hint);
+
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const BVH& bvh, std::vector<Point>& closestIntersections);
+
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const BVH& bvh, std::vector<Point>& closestIntersections, std::vector<int>& hints);
+
+void getClosestIntersectionOfRays(const Point rayBase, const BVH& bvh, std::vector<Point>& closestIntersections);
+
+void getClosestIntersectionOfRays(const Point rayBase, const BVH& bvh, const float radius, const float startAngle, const float endAngle, std::vector<Point>& closestIntersections, RayCastScratch& scratch);
+
+bool hasLineOfSight(const Point a, const Point b, const BVH& bvh);
+
+void hasLineOfSight(const std::vector<LineSegment>& sightLines, const BVH& bvh, std::vector<char>& visible);
@@ -0,0 +1,148 @@
+#include <cmath>
+#include "FanCache.h"
+
+bool FanKey::operator==(const FanKey& other) const
+{
+    return x == other.x && y == other.y && version == other.version;
+}
+
+size_t FanKeyHash::operator()(const FanKey& key) const
+{
+    const std::hash<long long> hash;
+    size_t h = hash(key.x);
+    h ^= hash(key.y) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= hash(key.version) + 0x9e3779b9 + (h << 6) + (h >> 2);
+
+    return h;
+}
+
+/**
+ * Creates an empty cache. Lights are snapped to a grid of quantum, so all lights in one
+ * grid cell share a fan. Fans are evicted once they take more than budget bytes.
+ */
+FanCache::FanCache(const float quantum, const size_t budget)
+    : quantum(quantum), budget(budget), used(0), version(0), hits(0), misses(0), evictions(0) {}
+
+/**
+ * Returns the grid point base is snapped to, which is where cached fans are cast from.
+ * Draw the fan from there, not from base.
+ */
+Point FanCache::quantize(const Point base) const
+{
+    return Point(std::round(base.x / quantum) * quantum, std::round(base.y / quantum) * quantum);
+}
+
+/**
+ * Returns the fan of a light at quantize(base) on the given version of the map. On a miss,
+ * compute casts it and it is kept, evicting the least recently used fans to stay within
+ * the budget.
+ *
+ * A new version makes every cached fan out of date, so they are all dropped.
+ *
+ * The fan stays valid until the next call that may evict it.
+ */
+const std::vector<Point>& FanCache::getFan(const Point base, const unsigned long long version, const FanQuery& compute)
+{
+    if (version != this->version)
+    {
+        clear();
+        this->version = version;
+    }
+
+    const FanKey key = { (long long) std::round(base.x / quantum), (long long) std::round(base.y / quantum), version };
+
+    auto found = index.find(key);
+    if (found != index.end())
+    {
+        hits++;
+        entries.splice(entries.begin(), entries, found->second);
+        return found->second->fan;
+    }
+
+    misses++;
+    entries.push_front(Entry());
+    Entry& entry = entries.front();
+    entry.key = key;
+    compute(quantize(base), entry.fan);
+    entry.fan.shrink_to_fit();
+
+    // The fan, the entry, and about what the list and the index take per entry
+    entry.bytes = entry.fan.capacity() * sizeof(Point) + sizeof(Entry) + 4 * sizeof(void*) + sizeof(FanKey);
+    used += entry.bytes;
+    index[key] = entries.begin();
+
+    evict();
+
+    return entry.fan;
+}
+
+/**
+ * Fan of a light at quantize(base) on the map, see getClosestIntersectionOfRays(). Editing
+ * the map changes its version, so fans cast before the edit are not returned.
+ *
+ * No two maps share a version, so passing another map drops the cached fans too.
+ * Alternating between maps casts every fan; keep a cache per map instead.
+ */
+const std::vector<Point>& FanCache::getFan(const Point base, Map& map)
+{
+    return getFan(base, map.getVersion(), [&map](const Point base, std::vector<Point>& fan)
+    {
+        getClosestIntersectionOfRays(base, map.getLineSegments(), map.getVertices(), fan);
+    });
+}
+
+/**
+ * Drops the least recently used fans while over budget. The most recent one is always kept.
+ */
+void FanCache::evict()
+{
+    while (used > budget && entries.size() > 1)
+    {
+        const Entry& last = entries.back();
+        used -= last.bytes;
+        index.erase(last.key);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+/**
+ * Drops every cached fan. The statistics are kept.
+ */
+void FanCache::clear()
+{
+    entries.clear();
+    index.clear();
+    used = 0;
+}
+
+/**
+ * Count of cached fans.
+ */
+int FanCache::size() const
+{
+    return entries.size();
+}
+
+/**
+ * Bytes taken by the cached fans, as counted against the budget.
+ */
+size_t FanCache::memoryUsed() const
+{
+    return used;
+}
+
+long long FanCache::getHits() const
+{
+    return hits;
+}
+
+long long FanCache::getMisses() const
+{
+    return misses;
+}
+
+long long FanCache::getEvictions() const
+{
+    return evictions;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <functional>
+#include <unordered_map>
+#include "RayCasting.h"
+#include "Map.h"
+
+// Quantized light position and the version of the map its fan was cast on
+struct FanKey
+{
+    long long x, y;
+    unsigned long long version;
+
+    bool operator==(const FanKey& other) const;
+};
+
+struct FanKeyHash
+{
+    size_t operator()(const FanKey& key) const;
+};
+
+// Computes the fan of a light at base
+typedef std::function<void(const Point base, std::vector<Point>& fan)> FanQuery;
+
+// Least recently used cache of fans, for lights that stay put or move within a small area
+class FanCache
+{
+private:
+    struct Entry
+    {
+        FanKey key;
+        std::vector<Point> fan;
+        size_t bytes;
+    };
+
+    float  quantum; // lights closer than this share a fan
+    size_t budget; // bytes
+    size_t used;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<FanKey, std::list<Entry>::iterator, FanKeyHash> index;
+    unsigned long long version; // of the map the entries were cast on
+    long long hits, misses, evictions;
+
+    void evict();
+
+public:
+    static const size_t DEFAULT_BUDGET = 16 << 20;
+
+    FanCache(const float quantum, const size_t budget = DEFAULT_BUDGET);
+
+    Point quantize(const Point base) const;
+    const std::vector<Point>& getFan(const Point base, const unsigned long long version, const FanQuery& compute);
+    const std::vector<Point>& getFan(const Point base, Map& map);
+    void   clear();
+    int    size() const;
+    size_t memoryUsed() const;
+    long long getHits() const;
+    long long getMisses() const;
+    long long getEvictions() const;
+};
@@ -0,0 +1,374 @@
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include "LightMap.h"
+#include "SegmentStore.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LIGHT_MAP_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * Creates a light of intensity 1 with no falloff.
+ */
+Light::Light() : intensity(1), falloff(Falloff::None), radius(1) {}
+
+/**
+ * Creates a light of the given intensity and falloff.
+ */
+Light::Light(const float intensity, const Falloff falloff, const float radius) : intensity(intensity), falloff(falloff), radius(radius) {}
+
+/**
+ * Creates a dark light map of width by height pixels. Pixel (x, y) covers the world from
+ * origin + (x, y) * pixelSize to origin + (x + 1, y + 1) * pixelSize.
+ */
+LightMap::LightMap(const int width, const int height, const Point origin, const float pixelSize)
+    : width(width), height(height), origin(origin), pixelSize(pixelSize), pixels((size_t) width * height, 0.f) {}
+
+int LightMap::getWidth() const
+{
+    return width;
+}
+
+int LightMap::getHeight() const
+{
+    return height;
+}
+
+/**
+ * Sets every pixel back to dark.
+ */
+void LightMap::clear()
+{
+    std::fill(pixels.begin(), pixels.end(), 0.f);
+}
+
+/**
+ * Light of pixel (x, y).
+ */
+float LightMap::at(const int x, const int y) const
+{
+    return pixels[(size_t) y * width + x];
+}
+
+const std::vector<float>& LightMap::getPixels() const
+{
+    return pixels;
+}
+
+/**
+ * Sets polygon to the fan's points, in pixels. Where the fan turns by half a circle or
+ * more between two points, rays escaped there without a hit, so the base is put between
+ * them: the triangle the other way around would light what the rays did not reach.
+ */
+void LightMap::buildPolygon(const Point base, const std::vector<Point>& fan)
+{
+    const int n = fan.size();
+
+    // Fans are sorted by angle, either way around
+    float turn = 0;
+    for (int i = 0; i < n; i++)
+    {
+        const Point p = fan[i];
+        const Point q = fan[(i + 1) % n];
+        turn += (p.x - base.x) * (q.y - base.y) - (p.y - base.y) * (q.x - base.x);
+    }
+    const float direction = turn >= 0 ? 1.f : -1.f;
+
+    auto toPixels = [this](const Point p) { return Point((p.x - origin.x) / pixelSize, (p.y - origin.y) / pixelSize); };
+
+    polygon.clear();
+    for (int i = 0; i < n; i++)
+    {
+        const Point p = fan[i];
+        const Point q = fan[(i + 1) % n];
+        const float cross = (p.x - base.x) * (q.y - base.y) - (p.y - base.y) * (q.x - base.x);
+        const float dot = (p.x - base.x) * (q.x - base.x) + (p.y - base.y) * (q.y - base.y);
+
+        polygon.push_back(toPixels(p));
+        if (n > 1 && (cross * direction < 0 || (cross == 0 && dot <= 0)))
+        {
+            polygon.push_back(toPixels(base));
+        }
+    }
+}
+
+/**
+ * Light added to a pixel at squared distance d2 from the light.
+ */
+static inline float lightAt(const float d2, const float intensity, const Falloff falloff, const float invRadius)
+{
+    if (falloff == Falloff::Linear)
+    {
+        return intensity * std::max(0.f, 1.f - std::sqrt(d2) * invRadius);
+    }
+    if (falloff == Falloff::InverseSquare)
+    {
+        // Grouped as the SIMD kernels do, which square the inverse radius once
+        return intensity / (1.f + d2 * (invRadius * invRadius));
+    }
+
+    return intensity;
+}
+
+// Pixels [x0, x1) of a row, dy is the row center's distance from the light on y
+struct Span
+{
+    float* row;
+    int   x0, x1;
+    float left; // world x of pixel 0's center, minus the light's x
+    float pixelSize;
+    float dy;
+};
+
+static void fillSpanScalar(const Span& s, const Light& light, const float invRadius)
+{
+    for (int x = s.x0; x < s.x1; x++)
+    {
+        const float dx = s.left + (float) x * s.pixelSize;
+        s.row[x] += lightAt(dx * dx + s.dy * s.dy, light.intensity, light.falloff, invRadius);
+    }
+}
+
+#ifdef LIGHT_MAP_X86
+
+/**
+ * SSE2 span fill, 4 pixels per iteration, with the same operations in the same order as
+ * fillSpanScalar(), so the results match it exactly.
+ */
+__attribute__((target("sse2")))
+static void fillSpanSSE(const Span& s, const Light& light, const float invRadius)
+{
+    const __m128 left = _mm_set1_ps(s.left);
+    const __m128 size = _mm_set1_ps(s.pixelSize);
+    const __m128 dy2 = _mm_set1_ps(s.dy * s.dy);
+    const __m128 intensity = _mm_set1_ps(light.intensity);
+    const __m128 invR = _mm_set1_ps(invRadius);
+    const __m128 invR2 = _mm_set1_ps(invRadius * invRadius);
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 lanes = _mm_setr_ps(0, 1, 2, 3);
+
+    int x = s.x0;
+    for (; x + 4 <= s.x1; x += 4)
+    {
+        __m128 value = intensity;
+        if (light.falloff != Falloff::None)
+        {
+            const __m128 dx = _mm_add_ps(left, _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float) x), lanes), size));
+            const __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), dy2);
+            if (light.falloff == Falloff::Linear)
+            {
+                value = _mm_mul_ps(intensity, _mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(_mm_sqrt_ps(d2), invR))));
+            }
+            else
+            {
+                value = _mm_div_ps(intensity, _mm_add_ps(one, _mm_mul_ps(d2, invR2)));
+            }
+        }
+
+        _mm_storeu_ps(s.row + x, _mm_add_ps(_mm_loadu_ps(s.row + x), value));
+    }
+
+    fillSpanScalar({ s.row, x, s.x1, s.left, s.pixelSize, s.dy }, light, invRadius);
+}
+
+/**
+ * AVX2 span fill, 8 pixels per iteration. Same as fillSpanSSE() otherwise.
+ */
+__attribute__((target("avx2")))
+static void fillSpanAVX2(const Span& s, const Light& light, const float invRadius)
+{
+    const __m256 left = _mm256_set1_ps(s.left);
+    const __m256 size = _mm256_set1_ps(s.pixelSize);
+    const __m256 dy2 = _mm256_set1_ps(s.dy * s.dy);
+    const __m256 intensity = _mm256_set1_ps(light.intensity);
+    const __m256 invR = _mm256_set1_ps(invRadius);
+    const __m256 invR2 = _mm256_set1_ps(invRadius * invRadius);
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+
+    int x = s.x0;
+    for (; x + 8 <= s.x1; x += 8)
+    {
+        __m256 value = intensity;
+        if (light.falloff != Falloff::None)
+        {
+            const __m256 dx = _mm256_add_ps(left, _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps((float) x), lanes), size));
+            const __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), dy2);
+            if (light.falloff == Falloff::Linear)
+            {
+                value = _mm256_mul_ps(intensity, _mm256_max_ps(zero, _mm256_sub_ps(one, _mm256_mul_ps(_mm256_sqrt_ps(d2), invR))));
+            }
+            else
+            {
+                value = _mm256_div_ps(intensity, _mm256_add_ps(one, _mm256_mul_ps(d2, invR2)));
+            }
+        }
+
+        _mm256_storeu_ps(s.row + x, _mm256_add_ps(_mm256_loadu_ps(s.row + x), value));
+    }
+
+    fillSpanScalar({ s.row, x, s.x1, s.left, s.pixelSize, s.dy }, light, invRadius);
+}
+
+#endif
+
+/**
+ * Adds the light to pixels [x0, x1) of row y, with the widest kernel allowed by
+ * getSimdLevel().
+ */
+void LightMap::fillSpan(const int y, const int x0, const int x1, const Point base, const Light& light)
+{
+    const Span span = { &pixels[(size_t) y * width], x0, x1, origin.x + 0.5f * pixelSize - base.x, pixelSize, origin.y + (y + 0.5f) * pixelSize - base.y };
+    const float invRadius = 1.f / light.radius;
+
+#ifdef LIGHT_MAP_X86
+    if (getSimdLevel() == SimdLevel::AVX2)
+    {
+        fillSpanAVX2(span, light, invRadius);
+    }
+    else if (getSimdLevel() == SimdLevel::SSE)
+    {
+        fillSpanSSE(span, light, invRadius);
+    }
+    else
+    {
+        fillSpanScalar(span, light, invRadius);
+    }
+#else
+    fillSpanScalar(span, light, invRadius);
+#endif
+}
+
+/**
+ * Adds the light of one fan, as from getClosestIntersectionOfRays() or the sweep, to the
+ * pixels it covers. Lights add up, so call it once per light.
+ *
+ * The fan's polygon is filled scanline by scanline: a pixel is lit if its center is
+ * inside (even-odd rule), and a center exactly on an edge belongs to the pixel right of
+ * or below it, so polygons that share an edge never light a pixel twice.
+ */
+void LightMap::addLight(const Point base, const std::vector<Point>& fan, const Light& light)
+{
+    if (fan.size() < 2)
+    {
+        return;
+    }
+
+    buildPolygon(base, fan);
+
+    edges.clear();
+    for (int i = 0; i < (int) polygon.size(); i++)
+    {
+        Point a = polygon[i];
+        Point b = polygon[(i + 1) % polygon.size()];
+        if (a.y == b.y)
+        {
+            continue;
+        }
+        if (a.y > b.y)
+        {
+            std::swap(a, b);
+        }
+
+        Edge e;
+        e.x0 = a.x;
+        e.y0 = a.y;
+        e.dxdy = (b.x - a.x) / (b.y - a.y);
+        e.firstRow = std::max(0, (int) std::ceil(a.y - 0.5f));
+        e.endRow = std::min(height, (int) std::ceil(b.y - 0.5f));
+        if (e.firstRow < e.endRow)
+        {
+            edges.push_back(e);
+        }
+    }
+
+    std::sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) { return a.firstRow < b.firstRow; });
+
+    active.clear();
+    int next = 0;
+    const int firstRow = edges.empty() ? height : edges[0].firstRow;
+    for (int y = firstRow; y < height && (next < (int) edges.size() || !active.empty()); y++)
+    {
+        while (next < (int) edges.size() && edges[next].firstRow == y)
+        {
+            active.push_back(next++);
+        }
+        active.erase(std::remove_if(active.begin(), active.end(), [&](const int e) { return edges[e].endRow <= y; }), active.end());
+
+        const float center = y + 0.5f;
+        crossings.clear();
+        for (const int e : active)
+        {
+            crossings.push_back(edges[e].x0 + (center - edges[e].y0) * edges[e].dxdy);
+        }
+        std::sort(crossings.begin(), crossings.end());
+
+        for (int i = 0; i + 1 < (int) crossings.size(); i += 2)
+        {
+            const int x0 = std::max(0, (int) std::ceil(crossings[i] - 0.5f));
+            const int x1 = std::min(width, (int) std::ceil(crossings[i + 1] - 0.5f));
+            if (x0 < x1)
+            {
+                fillSpan(y, x0, x1, base, light);
+            }
+        }
+    }
+}
+
+/**
+ * Converts to 8 bits per pixel: light 1 / exposure is white, more is clamped.
+ */
+void LightMap::toGray8(std::vector<unsigned char>& out, const float exposure) const
+{
+    out.resize(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++)
+    {
+        out[i] = (unsigned char) std::min(255.f, std::max(0.f, pixels[i] * exposure * 255.f + 0.5f));
+    }
+}
+
+/**
+ * Writes the light as a binary PGM (grayscale) image, see toGray8() for exposure.
+ *
+ * Returns false if the file could not be written.
+ */
+bool LightMap::writePGM(const std::string& path, const float exposure) const
+{
+    std::vector<unsigned char> gray;
+    toGray8(gray, exposure);
+
+    std::ofstream file(path, std::ios::binary);
+    file << "P5\n" << width << " " << height << "\n255\n";
+    file.write((const char*) gray.data(), gray.size());
+
+    return (bool) file;
+}
+
+/**
+ * Writes the light as a binary PPM image, tinted with the given color (0 to 1 per
+ * channel). See toGray8() for exposure.
+ *
+ * Returns false if the file could not be written.
+ */
+bool LightMap::writePPM(const std::string& path, const float red, const float green, const float blue, const float exposure) const
+{
+    std::vector<unsigned char> rgb(3 * pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++)
+    {
+        const float tint[3] = { red, green, blue };
+        for (int c = 0; c < 3; c++)
+        {
+            rgb[3 * i + c] = (unsigned char) std::min(255.f, std::max(0.f, pixels[i] * tint[c] * exposure * 255.f + 0.5f));
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file << "P6\n" << width << " " << height << "\n255\n";
+    file.write((const char*) rgb.data(), rgb.size());
+
+    return (bool) file;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include "RayCasting.h"
+
+enum class Falloff
+{
+    None, Linear, InverseSquare
+};
+
+struct Light
+{
+    float   intensity; // added to each lit pixel, before falloff
+    Falloff falloff;
+    float   radius; // Linear: falls to 0 here, InverseSquare: falls to half here
+
+    Light();
+    Light(const float intensity, const Falloff falloff = Falloff::None, const float radius = 1);
+};
+
+// Software light buffer, for rendering light without a GPU or a window
+class LightMap
+{
+private:
+    struct Edge
+    {
+        float x0, y0; // upper end, in pixels
+        float dxdy;
+        int   firstRow, endRow; // rows whose pixel centers the edge crosses
+    };
+
+    int   width, height;
+    Point origin; // world position of the top left corner of pixel (0,0)
+    float pixelSize; // world units per pixel
+    std::vector<float> pixels; // row by row
+
+    // Working buffers of addLight(), reused so drawing many lights does not allocate
+    std::vector<Point> polygon;
+    std::vector<Edge> edges;
+    std::vector<int> active;
+    std::vector<float> crossings;
+
+    void buildPolygon(const Point base, const std::vector<Point>& fan);
+    void fillSpan(const int y, const int x0, const int x1, const Point base, const Light& light);
+
+public:
+    LightMap(const int width, const int height, const Point origin, const float pixelSize);
+
+    int   getWidth() const;
+    int   getHeight() const;
+    void  clear();
+    void  addLight(const Point base, const std::vector<Point>& fan, const Light& light);
+    float at(const int x, const int y) const;
+    const std::vector<float>& getPixels() const;
+    void  toGray8(std::vector<unsigned char>& out, const float exposure = 1) const;
+    bool  writePGM(const std::string& path, const float exposure = 1) const;
+    bool  writePPM(const std::string& path, const float red, const float green, const float blue, const float exposure = 1) const;
+};
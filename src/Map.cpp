@@ -1,6 +1,176 @@
 #include "Map.h"
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <atomic>
 
-Map::Map() {}
+/**
+ * Hashes the endpoints in a fixed order (smallest x, then smallest y first), so a line
+ * segment and its reverse hash the same.
+ */
+size_t LineSegmentHash::operator()(const LineSegment& ls) const
+{
+    const bool aFirst = ls.a.x < ls.b.x || (ls.a.x == ls.b.x && ls.a.y < ls.b.y);
+    const Point first = aFirst ? ls.a : ls.b;
+    const Point second = aFirst ? ls.b : ls.a;
+
+    const std::hash<float> hash;
+    size_t h = hash(first.x);
+    for (const float v : { first.y, second.x, second.y })
+    {
+        h ^= hash(v) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    }
+
+    return h;
+}
+
+static std::atomic<unsigned long long> nextVersion(1);
+
+/**
+ * Takes a number no map had before.
+ */
+MapVersion::MapVersion() : value(nextVersion++) {}
+
+MapVersion::MapVersion(const MapVersion&) : value(nextVersion++) {}
+
+/**
+ * The map moved from is emptied, so it takes a new number too.
+ */
+MapVersion::MapVersion(MapVersion&& other) : value(nextVersion++)
+{
+    other.next();
+}
+
+MapVersion& MapVersion::operator=(const MapVersion&)
+{
+    next();
+    return *this;
+}
+
+MapVersion& MapVersion::operator=(MapVersion&& other)
+{
+    next();
+    other.next();
+    return *this;
+}
+
+void MapVersion::next()
+{
+    value = nextVersion++;
+}
+
+unsigned long long MapVersion::get() const
+{
+    return value;
+}
+
+Map::Map() : cellSize(DEFAULT_CELL_SIZE) {}
+
+/**
+ * Endpoints are bucketed in square grid cells of the given size. Close to the distance
+ * closestEndPoint() is called with works best.
+ */
+Map::Map(const float endPointCellSize) : cellSize(endPointCellSize) {}
+
+/**
+ * Packs the grid coordinates of a cell into its key. Shifted unsigned, since shifting a
+ * negative cx left is undefined.
+ */
+static long long cellKey(const long long cx, const long long cy)
+{
+    return (long long) (((unsigned long long) cx << 32) ^ (uint32_t) cy);
+}
+
+/**
+ * Returns the key of the grid cell that p is in.
+ */
+long long Map::cellOf(const Point p) const
+{
+    const long long cx = (long long) std::floor(p.x / cellSize);
+    const long long cy = (long long) std::floor(p.y / cellSize);
+
+    return cellKey(cx, cy);
+}
+
+/**
+ * Records that the endpoint ref of a line segment is at p, adding p to the vertex table
+ * and the grid if no line segment ended there yet.
+ */
+void Map::addEndPoint(const Point p, const int ref)
+{
+    auto it = vertexIndex.find(p);
+    if (it == vertexIndex.end())
+    {
+        it = vertexIndex.emplace(p, (int) vertices.size()).first;
+        vertices.push_back(p);
+        vertexEndPoints.emplace_back();
+        cells[cellOf(p)].push_back(p);
+    }
+
+    if ((int) segmentVertices.size() <= ref)
+    {
+        segmentVertices.resize(ref + 1);
+    }
+
+    vertexEndPoints[it->second].push_back(ref);
+    segmentVertices[ref] = it->second;
+}
+
+/**
+ * Forgets that the endpoint ref of a line segment is at p. The vertex leaves the table
+ * and the grid once no line segment ends there, and the last vertex takes its place.
+ */
+void Map::removeEndPoint(const Point p, const int ref)
+{
+    const int vertex = vertexIndex[p];
+    std::vector<int>& refs = vertexEndPoints[vertex];
+    refs.erase(std::find(refs.begin(), refs.end(), ref));
+
+    if (!refs.empty())
+    {
+        return;
+    }
+
+    const int last = vertices.size() - 1;
+    if (vertex != last)
+    {
+        vertices[vertex] = vertices[last];
+        vertexEndPoints[vertex].swap(vertexEndPoints[last]);
+        vertexIndex[vertices[vertex]] = vertex;
+
+        for (const int moved : vertexEndPoints[vertex])
+        {
+            segmentVertices[moved] = vertex;
+        }
+    }
+
+    vertices.pop_back();
+    vertexEndPoints.pop_back();
+    vertexIndex.erase(p);
+
+    auto cell = cells.find(cellOf(p));
+    std::vector<Point>& points = cell->second;
+    *std::find(points.begin(), points.end(), p) = points.back();
+    points.pop_back();
+
+    if (points.empty())
+    {
+        cells.erase(cell);
+    }
+}
+
+/**
+ * Updates the endpoint oldRef to newRef after its line segment changed position.
+ */
+void Map::renumberEndPoint(const int oldRef, const int newRef)
+{
+    const int vertex = segmentVertices[oldRef];
+    std::vector<int>& refs = vertexEndPoints[vertex];
+    *std::find(refs.begin(), refs.end(), oldRef) = newRef;
+
+    segmentVertices[newRef] = vertex;
+}
 
 /**
  * Adds a line segments.
@@ -9,19 +179,50 @@ Map::Map() {}
  */
 bool Map::addLineSegment(LineSegment ls)
 {
-    for (auto x : lineSegments)
+    const int i = lineSegments.size();
+    if (!index.emplace(ls, i).second)
     {
-        if (ls == x)
-        {
-            return false;
-        }
+        return false;
     }
 
     lineSegments.push_back(ls);
+    addEndPoint(ls.a, 2 * i);
+    addEndPoint(ls.b, 2 * i + 1);
+    version.next();
 
     return true;
 }
 
+/**
+ * Adds many line segments at once, skipping the ones already in the map or already
+ * earlier in lss.
+ * 
+ * Returns the number of line segments added.
+ */
+int Map::addLineSegments(const std::vector<LineSegment>& lss)
+{
+    lineSegments.reserve(lineSegments.size() + lss.size());
+    index.reserve(lineSegments.size() + lss.size());
+
+    int added = 0;
+    for (const LineSegment& ls : lss)
+    {
+        added += addLineSegment(ls);
+    }
+
+    return added;
+}
+
+/**
+ * Number that changes with every edit of the map, so anything computed from the map can
+ * tell it is out of date. No other map has or had the same number, also not a copy of
+ * this one, or a map assigned over this one.
+ */
+unsigned long long Map::getVersion() const
+{
+    return version.get();
+}
+
 /**
  * Count of line segments.
  */
@@ -31,53 +232,106 @@ int Map::sizeLineSegments()
 }
 
 /**
- * Removes line segment.
+ * Removes the line segment at position i, by moving the last line segment into its place.
+ * The removed line segment's index entry is left to the caller.
+ */
+void Map::eraseAt(const int i)
+{
+    removeEndPoint(lineSegments[i].a, 2 * i);
+    removeEndPoint(lineSegments[i].b, 2 * i + 1);
+
+    const int last = lineSegments.size() - 1;
+    if (i != last)
+    {
+        lineSegments[i] = lineSegments[last];
+        index[lineSegments[i]] = i;
+        renumberEndPoint(2 * last, 2 * i);
+        renumberEndPoint(2 * last + 1, 2 * i + 1);
+    }
+
+    lineSegments.pop_back();
+    segmentVertices.resize(2 * lineSegments.size());
+}
+
+/**
+ * Removes line segment. The last line segment takes its place, so the order of the line
+ * segments is not kept.
  * 
  * Returns true if line segment removed, else false if not found.
  */
 bool Map::removeLineSegment(LineSegment ls)
 {
-    for (auto it = lineSegments.begin(); it != lineSegments.end(); it++)
+    auto it = index.find(ls);
+    if (it == index.end())
     {
-        if (*it == ls)
-        {
-            lineSegments.erase(it);
-            return true;
-        }
+        return false;
     }
 
-    return false;
+    const int i = it->second;
+    index.erase(it);
+    eraseAt(i);
+    version.next();
+
+    return true;
 }
 
 /**
- * Moves a endpoint of a line segment.
+ * Moves a endpoint of a line segment. Only the line segments ending at oldP are touched.
+ * 
+ * A line segment that becomes the same as another one is removed.
  * 
  * Returns true if endpoint found, else false.
  */
 bool Map::moveEndPoint(Point oldP, Point newP)
 {
-    bool foundAEndpoint = false;
-    for (auto it = lineSegments.begin(); it != lineSegments.end(); it++)
+    if (vertexIndex.find(oldP) == vertexIndex.end())
+    {
+        return false;
+    }
+    if (oldP == newP)
+    {
+        return true;
+    }
+
+    version.next();
+
+    // Each step moves one endpoint away from oldP, until none is left there
+    for (auto it = vertexIndex.find(oldP); it != vertexIndex.end(); it = vertexIndex.find(oldP))
     {
-        if ((*it).a == oldP)
+        const int ref = vertexEndPoints[it->second].back();
+        const int i = ref / 2;
+
+        LineSegment moved = lineSegments[i];
+        if (ref % 2 == 0)
+        {
+            moved.a = newP;
+        }
+        else
         {
-            (*it).a = newP;
-            foundAEndpoint = true;
+            moved.b = newP;
         }
 
-        if ((*it).b == oldP)
+        index.erase(lineSegments[i]);
+        removeEndPoint(oldP, ref);
+        addEndPoint(newP, ref);
+        lineSegments[i] = moved;
+
+        if (!index.emplace(moved, i).second)
         {
-            (*it).b = newP;
-            foundAEndpoint = true;
+            // Same as another line segment now, drop this copy
+            eraseAt(i);
         }
     }
 
-    return foundAEndpoint;
+    return true;
 }
 
 /**
  * Figures out the closest endpoint to p.
  * 
+ * Only the grid cells within maxDist are searched, or every endpoint if that would be
+ * more cells than the map has.
+ * 
  * Returns true if found a endpoint within the maxDist, else false and result
  * value is meaningless.
  */
@@ -86,39 +340,46 @@ bool Map::closestEndPoint(Point p, float maxDist, Point & result)
     const float maxDistSquared = maxDist * maxDist;
 
     Point closestEndPoint;
+    float closestDistSquared = maxDistSquared;
     bool foundEndPointWithinMaxDist = false;
-    
-    for (auto it = lineSegments.begin(); it != lineSegments.end(); it++)
+
+    auto search = [&](const std::vector<Point>& points)
     {
-        if ((*it).a.distSquared(p) < maxDistSquared)
+        for (const Point q : points)
         {
-            if (foundEndPointWithinMaxDist)
-            {
-                if ((*it).a.distSquared(p) < closestEndPoint.distSquared(p))
-                {
-                    closestEndPoint = (*it).a;
-                }
-            }
-            else
+            const float distSquared = q.distSquared(p);
+            if (distSquared < closestDistSquared)
             {
-                closestEndPoint = (*it).a;
+                closestEndPoint = q;
+                closestDistSquared = distSquared;
                 foundEndPointWithinMaxDist = true;
             }
         }
-        if ((*it).b.distSquared(p) < maxDistSquared)
+    };
+
+    const float reach = std::ceil(maxDist / cellSize);
+    if ((2 * reach + 1) * (2 * reach + 1) > cells.size())
+    {
+        for (const auto& cell : cells)
+        {
+            search(cell.second);
+        }
+    }
+    else
+    {
+        const long long cx = (long long) std::floor(p.x / cellSize);
+        const long long cy = (long long) std::floor(p.y / cellSize);
+
+        for (long long x = cx - (long long) reach; x <= cx + (long long) reach; x++)
         {
-            if (foundEndPointWithinMaxDist)
+            for (long long y = cy - (long long) reach; y <= cy + (long long) reach; y++)
             {
-                if ((*it).b.distSquared(p) < closestEndPoint.distSquared(p))
+                auto cell = cells.find(cellKey(x, y));
+                if (cell != cells.end())
                 {
-                    closestEndPoint = (*it).b;
+                    search(cell->second);
                 }
             }
-            else
-            {
-                closestEndPoint = (*it).b;
-                foundEndPointWithinMaxDist = true;
-            }
         }
     }
 
@@ -137,4 +398,31 @@ bool Map::closestEndPoint(Point p, float maxDist, Point & result)
 const std::vector<LineSegment>& Map::getLineSegments()
 {
     return lineSegments;
-}
\ No newline at end of file
+}
+
+/**
+ * Count of distinct endpoints.
+ */
+int Map::sizeVertices()
+{
+    return vertices.size();
+}
+
+/**
+ * Gets the distinct endpoints of the line segments, kept up to date as line segments are
+ * added, removed and moved. Same points as getVertices() in RayCasting.h, in no particular
+ * order.
+ */
+const std::vector<Point>& Map::getVertices()
+{
+    return vertices;
+}
+
+/**
+ * Gets the position in getVertices() of each endpoint, 2 * i for a and 2 * i + 1 for b of
+ * line segment i.
+ */
+const std::vector<int>& Map::getSegmentVertices()
+{
+    return segmentVertices;
+}
@@ -1,19 +1,70 @@
+#pragma once
+
 #include "RayCasting.h"
 #include <vector>
+#include <unordered_map>
+
+// Hashes a line segment so that both endpoint orders give the same hash, like LineSegment::operator==
+struct LineSegmentHash
+{
+    size_t operator()(const LineSegment& ls) const;
+};
+
+// Version number of a map, drawn from one counter for the whole process, so no two maps
+// ever share one. A copy, a move or an assignment takes a new number.
+class MapVersion
+{
+private:
+    unsigned long long value;
+
+public:
+    MapVersion();
+    MapVersion(const MapVersion& other);
+    MapVersion(MapVersion&& other);
+
+    MapVersion& operator=(const MapVersion& other);
+    MapVersion& operator=(MapVersion&& other);
+
+    void next();
+    unsigned long long get() const;
+};
 
 class Map
 {
 private:
     std::vector<LineSegment> lineSegments;
+    std::unordered_map<LineSegment, int, LineSegmentHash> index; // line segment to its position in lineSegments
+    // Vertex table, endpoints are referred to as 2 * position + (0 for a, 1 for b)
+    std::vector<Point> vertices; // distinct endpoints
+    std::vector<std::vector<int>> vertexEndPoints; // endpoints at each vertex
+    std::vector<int> segmentVertices; // vertex of each endpoint
+    std::unordered_map<Point, int, PointHash> vertexIndex; // vertex to its position in vertices
+
+    std::unordered_map<long long, std::vector<Point>> cells; // grid cell to the vertices in it
+    float cellSize;
+    MapVersion version; // changes with every edit
+
+    long long cellOf(const Point p) const;
+    void addEndPoint(const Point p, const int ref);
+    void removeEndPoint(const Point p, const int ref);
+    void renumberEndPoint(const int oldRef, const int newRef);
+    void eraseAt(const int i);
 
 public:
+    static const int DEFAULT_CELL_SIZE = 8;
 
     Map();
+    Map(const float endPointCellSize);
 
+    unsigned long long getVersion() const;
     int  sizeLineSegments();
     bool addLineSegment(LineSegment ls);
+    int  addLineSegments(const std::vector<LineSegment>& lss);
     bool removeLineSegment(LineSegment ls);
     bool moveEndPoint(Point oldPos, Point newPos);
     bool closestEndPoint(Point p, float maxDist, Point & result);
     const std::vector<LineSegment>& getLineSegments();
-};
\ No newline at end of file
+    int  sizeVertices();
+    const std::vector<Point>& getVertices();
+    const std::vector<int>& getSegmentVertices();
+};
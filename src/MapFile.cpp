@@ -0,0 +1,390 @@
+#include <cstring>
+#include <climits>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "MapFile.h"
+
+static const char MAGIC[8] = { 'R', 'C', 'M', 'A', 'P', 0, 0, 0 };
+
+static_assert(sizeof(MapFileHeader) <= MapFile::PAGE_SIZE, "header must fit in its page");
+static_assert(sizeof(BVHNode) == 32, "BVHNode is stored as is, it must have no padding");
+
+/**
+ * Creates a map file that is not open.
+ */
+MapFile::MapFile() : data(nullptr), length(0), header(nullptr) {}
+
+MapFile::~MapFile()
+{
+    close();
+}
+
+/**
+ * Closes the file, sets the error and returns false.
+ */
+bool MapFile::fail(const std::string& message)
+{
+    close();
+    error = message;
+    return false;
+}
+
+/**
+ * Maps the file into memory. Pages are read from disk as they are first used, so opening
+ * takes about the same time however large the map is.
+ *
+ * The header and the section bounds are always checked. With verify, the checksum is
+ * checked as well, which reads the whole file.
+ *
+ * Returns true if opened, else false and getError() tells why.
+ */
+bool MapFile::open(const std::string& path, const bool verify)
+{
+    close();
+    error.clear();
+
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return fail("could not open " + path);
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < PAGE_SIZE)
+    {
+        ::close(fd);
+        return fail(path + " is too short to be a map file");
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    void* mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return fail("could not map " + path);
+    }
+
+    data = static_cast<const unsigned char*>(mapped);
+    length = status.st_size;
+    header = reinterpret_cast<const MapFileHeader*>(data);
+
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        return fail(path + " is not a map file");
+    }
+    if (header->version != VERSION)
+    {
+        return fail(path + " has map file version " + std::to_string(header->version) + ", expected " + std::to_string(VERSION));
+    }
+    if (header->fileSize != length)
+    {
+        return fail(path + " is " + std::to_string(length) + " bytes, its header says " + std::to_string(header->fileSize));
+    }
+
+    const uint64_t width = SegmentStore::SEGMENT_STORE_WIDTH;
+    if (header->segmentCount > INT_MAX || header->paddedCount > INT_MAX || header->paddedCount % width != 0 ||
+        header->paddedCount < header->segmentCount || header->paddedCount - header->segmentCount >= width)
+    {
+        return fail(path + " has a bad segment count");
+    }
+
+    auto inside = [this](const uint64_t offset, const uint64_t bytes)
+    {
+        return offset >= PAGE_SIZE && offset % PAGE_SIZE == 0 && offset <= length && bytes <= length - offset;
+    };
+
+    const uint64_t arrayBytes = header->paddedCount * sizeof(float);
+    if (!inside(header->axOffset, arrayBytes) || !inside(header->ayOffset, arrayBytes) || !inside(header->bxOffset, arrayBytes) || !inside(header->byOffset, arrayBytes))
+    {
+        return fail(path + " has segment arrays out of the file");
+    }
+
+    if (hasBVH() && (header->nodeCount > INT_MAX || !inside(header->nodeOffset, header->nodeCount * sizeof(BVHNode)) ||
+        !inside(header->primitiveOffset, header->segmentCount * sizeof(int))))
+    {
+        return fail(path + " has a BVH out of the file");
+    }
+
+    if (verify && !this->verify())
+    {
+        return false;
+    }
+
+    store.view(reinterpret_cast<const float*>(data + header->axOffset), reinterpret_cast<const float*>(data + header->ayOffset),
+               reinterpret_cast<const float*>(data + header->bxOffset), reinterpret_cast<const float*>(data + header->byOffset),
+               header->segmentCount, header->paddedCount);
+
+    return true;
+}
+
+/**
+ * Unmaps the file. Stores and line segments taken from it before must not be used after.
+ */
+void MapFile::close()
+{
+    if (data)
+    {
+        munmap(const_cast<unsigned char*>(data), length);
+    }
+
+    data = nullptr;
+    length = 0;
+    header = nullptr;
+    store = SegmentStore();
+}
+
+bool MapFile::isOpen() const
+{
+    return data != nullptr;
+}
+
+/**
+ * Checks the checksum of the open file. A file that fails is closed.
+ *
+ * Returns true if it matches, else false.
+ */
+bool MapFile::verify()
+{
+    if (!isOpen())
+    {
+        return false;
+    }
+
+    if (mapFileChecksum(data + PAGE_SIZE, length - PAGE_SIZE) != header->checksum)
+    {
+        return fail("checksum mismatch, the map file is damaged");
+    }
+
+    return true;
+}
+
+/**
+ * Count of line segments, 0 if no file is open.
+ */
+int MapFile::size() const
+{
+    return header ? header->segmentCount : 0;
+}
+
+bool MapFile::hasBVH() const
+{
+    return header && (header->flags & HAS_BVH);
+}
+
+/**
+ * Returns the i-th line segment.
+ */
+LineSegment MapFile::get(const int i) const
+{
+    return store.get(i);
+}
+
+/**
+ * The line segments as a SegmentStore, on the mapped arrays. Valid until the file is closed.
+ */
+const SegmentStore& MapFile::getStore() const
+{
+    return store;
+}
+
+/**
+ * Copies the line segments out, in file order.
+ */
+void MapFile::getLineSegments(std::vector<LineSegment>& lineSegments) const
+{
+    lineSegments.resize(size());
+    for (int i = 0; i < size(); i++)
+    {
+        lineSegments[i] = store.get(i);
+    }
+}
+
+/**
+ * Sets bvh to the tree stored in the file, without building it again.
+ *
+ * Returns true if the file has a valid BVH, else false.
+ */
+bool MapFile::getBVH(BVH& bvh) const
+{
+    if (!hasBVH())
+    {
+        return false;
+    }
+
+    std::vector<LineSegment> lineSegments;
+    getLineSegments(lineSegments);
+
+    return bvh.restore(lineSegments, reinterpret_cast<const BVHNode*>(data + header->nodeOffset), header->nodeCount,
+                       reinterpret_cast<const int*>(data + header->primitiveOffset));
+}
+
+const std::string& MapFile::getError() const
+{
+    return error;
+}
+
+/**
+ * 64-bit FNV-1a over 8-byte words instead of bytes, with the high half folded back into the
+ * low half after each word so that every bit of a word reaches every bit of the hash.
+ */
+uint64_t mapFileChecksum(const void* data, const size_t bytes)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t hash = 14695981039346656037ULL;
+
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 32;
+    }
+    for (; i < bytes; i++)
+    {
+        hash = (hash ^ p[i]) * prime;
+    }
+
+    return hash;
+}
+
+/**
+ * Rounds up to a whole number of pages.
+ */
+static uint64_t pageAlign(const uint64_t bytes)
+{
+    return (bytes + MapFile::PAGE_SIZE - 1) / MapFile::PAGE_SIZE * MapFile::PAGE_SIZE;
+}
+
+/**
+ * Writes the line segments as a map file, see MapFileHeader. With withBVH, the BVH is built
+ * and saved too, so loading the map does not need to build it.
+ *
+ * Returns true if written, else false.
+ */
+bool writeMapFile(const std::string& path, const std::vector<LineSegment>& lineSegments, const bool withBVH)
+{
+    const SegmentStore store(lineSegments);
+    BVH bvh;
+    if (withBVH)
+    {
+        bvh.build(lineSegments);
+    }
+
+    MapFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = MapFile::VERSION;
+    header.flags = withBVH ? MapFile::HAS_BVH : 0;
+    header.segmentCount = store.size();
+    header.paddedCount = store.paddedSize();
+    header.nodeCount = bvh.nodeCount();
+
+    // Each section starts on the page after the end of the one before
+    uint64_t end = MapFile::PAGE_SIZE;
+    auto place = [&end](const uint64_t bytes)
+    {
+        const uint64_t offset = end;
+        end = pageAlign(end + bytes);
+        return offset;
+    };
+
+    const uint64_t arrayBytes = header.paddedCount * sizeof(float);
+    header.axOffset = place(arrayBytes);
+    header.ayOffset = place(arrayBytes);
+    header.bxOffset = place(arrayBytes);
+    header.byOffset = place(arrayBytes);
+    if (withBVH)
+    {
+        header.nodeOffset = place(header.nodeCount * sizeof(BVHNode));
+        header.primitiveOffset = place(header.segmentCount * sizeof(int));
+    }
+    header.fileSize = end;
+
+    std::vector<unsigned char> image(header.fileSize, 0);
+    std::memcpy(image.data() + header.axOffset, store.dataAx(), arrayBytes);
+    std::memcpy(image.data() + header.ayOffset, store.dataAy(), arrayBytes);
+    std::memcpy(image.data() + header.bxOffset, store.dataBx(), arrayBytes);
+    std::memcpy(image.data() + header.byOffset, store.dataBy(), arrayBytes);
+    if (withBVH)
+    {
+        std::memcpy(image.data() + header.nodeOffset, bvh.getNodes().data(), header.nodeCount * sizeof(BVHNode));
+        std::memcpy(image.data() + header.primitiveOffset, bvh.getPrimitives().data(), header.segmentCount * sizeof(int));
+    }
+
+    header.checksum = mapFileChecksum(image.data() + MapFile::PAGE_SIZE, image.size() - MapFile::PAGE_SIZE);
+    std::memcpy(image.data(), &header, sizeof(header));
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(image.data()), image.size());
+
+    return (bool) out;
+}
+
+/**
+ * Appends the line segments of a text map to lineSegments.
+ *
+ * Returns true if read, else false and error tells the line that could not be read.
+ */
+bool readTextMap(const std::string& path, std::vector<LineSegment>& lineSegments, std::string& error)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        error = "could not open " + path;
+        return false;
+    }
+
+    std::string line;
+    int number = 0;
+    while (std::getline(in, line))
+    {
+        number++;
+
+        const size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+        {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        float ax, ay, bx, by;
+        std::string rest;
+        if (!(fields >> ax >> ay >> bx >> by) || (fields >> rest))
+        {
+            error = path + ":" + std::to_string(number) + ": expected \"ax ay bx by\"";
+            return false;
+        }
+
+        lineSegments.push_back(LineSegment(Point(ax, ay), Point(bx, by)));
+    }
+
+    return true;
+}
+
+/**
+ * Converts a text map to a map file.
+ *
+ * Returns true if converted, else false and error tells why.
+ */
+bool convertTextMap(const std::string& textPath, const std::string& mapPath, const bool withBVH, std::string& error)
+{
+    std::vector<LineSegment> lineSegments;
+    if (!readTextMap(textPath, lineSegments, error))
+    {
+        return false;
+    }
+
+    if (!writeMapFile(mapPath, lineSegments, withBVH))
+    {
+        error = "could not write " + mapPath;
+        return false;
+    }
+
+    return true;
+}
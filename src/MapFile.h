@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "RayCasting.h"
+#include "SegmentStore.h"
+#include "BVH.h"
+
+// Binary map file, in the byte order of the machine that wrote it (little-endian on x86).
+// A header page, then sections that each start on a page:
+//   ax, ay, bx, by - paddedCount floats each, padded with NaN like SegmentStore
+//   nodes          - nodeCount BVHNode, if flags has MapFile::HAS_BVH
+//   primitives     - segmentCount ints, the BVH's segment indices by leaf, same
+struct MapFileHeader
+{
+    char     magic[8]; // "RCMAP" and 3 zero bytes
+    uint32_t version;
+    uint32_t flags;
+    uint64_t segmentCount;
+    uint64_t paddedCount;
+    uint64_t nodeCount;
+    uint64_t axOffset, ayOffset, bxOffset, byOffset; // bytes from the start of the file
+    uint64_t nodeOffset, primitiveOffset; // 0 without a BVH
+    uint64_t fileSize;
+    uint64_t checksum; // mapFileChecksum() of everything after the header page
+};
+
+// A map file mapped into memory. The segment arrays are used where they are, not copied.
+class MapFile
+{
+private:
+    const unsigned char* data;
+    size_t length;
+    const MapFileHeader* header;
+    SegmentStore store; // views the mapped arrays
+    std::string error;
+
+    bool fail(const std::string& message);
+
+public:
+    static const int VERSION = 1;
+    static const int PAGE_SIZE = 4096;
+    static const uint32_t HAS_BVH = 1;
+
+    MapFile();
+    ~MapFile();
+    MapFile(const MapFile&) = delete;
+    MapFile& operator=(const MapFile&) = delete;
+
+    bool open(const std::string& path, const bool verify = false);
+    void close();
+    bool isOpen() const;
+    bool verify();
+    int  size() const;
+    bool hasBVH() const;
+    LineSegment get(const int i) const;
+    const SegmentStore& getStore() const;
+    void getLineSegments(std::vector<LineSegment>& lineSegments) const;
+    bool getBVH(BVH& bvh) const;
+    const std::string& getError() const;
+};
+
+uint64_t mapFileChecksum(const void* data, const size_t bytes);
+
+bool writeMapFile(const std::string& path, const std::vector<LineSegment>& lineSegments, const bool withBVH = true);
+
+// Text maps: one line segment per line as "ax ay bx by", blank lines and lines starting with # are skipped
+bool readTextMap(const std::string& path, std::vector<LineSegment>& lineSegments, std::string& error);
+
+bool convertTextMap(const std::string& textPath, const std::string& mapPath, const bool withBVH, std::string& error);
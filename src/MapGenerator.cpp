@@ -0,0 +1,371 @@
+#include <cmath>
+#include <algorithm>
+#include "MapGenerator.h"
+
+static const float CELL = 20.f; // size of a maze cell, corridor width, ... all maps use the same scale
+
+/**
+ * Starts the sequence for the given seed.
+ */
+MapRandom::MapRandom(const unsigned int seed) : state(seed * 2654435761ULL + 1) {}
+
+/**
+ * Returns the next 32 random bits (64-bit linear congruential generator, high bits only).
+ */
+unsigned int MapRandom::next()
+{
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned int) (state >> 32);
+}
+
+/**
+ * Returns a float in [min, max).
+ */
+float MapRandom::uniform(const float min, const float max)
+{
+    return min + (max - min) * (float) (next() >> 8) / 16777216.f;
+}
+
+/**
+ * Returns an int in [0, n).
+ */
+int MapRandom::below(const int n)
+{
+    return (int) (((unsigned long long) next() * n) >> 32);
+}
+
+/**
+ * Adds the closed polygon through the given corners.
+ */
+static void addPolygon(const std::vector<Point>& corners, std::vector<LineSegment>& lineSegments)
+{
+    for (int i = 0; i < (int) corners.size(); i++)
+    {
+        lineSegments.push_back(LineSegment(corners[i], corners[(i + 1) % corners.size()]));
+    }
+}
+
+/**
+ * Short line segments in random directions, scattered over a square that grows with the
+ * count so the number of line segments a ray passes stays about the same at any count.
+ */
+void generateRandomMap(const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments)
+{
+    const float half = (std::sqrt((float) count) * CELL + 2 * CELL) / 2;
+    const float maxLength = 0.6f * CELL;
+
+    MapRandom random(seed);
+    lineSegments.reserve(lineSegments.size() + std::max(count, 0));
+    for (int i = 0; i < count; i++)
+    {
+        const Point a(random.uniform(-half, half), random.uniform(-half, half));
+        Point b(a.x + random.uniform(-maxLength, maxLength), a.y + random.uniform(-maxLength, maxLength));
+        if (b == a)
+        {
+            b.x += maxLength;
+        }
+
+        lineSegments.push_back(LineSegment(a, b));
+    }
+}
+
+/**
+ * A perfect maze (one path between any two cells) on a square grid of cells, carved with a
+ * depth-first search. A w by w maze has (w + 1)^2 walls, one line segment per cell side;
+ * the outer walls come first so a maze cut short at count is still closed.
+ */
+void generateMaze(const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    const int w = std::max(1, (int) std::ceil(std::sqrt((double) count)) - 1);
+    const float half = w * CELL / 2;
+    const int start = (int) lineSegments.size();
+
+    // Bit 1: passage to the cell on the right, bit 2: passage to the cell below
+    std::vector<char> open((size_t) w * w, 0);
+    std::vector<char> visited((size_t) w * w, 0);
+    std::vector<int> stack;
+
+    MapRandom random(seed);
+    stack.push_back(0);
+    visited[0] = 1;
+    while (!stack.empty())
+    {
+        const int cell = stack.back();
+        const int x = cell % w;
+        const int y = cell / w;
+
+        int neighbours[4];
+        int n = 0;
+        if (x > 0 && !visited[cell - 1]) neighbours[n++] = cell - 1;
+        if (x < w - 1 && !visited[cell + 1]) neighbours[n++] = cell + 1;
+        if (y > 0 && !visited[cell - w]) neighbours[n++] = cell - w;
+        if (y < w - 1 && !visited[cell + w]) neighbours[n++] = cell + w;
+
+        if (n == 0)
+        {
+            stack.pop_back();
+            continue;
+        }
+
+        const int next = neighbours[random.below(n)];
+        const int low = std::min(cell, next);
+        open[low] |= next - cell == 1 || cell - next == 1 ? 1 : 2;
+        visited[next] = 1;
+        stack.push_back(next);
+    }
+
+    lineSegments.reserve(lineSegments.size() + (size_t) (w + 1) * (w + 1));
+    auto corner = [half](const int x, const int y) { return Point(x * CELL - half, y * CELL - half); };
+
+    for (int i = 0; i < w; i++)
+    {
+        lineSegments.push_back(LineSegment(corner(i, 0), corner(i + 1, 0)));
+        lineSegments.push_back(LineSegment(corner(w, i), corner(w, i + 1)));
+        lineSegments.push_back(LineSegment(corner(w - i, w), corner(w - i - 1, w)));
+        lineSegments.push_back(LineSegment(corner(0, w - i), corner(0, w - i - 1)));
+    }
+
+    for (int y = 0; y < w; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            const char o = open[y * w + x];
+            if (x < w - 1 && !(o & 1))
+            {
+                lineSegments.push_back(LineSegment(corner(x + 1, y), corner(x + 1, y + 1)));
+            }
+            if (y < w - 1 && !(o & 2))
+            {
+                lineSegments.push_back(LineSegment(corner(x, y + 1), corner(x + 1, y + 1)));
+            }
+        }
+    }
+
+    lineSegments.resize(start + count);
+}
+
+/**
+ * City blocks separated by streets, each block holding one building: a rectangle or, one
+ * time in three, an L shape.
+ */
+void generateCity(const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    const float block = 3 * CELL;
+    const float street = CELL;
+    const int b = (int) std::ceil(std::sqrt(count / 4.0));
+    const float half = b * (block + street) / 2;
+    const int start = (int) lineSegments.size();
+
+    MapRandom random(seed);
+    lineSegments.reserve(lineSegments.size() + count + 6);
+    std::vector<Point> corners;
+    for (int i = 0; (int) lineSegments.size() - start < count; i++)
+    {
+        const float x0 = (i % b) * (block + street) - half + random.uniform(0, block / 4);
+        const float y0 = (i / b) * (block + street) - half + random.uniform(0, block / 4);
+        const float x1 = x0 + block / 2 + random.uniform(0, block / 4);
+        const float y1 = y0 + block / 2 + random.uniform(0, block / 4);
+
+        corners.clear();
+        if (random.below(3) == 0)
+        {
+            const float xm = random.uniform(x0 + 0.3f * (x1 - x0), x0 + 0.7f * (x1 - x0));
+            const float ym = random.uniform(y0 + 0.3f * (y1 - y0), y0 + 0.7f * (y1 - y0));
+            corners = { Point(x0, y0), Point(x1, y0), Point(x1, ym), Point(xm, ym), Point(xm, y1), Point(x0, y1) };
+        }
+        else
+        {
+            corners = { Point(x0, y0), Point(x1, y0), Point(x1, y1), Point(x0, y1) };
+        }
+
+        addPolygon(corners, lineSegments);
+    }
+
+    lineSegments.resize(start + count);
+}
+
+/**
+ * Trees: small convex polygons of 3 to 7 sides on a jittered grid, close enough together
+ * that most rays end after a few trees.
+ */
+void generateForest(const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    const float spacing = 0.8f * CELL;
+    const int g = (int) std::ceil(std::sqrt(count / 5.0));
+    const float half = g * spacing / 2;
+    const int start = (int) lineSegments.size();
+
+    MapRandom random(seed);
+    lineSegments.reserve(lineSegments.size() + count + 7);
+    std::vector<Point> corners;
+    for (int i = 0; (int) lineSegments.size() - start < count; i++)
+    {
+        const float radius = random.uniform(0.1f, 0.3f) * spacing;
+        const Point center((i % g + 0.5f) * spacing - half + random.uniform(-1, 1) * (spacing / 2 - radius),
+                           (i / g + 0.5f) * spacing - half + random.uniform(-1, 1) * (spacing / 2 - radius));
+        const int sides = 3 + random.below(5);
+        const float rotation = random.uniform(0, 2 * PI);
+
+        corners.clear();
+        for (int s = 0; s < sides; s++)
+        {
+            const float angle = rotation + 2 * PI * s / sides;
+            corners.push_back(Point(center.x + radius * std::cos(angle), center.y + radius * std::sin(angle)));
+        }
+
+        addPolygon(corners, lineSegments);
+    }
+
+    lineSegments.resize(start + count);
+}
+
+/**
+ * One long corridor, a walk of axis-aligned stretches that turns left or right now and
+ * then. Each stretch adds a wall on both sides, joined at the corners, and the two ends
+ * are closed. The walk may cross itself, which makes junctions.
+ */
+void generateCorridors(const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    const float width = CELL;
+    const int stretches = std::max(1, (count - 1) / 2);
+    const int start = (int) lineSegments.size();
+
+    // Center line of the corridor
+    MapRandom random(seed);
+    std::vector<Point> path;
+    std::vector<int> directions; // of each stretch: 0 right, 1 up, 2 left, 3 down
+    path.push_back(Point(0, 0));
+    int direction = 0;
+    for (int i = 0; i < stretches; i++)
+    {
+        const int turn = random.below(10);
+        if (i > 0 && turn < 3)
+        {
+            direction = (direction + 1) % 4;
+        }
+        else if (i > 0 && turn < 6)
+        {
+            direction = (direction + 3) % 4;
+        }
+
+        const float length = random.uniform(3 * CELL, 15 * CELL);
+        const Point p = path.back();
+        const Point d(direction == 0 ? 1.f : direction == 2 ? -1.f : 0.f, direction == 1 ? 1.f : direction == 3 ? -1.f : 0.f);
+        path.push_back(Point(p.x + d.x * length, p.y + d.y * length));
+        directions.push_back(direction);
+    }
+
+    // Offset of each path point to the left wall, mitered at the corners
+    auto normal = [](const int dir) { return Point(dir == 1 ? -1.f : dir == 3 ? 1.f : 0.f, dir == 0 ? 1.f : dir == 2 ? -1.f : 0.f); };
+    std::vector<Point> left, right;
+    for (int i = 0; i < (int) path.size(); i++)
+    {
+        const Point before = normal(directions[std::max(i - 1, 0)]);
+        const Point after = normal(directions[std::min(i, stretches - 1)]);
+        const Point offset = before == after ? before : Point(before.x + after.x, before.y + after.y);
+        left.push_back(Point(path[i].x + offset.x * width / 2, path[i].y + offset.y * width / 2));
+        right.push_back(Point(path[i].x - offset.x * width / 2, path[i].y - offset.y * width / 2));
+    }
+
+    lineSegments.reserve(lineSegments.size() + 2 * stretches + 2);
+    lineSegments.push_back(LineSegment(right.front(), left.front()));
+    for (int i = 0; i < stretches; i++)
+    {
+        lineSegments.push_back(LineSegment(left[i], left[i + 1]));
+        lineSegments.push_back(LineSegment(right[i], right[i + 1]));
+    }
+    lineSegments.push_back(LineSegment(left.back(), right.back()));
+
+    lineSegments.resize(start + count);
+}
+
+/**
+ * Appends count line segments of a map of the given kind.
+ */
+void generateMap(const MapKind kind, const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments)
+{
+    switch (kind)
+    {
+        case MapKind::Random:    generateRandomMap(count, seed, lineSegments); break;
+        case MapKind::Maze:      generateMaze(count, seed, lineSegments); break;
+        case MapKind::City:      generateCity(count, seed, lineSegments); break;
+        case MapKind::Forest:    generateForest(count, seed, lineSegments); break;
+        case MapKind::Corridors: generateCorridors(count, seed, lineSegments); break;
+    }
+}
+
+/**
+ * Adds a generated map to the given map. Returns the number of line segments added, less
+ * than count when the map already had some of them.
+ */
+int generateMap(const MapKind kind, const int count, const unsigned int seed, Map& map)
+{
+    std::vector<LineSegment> lineSegments;
+    generateMap(kind, count, seed, lineSegments);
+
+    return map.addLineSegments(lineSegments);
+}
+
+/**
+ * Checks if maps of the kind have line segments that cross each other, which the sweep
+ * cannot handle on its own: random line segments, and corridors whose walk runs into
+ * itself. The other kinds only meet at endpoints.
+ */
+bool mapKindCrosses(const MapKind kind)
+{
+    return kind == MapKind::Random || kind == MapKind::Corridors;
+}
+
+/**
+ * Returns the name of the kind, as used on the benchmark command line.
+ */
+const char* mapKindName(const MapKind kind)
+{
+    switch (kind)
+    {
+        case MapKind::Random:    return "random";
+        case MapKind::Maze:      return "maze";
+        case MapKind::City:      return "city";
+        case MapKind::Forest:    return "forest";
+        case MapKind::Corridors: return "corridors";
+    }
+
+    return "";
+}
+
+/**
+ * Looks up a kind by its name. Returns false for an unknown name.
+ */
+bool mapKindFromName(const std::string& name, MapKind& kind)
+{
+    for (const MapKind k : { MapKind::Random, MapKind::Maze, MapKind::City, MapKind::Forest, MapKind::Corridors })
+    {
+        if (name == mapKindName(k))
+        {
+            kind = k;
+            return true;
+        }
+    }
+
+    return false;
+}
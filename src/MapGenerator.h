@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include "RayCasting.h"
+#include "Map.h"
+
+enum class MapKind
+{
+    Random, Maze, City, Forest, Corridors
+};
+
+// Pseudo-random numbers that are the same on every platform for the same seed
+class MapRandom
+{
+private:
+    unsigned long long state;
+
+public:
+    MapRandom(const unsigned int seed);
+
+    unsigned int next();
+    float uniform(const float min, const float max);
+    int   below(const int n);
+};
+
+// Every generator appends exactly count line segments, centered around the origin
+void generateRandomMap(const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments);
+void generateMaze(const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments);
+void generateCity(const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments);
+void generateForest(const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments);
+void generateCorridors(const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments);
+
+void generateMap(const MapKind kind, const int count, const unsigned int seed, std::vector<LineSegment>& lineSegments);
+int  generateMap(const MapKind kind, const int count, const unsigned int seed, Map& map);
+
+bool mapKindCrosses(const MapKind kind);
+
+const char* mapKindName(const MapKind kind);
+bool mapKindFromName(const std::string& name, MapKind& kind);
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include "ParallelRayCasting.h"
+
+/**
+ * Calculates the CLOSEST intersection point for each ray, with the rays spread over the pool.
+ *
+ * Rays are cast at equally spaced angled intervals starting from angle 0 radian. Each ray
+ * writes to its own pre-sized slot, and the hits are then gathered in ray order, so the
+ * result is the same as the single-threaded version no matter how the work was split.
+ *
+ * getClosest is called from several threads at once, so it must only read shared state.
+ */
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const ClosestIntersectionQuery& getClosest, std::vector<Point>& closestIntersections, ThreadPool& pool)
+{
+    if (rayCount == 0)
+    {
+        return;
+    }
+
+    std::vector<Point> slots(rayCount);
+    std::vector<char> found(rayCount, 0);
+
+    const float angleBetweenRays = 2 * PI / rayCount;
+
+    // Several chunks per thread, so a slow part of the map does not hold up one thread
+    int grain = rayCount / (pool.size() * 8);
+    if (grain < 1)
+    {
+        grain = 1;
+    }
+
+    pool.parallelFor(rayCount, grain, [&](const int begin, const int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            found[i] = getClosest(Ray(angleBetweenRays * i, rayBase), slots[i]);
+        }
+    });
+
+    for (int i = 0; i < rayCount; i++)
+    {
+        if (found[i])
+        {
+            closestIntersections.push_back(slots[i]);
+        }
+    }
+}
+
+/**
+ * Parallel version of getClosestIntersectionsOfRays() over a line segment list.
+ */
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, ThreadPool& pool)
+{
+    getClosestIntersectionsOfRays(rayBase, rayCount, [&](const Ray r, Point& result)
+    {
+        return getClosestIntersection(r, lineSegments, result);
+    }, closestIntersections, pool);
+}
+
+/**
+ * Parallel version of the batched hasLineOfSight() over a BVH. Each sight line writes
+ * only its own flag, so the result is the same as the single-threaded version.
+ */
+void hasLineOfSight(const std::vector<LineSegment>& sightLines, const BVH& bvh, std::vector<char>& visible, ThreadPool& pool)
+{
+    const int count = (int) sightLines.size();
+    visible.resize(count);
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Queries that exit early vary a lot in cost, so use small chunks
+    int grain = count / (pool.size() * 8);
+    if (grain < 1)
+    {
+        grain = 1;
+    }
+
+    pool.parallelFor(count, grain, [&](const int begin, const int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            visible[i] = hasLineOfSight(sightLines[i].a, sightLines[i].b, bvh);
+        }
+    });
+}
+
+/**
+ * Count of fans in the batch.
+ */
+int FanBatch::size() const
+{
+    return offsets.empty() ? 0 : offsets.size() - 1;
+}
+
+/**
+ * Count of points in fan i.
+ */
+int FanBatch::fanSize(const int i) const
+{
+    return offsets[i + 1] - offsets[i];
+}
+
+/**
+ * The first point of fan i, the rest follow it.
+ */
+const Point* FanBatch::fan(const int i) const
+{
+    return points.data() + offsets[i];
+}
+
+/**
+ * Builds the triangle fan of every light, same as getClosestIntersectionOfRays() on each.
+ *
+ * All lights share the read-only BVH and one vertex list. Lights are spread over the pool
+ * with work stealing, since a light in a cluttered corner costs far more than one in an
+ * open room. Each thread collects its fans in its own buffer, and they are then copied
+ * out in light order, so fans hold the same result no matter how the work was split.
+ */
+void getClosestIntersectionOfRaysBatch(const Point* rayBases, const int rayBaseCount, const BVH& bvh, FanBatch& fans, ThreadPool& pool)
+{
+    struct FanRecord
+    {
+        int light, first, count;
+    };
+
+    struct ThreadFans
+    {
+        std::vector<Point> points;
+        std::vector<FanRecord> records;
+        std::vector<Point> fan;
+    };
+
+    std::vector<Point> vertices;
+    getVertices(bvh.getLineSegments(), vertices);
+
+    std::vector<ThreadFans> perThread(pool.size());
+
+    pool.parallelForStealing(rayBaseCount, [&](const int light, const int thread)
+    {
+        ThreadFans& own = perThread[thread];
+
+        own.fan.clear();
+        getClosestIntersectionOfRays(rayBases[light], vertices, [&](const Ray r, Point& result)
+        {
+            return getClosestIntersection(r, bvh, result);
+        }, own.fan);
+
+        own.records.push_back({ light, (int) own.points.size(), (int) own.fan.size() });
+        own.points.insert(own.points.end(), own.fan.begin(), own.fan.end());
+    });
+
+    // Offsets by light order, then copy each fan into place
+    std::vector<const FanRecord*> byLight(rayBaseCount, nullptr);
+    std::vector<const ThreadFans*> owner(rayBaseCount, nullptr);
+    for (const ThreadFans& own : perThread)
+    {
+        for (const FanRecord& record : own.records)
+        {
+            byLight[record.light] = &record;
+            owner[record.light] = &own;
+        }
+    }
+
+    fans.offsets.assign(rayBaseCount + 1, 0);
+    for (int light = 0; light < rayBaseCount; light++)
+    {
+        fans.offsets[light + 1] = fans.offsets[light] + byLight[light]->count;
+    }
+
+    fans.points.resize(fans.offsets[rayBaseCount]);
+    for (int light = 0; light < rayBaseCount; light++)
+    {
+        const Point* first = owner[light]->points.data() + byLight[light]->first;
+        std::copy(first, first + byLight[light]->count, fans.points.begin() + fans.offsets[light]);
+    }
+}
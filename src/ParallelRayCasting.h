@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+#include "RayCasting.h"
+#include "ThreadPool.h"
+#include "BVH.h"
+
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const ClosestIntersectionQuery& getClosest, std::vector<Point>& closestIntersections, ThreadPool& pool);
+
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, ThreadPool& pool);
+
+// Fans of many lights, back to back in one buffer
+struct FanBatch
+{
+    std::vector<Point> points;
+    std::vector<int> offsets; // fan i is points[offsets[i], offsets[i + 1])
+
+    int size() const;
+    int fanSize(const int i) const;
+    const Point* fan(const int i) const;
+};
+
+void hasLineOfSight(const std::vector<LineSegment>& sightLines, const BVH& bvh, std::vector<char>& visible, ThreadPool& pool);
+
+void getClosestIntersectionOfRaysBatch(const Point* rayBases, const int rayBaseCount, const BVH& bvh, FanBatch& fans, ThreadPool& pool);
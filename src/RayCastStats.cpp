@@ -0,0 +1,143 @@
+#include <mutex>
+#include "RayCastStats.h"
+
+/**
+ * Creates stats with every counter and timer at zero.
+ */
+RayCastStats::RayCastStats()
+{
+#define RAYCAST_STATS_ZERO(name, comment) name = 0;
+    RAYCAST_STATS_FIELDS(RAYCAST_STATS_ZERO)
+#undef RAYCAST_STATS_ZERO
+}
+
+/**
+ * Adds the other stats to these. Maxima are combined as a maximum, the rest are summed.
+ */
+RayCastStats& RayCastStats::operator+=(const RayCastStats& other)
+{
+    const unsigned long long maxSortSizeBefore = maxSortSize;
+
+#define RAYCAST_STATS_ADD(name, comment) name += other.name;
+    RAYCAST_STATS_FIELDS(RAYCAST_STATS_ADD)
+#undef RAYCAST_STATS_ADD
+
+    maxSortSize = std::max(maxSortSizeBefore, other.maxSortSize);
+
+    return *this;
+}
+
+#ifdef RAYCAST_STATS
+
+// Every thread counts into its own stats, which are summed when asked for
+static std::mutex registryMutex;
+static std::vector<RayCastStats*> liveStats;
+static RayCastStats finishedStats; // of threads that have exited
+
+struct ThreadRayCastStats
+{
+    RayCastStats stats;
+
+    ThreadRayCastStats()
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        liveStats.push_back(&stats);
+    }
+
+    ~ThreadRayCastStats()
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        finishedStats += stats;
+        liveStats.erase(std::find(liveStats.begin(), liveStats.end(), &stats));
+    }
+};
+
+RayCastStats& threadRayCastStats()
+{
+    thread_local ThreadRayCastStats local;
+
+    return local.stats;
+}
+
+RayCastTimer::RayCastTimer(unsigned long long RayCastStats::* field) : field(field), start(std::chrono::steady_clock::now()) {}
+
+RayCastTimer::~RayCastTimer()
+{
+    threadRayCastStats().*field += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Counts each doubling of the capacity as one allocation, which is how push_back() grows
+ * a vector. A single reserve() or assign() that grows it more is counted the same way.
+ */
+RayCastGrowthWatch::~RayCastGrowthWatch()
+{
+    size_t capacity = before;
+    const size_t after = capacityOf(vector);
+    while (capacity < after)
+    {
+        capacity = capacity == 0 ? 1 : 2 * capacity;
+        threadRayCastStats().allocations++;
+    }
+}
+
+bool rayCastStatsEnabled()
+{
+    return true;
+}
+
+/**
+ * Returns the stats of all threads together since the last reset.
+ *
+ * Threads write their counters without locking, so take snapshots while no queries run
+ * (between frames, or after a benchmark case); counts of queries in flight may be missed.
+ */
+RayCastStats getRayCastStats()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    RayCastStats total = finishedStats;
+    for (const RayCastStats* stats : liveStats)
+    {
+        total += *stats;
+    }
+
+    return total;
+}
+
+/**
+ * Sets the stats of all threads back to zero. Same as getRayCastStats(), call it while no
+ * queries run.
+ */
+void resetRayCastStats()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    finishedStats = RayCastStats();
+    for (RayCastStats* stats : liveStats)
+    {
+        *stats = RayCastStats();
+    }
+}
+
+#else
+
+/**
+ * Returns false when the instrumentation is compiled out.
+ */
+bool rayCastStatsEnabled()
+{
+    return false;
+}
+
+/**
+ * Returns all zero stats, nothing is counted in this build.
+ */
+RayCastStats getRayCastStats()
+{
+    return RayCastStats();
+}
+
+void resetRayCastStats() {}
+
+#endif
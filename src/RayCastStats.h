@@ -0,0 +1,97 @@
+#pragma once
+
+// Counters and timers of the ray casting functions. They are only kept when built with
+// -DRAYCAST_STATS (make DEFINES=-DRAYCAST_STATS), otherwise the macros below compile to
+// nothing and the stats stay zero.
+
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+// X(name, comment) for every field of RayCastStats
+#define RAYCAST_STATS_FIELDS(X) \
+    X(raysCast,       "closest hit queries") \
+    X(sightQueries,   "line of sight queries") \
+    X(segmentTests,   "ray and line segment intersection tests") \
+    X(culledSegments, "line segments out of a light's range or cone") \
+    X(boundRejects,   "line segments past the hit of a ray's hint, not tested") \
+    X(hits,           "tests where the ray hit the line segment") \
+    X(parallelCases,  "line segment parallel to the ray and apart from it") \
+    X(collinearCases, "line segment on the ray's line") \
+    X(exactPredicates, "orientations too close to call in doubles, summed exactly") \
+    X(sorts,          "angular sorts of a fan") \
+    X(sortedPoints,   "points in those sorts") \
+    X(maxSortSize,    "most points in one sort") \
+    X(allocations,    "times a working buffer grew") \
+    X(vertexNs,       "time spent finding vertices for a fan") \
+    X(castNs,         "time spent casting the rays of a fan") \
+    X(sortNs,         "time spent sorting fans by angle")
+
+struct RayCastStats
+{
+#define RAYCAST_STATS_DECLARE(name, comment) unsigned long long name;
+    RAYCAST_STATS_FIELDS(RAYCAST_STATS_DECLARE)
+#undef RAYCAST_STATS_DECLARE
+
+    RayCastStats();
+
+    RayCastStats& operator+=(const RayCastStats& other);
+};
+
+bool rayCastStatsEnabled();
+RayCastStats getRayCastStats();
+void resetRayCastStats();
+
+#ifdef RAYCAST_STATS
+
+// What the calling thread counted since the last reset. Only that thread writes it.
+RayCastStats& threadRayCastStats();
+
+// Adds the time until the end of the scope to a field
+class RayCastTimer
+{
+private:
+    unsigned long long RayCastStats::* field;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    RayCastTimer(unsigned long long RayCastStats::* field);
+    ~RayCastTimer();
+};
+
+// Counts how often a vector's buffer grew until the end of the scope
+class RayCastGrowthWatch
+{
+private:
+    const void* vector;
+    size_t (*capacityOf)(const void* vector);
+    size_t before;
+
+    template <typename T>
+    static size_t capacityOfVector(const void* vector)
+    {
+        return static_cast<const std::vector<T>*>(vector)->capacity();
+    }
+
+public:
+    template <typename T>
+    RayCastGrowthWatch(const std::vector<T>& v) : vector(&v), capacityOf(&capacityOfVector<T>), before(v.capacity()) {}
+    ~RayCastGrowthWatch();
+};
+
+#define RAYCAST_CONCAT_(a, b) a##b
+#define RAYCAST_CONCAT(a, b) RAYCAST_CONCAT_(a, b)
+
+#define RAYCAST_COUNT(field, n) (threadRayCastStats().field += (n))
+#define RAYCAST_MAX(field, n) (threadRayCastStats().field = std::max<unsigned long long>(threadRayCastStats().field, (n)))
+#define RAYCAST_TIME(field) RayCastTimer RAYCAST_CONCAT(rayCastTimer, __LINE__)(&RayCastStats::field)
+#define RAYCAST_WATCH_GROWTH(v) RayCastGrowthWatch RAYCAST_CONCAT(rayCastGrowth, __LINE__)(v)
+
+#else
+
+#define RAYCAST_COUNT(field, n) ((void) 0)
+#define RAYCAST_MAX(field, n) ((void) 0)
+#define RAYCAST_TIME(field) ((void) 0)
+#define RAYCAST_WATCH_GROWTH(v) ((void) 0)
+
+#endif
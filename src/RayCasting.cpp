@@ -1,7 +1,10 @@
 #include <cmath>
 #include <algorithm>
 #include <stdexcept>
+#include <functional>
 #include "RayCasting.h"
+#include "RayCastStats.h"
+#include "UniformRays.h"
 #include <iostream>
 
 bool almostEqual(float a, float b, float epsilon = 1e-5f) {
@@ -36,6 +39,18 @@ float Point::distSquared(const Point other) const
     return (other.x - x) * (other.x - x) + (other.y - y) * (other.y - y);
 }
 
+/**
+ * Hashes both coordinates. Equal points hash the same, also 0 and -0.
+ */
+size_t PointHash::operator()(const Point& p) const
+{
+    const std::hash<float> hash;
+    size_t h = hash(p.x);
+    h ^= hash(p.y) + 0x9e3779b9 + (h << 6) + (h >> 2);
+
+    return h;
+}
+
 /**
  * Creates the default line, a horizontal line that goes through the origin.
  */
@@ -376,6 +391,38 @@ RayDirection Ray::getDirection() const
     }
 }
 
+/**
+ * Returns the unit vector in the direction the ray goes.
+ * 
+ * Rays that go exactly along an axis (N, E, S, W) get an exact direction,
+ * so that their intersections do not pick up error from cos() and sin().
+ */
+Point Ray::direction() const
+{
+    const RayDirection dir = getDirection();
+
+    if (dir == RayDirection::N)
+    {
+        return Point(0, 1);
+    }
+    else if (dir == RayDirection::E)
+    {
+        return Point(1, 0);
+    }
+    else if (dir == RayDirection::S)
+    {
+        return Point(0, -1);
+    }
+    else if (dir == RayDirection::W)
+    {
+        return Point(-1, 0);
+    }
+    else
+    {
+        return Point(std::cos(angle), std::sin(angle));
+    }
+}
+
 /**
  * Checks if point has x- or y-overlap with ray.
  * 
@@ -544,6 +591,290 @@ void getAllIntersectionsOfRay(const Ray r, const std::vector<LineSegment>& lineS
     intersectionPoints.erase(std::unique(intersectionPoints.begin(), intersectionPoints.end()), intersectionPoints.end());
 }
 
+/**
+ * Returns the 2D cross product (z-component) of vectors u and v.
+ */
+static inline float cross(const Point u, const Point v)
+{
+    return u.x * v.y - u.y * v.x;
+}
+
+/**
+ * Returns the dot product of vectors u and v.
+ */
+static inline float dot(const Point u, const Point v)
+{
+    return u.x * v.x + u.y * v.y;
+}
+
+/**
+ * Returns the sign of the sum of the terms, with no rounding: 1, -1 or 0.
+ *
+ * The terms are added into an expansion, a sum of doubles that do not overlap, where each
+ * rounding error is kept as a smaller term (Shewchuk's grow-expansion). The largest term of
+ * the expansion has the sign of the whole sum.
+ */
+static int signOfSum(const double* terms, const int count)
+{
+    double expansion[8];
+    int length = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        double q = terms[i];
+        int kept = 0;
+        for (int j = 0; j < length; j++)
+        {
+            // sum + error is exactly q + expansion[j]
+            const double sum = q + expansion[j];
+            const double virtualB = sum - q;
+            const double virtualA = sum - virtualB;
+            const double error = (q - virtualA) + (expansion[j] - virtualB);
+            q = sum;
+            if (error != 0)
+            {
+                expansion[kept++] = error;
+            }
+        }
+        if (q != 0)
+        {
+            expansion[kept++] = q;
+        }
+        length = kept;
+    }
+
+    return length == 0 ? 0 : expansion[length - 1] > 0 ? 1 : -1;
+}
+
+/**
+ * Returns 1 if c is to the left of the line from a to b (a, b, c turn counterclockwise),
+ * -1 if it is to the right and 0 if it is on the line. Always exact.
+ *
+ * The determinant is first worked out in doubles. Only when it is too close to zero for
+ * its rounding error bound to tell the sign, it is summed again exactly, from the six
+ * products of coordinates, which doubles hold with no rounding.
+ */
+int orient2d(const Point a, const Point b, const Point c)
+{
+    const double left = ((double) a.x - c.x) * ((double) b.y - c.y);
+    const double right = ((double) a.y - c.y) * ((double) b.x - c.x);
+    const double det = left - right;
+
+    // Error bound of the determinant in doubles, from Shewchuk's orient2d
+    const double bound = (3 + 16 * 0x1p-53) * 0x1p-53 * (std::fabs(left) + std::fabs(right));
+    if (det > bound || -det > bound)
+    {
+        return det > 0 ? 1 : -1;
+    }
+
+    RAYCAST_COUNT(exactPredicates, 1);
+
+    const double terms[6] = {
+        (double) a.x * b.y, -((double) a.y * b.x),
+        (double) b.x * c.y, -((double) b.y * c.x),
+        (double) c.x * a.y, -((double) c.y * a.x)
+    };
+
+    return signOfSum(terms, 6);
+}
+
+/**
+ * Checks if p is on the line segment, endpoints included. Exact, see orient2d().
+ */
+bool isOnLineSegment(const Point p, const LineSegment& ls)
+{
+    return std::min(ls.a.x, ls.b.x) <= p.x && p.x <= std::max(ls.a.x, ls.b.x) &&
+           std::min(ls.a.y, ls.b.y) <= p.y && p.y <= std::max(ls.a.y, ls.b.y) &&
+           orient2d(ls.a, ls.b, p) == 0;
+}
+
+/**
+ * Intersects a ray, given by its base and direction, with the line segment.
+ * 
+ * Solves base + t * dir = ls.a + u * (ls.b - ls.a), with no trig.
+ * 
+ * Returns:
+ *   One  - the lines cross at a single point, t and u are set.
+ *   Many - the segment lies on the ray's line. t and u are set to the ray
+ *          parameters of ls.a and ls.b respectively.
+ *   Zero - the lines are parallel and apart, t and u are untouched.
+ * 
+ * Note: does not check t and u against the ray or segment ranges, that is up to the caller.
+ */
+IntersectionCount intersectRayLineSegment(const Point base, const Point dir, const LineSegment& ls, float& t, float& u)
+{
+    const Point e = Point(ls.b.x - ls.a.x, ls.b.y - ls.a.y);
+    const Point ba = Point(ls.a.x - base.x, ls.a.y - base.y);
+    const float denom = cross(dir, e);
+
+    // Parallel (or degenerate segment), tolerance is relative to segment length
+    if (std::fabs(denom) <= 1e-6f * (std::fabs(e.x) + std::fabs(e.y)))
+    {
+        // Collinear: ls.a lies on the ray's line
+        if (std::fabs(cross(ba, dir)) <= 1e-6f * (std::fabs(ba.x) + std::fabs(ba.y)))
+        {
+            RAYCAST_COUNT(collinearCases, 1);
+            t = dot(ba, dir);
+            u = dot(Point(ls.b.x - base.x, ls.b.y - base.y), dir);
+            return IntersectionCount::Many;
+        }
+
+        RAYCAST_COUNT(parallelCases, 1);
+        return IntersectionCount::Zero;
+    }
+
+    t = cross(ba, e) / denom;
+    u = cross(ba, dir) / denom;
+
+    return IntersectionCount::One;
+}
+
+/**
+ * Returns the point at parameter t on the ray, which is also at parameter u on the line segment.
+ * 
+ * Coordinates that are fixed by an axis-aligned ray or segment, or by a hit exactly on
+ * an endpoint, are copied exactly instead of being recomputed.
+ */
+static Point parametricIntersectionPoint(const Point base, const Point dir, const LineSegment& ls, const float t, const float u)
+{
+    if (u == 0)
+    {
+        return ls.a;
+    }
+    if (u == 1)
+    {
+        return ls.b;
+    }
+
+    Point inter = Point(base.x + t * dir.x, base.y + t * dir.y);
+
+    if (dir.x == 0)
+    {
+        inter.x = base.x;
+    }
+    else if (ls.a.x == ls.b.x)
+    {
+        inter.x = ls.a.x;
+    }
+
+    if (dir.y == 0)
+    {
+        inter.y = base.y;
+    }
+    else if (ls.a.y == ls.b.y)
+    {
+        inter.y = ls.a.y;
+    }
+
+    return inter;
+}
+
+/**
+ * Calculates the closest point at which the ray, given by its base and direction, hits the line segment.
+ * 
+ * Sets t to the ray parameter of that point and hit to the point. A segment that lies on the ray
+ * is hit at its closest endpoint, or at the base if the base is between its endpoints.
+ * 
+ * Returns true if the ray hits the line segment, else false and t and hit are meaningless.
+ */
+bool closestIntersectionOfRayAndLineSegment(const Point base, const Point dir, const LineSegment& ls, float& t, Point& hit)
+{
+    RAYCAST_COUNT(segmentTests, 1);
+
+    float u;
+    IntersectionCount count = intersectRayLineSegment(base, dir, ls, t, u);
+
+    if (count == IntersectionCount::One)
+    {
+        if (t >= 0 && u >= 0 && u <= 1)
+        {
+            RAYCAST_COUNT(hits, 1);
+            hit = parametricIntersectionPoint(base, dir, ls, t, u);
+            return true;
+        }
+    }
+    else if (count == IntersectionCount::Many) // t and u are ray parameters of ls.a and ls.b
+    {
+        if (t >= 0 && u >= 0)
+        {
+            RAYCAST_COUNT(hits, 1);
+            hit = t <= u ? ls.a : ls.b;
+            t = t <= u ? t : u;
+            return true;
+        }
+        else if (t >= 0 || u >= 0)
+        {
+            RAYCAST_COUNT(hits, 1);
+            hit = base;
+            t = 0;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Calculates the intersections points between the ray and each line segment.
+ * 
+ * Same results as getAllIntersectionsOfRay(), but uses direction vectors and
+ * cross products instead of building a Line for the ray and each segment.
+ * The ray's direction is computed once, so there is no trig in the loop.
+ */
+void getAllIntersectionsOfRayParametric(const Ray r, const std::vector<LineSegment>& lineSegments, std::vector<Point>& intersectionPoints, std::vector<LineSegment>& intersectionLineSegments)
+{
+    const Point dir = r.direction();
+
+    for (const LineSegment& ls : lineSegments)
+    {
+        float t, u;
+        IntersectionCount count = intersectRayLineSegment(r.base, dir, ls, t, u);
+
+        if (count == IntersectionCount::Zero)
+        {
+            // Ray and line segment are parallel and do not overlap
+            continue;
+        }
+        else if (count == IntersectionCount::One)
+        {
+            if (t >= 0 && u >= 0 && u <= 1)
+            {
+                intersectionPoints.push_back(parametricIntersectionPoint(r.base, dir, ls, t, u));
+            }
+        }
+        else // many intersections, t and u are ray parameters of ls.a and ls.b
+        {
+            // ray intersects with entire line segment
+            if (t >= 0 && u >= 0)
+            {
+                intersectionLineSegments.push_back(ls);
+            }
+            // ray's base is a point between the endpoints of the line segment [base, ls.a]
+            else if (t >= 0)
+            {
+                intersectionLineSegments.push_back(LineSegment(ls.a, r.base));
+            }
+            // ray's base is a point between the endpoints of the line segment [base, ls.b]
+            else if (u >= 0)
+            {
+                intersectionLineSegments.push_back(LineSegment(ls.b, r.base));
+            }
+            else // ray does not intersect with line segment
+            {
+                continue;
+            }
+        }
+    }
+
+    // Sort points by x first, then by y if x values are equal
+    std::sort(intersectionPoints.begin(), intersectionPoints.end(), [](const Point& a, const Point& b) {
+        return (a.x < b.x) || (a.x == b.x && a.y < b.y);
+    });
+
+    // Remove duplicates using std::unique, which will use operator==
+    intersectionPoints.erase(std::unique(intersectionPoints.begin(), intersectionPoints.end()), intersectionPoints.end());
+}
+
 /**
  * Calculates the intersection points for each ray on each line segment.
  * 
@@ -575,7 +906,9 @@ std::vector<Ray> getAllIntersectionsOfRays(const Point rayBase, const int rayCou
 /**
  * Calculates the CLOSEST intersection point for each ray. Essentially, the triangle fan.
  * 
- * Rays are cast at equally spaced angled intervals starting from angle 0 radian.
+ * Rays are cast at equally spaced angled intervals starting from angle 0 radian. For 64,
+ * 256, 1024 and 4096 rays the directions come from a table instead of cos() and sin(),
+ * see UniformRays.h.
  */
 void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections)
 {   
@@ -583,28 +916,19 @@ void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, cons
     {
         return;
     }
+    if (getClosestIntersectionsOfTabledRays(rayBase, rayCount, lineSegments, closestIntersections))
+    {
+        return;
+    }
 
     float angleBetweenRays = 2 * PI / rayCount;
     for (int i = 0; i <rayCount; i++)
     {
-        Ray r = Ray(angleBetweenRays * i, rayBase);
-        std::vector<Point> pointIntersectionsForCurentRay;
-        std::vector<LineSegment> lineSegmentsIntersectionsForCurrentRay;
-        getAllIntersectionsOfRay(r, lineSegments, pointIntersectionsForCurentRay, lineSegmentsIntersectionsForCurrentRay);
-
-        for (auto ls : lineSegmentsIntersectionsForCurrentRay)
+        Point closest;
+        if (getClosestIntersection(Ray(angleBetweenRays * i, rayBase), lineSegments, closest))
         {
-            pointIntersectionsForCurentRay.push_back(ls.a);
-            pointIntersectionsForCurentRay.push_back(ls.b);
-        }
-
-        // No intersection
-        if (pointIntersectionsForCurentRay.size() == 0)
-        {
-            continue;
+            closestIntersections.push_back(closest);
         }
-
-        closestIntersections.push_back(r.closestPointOnRay(pointIntersectionsForCurentRay));
     }
 }
 
@@ -613,148 +937,963 @@ void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, cons
  */
 void getVertices(const std::vector<LineSegment>& lineSegments, std::vector<Point>& vertices)
 {
-    for (auto ls : lineSegments)
+    std::vector<int> table;
+
+    getVertices(lineSegments, vertices, table);
+}
+
+/**
+ * Same as getVertices(), but the hash table's slots live in table, so a reused table does
+ * not allocate.
+ * 
+ * Vertices are appended in the order they first appear, and vertices already in the list
+ * are not added again. Takes O(N) instead of checking every vertex found so far.
+ */
+void getVertices(const std::vector<LineSegment>& lineSegments, std::vector<Point>& vertices, std::vector<int>& table)
+{
+    RAYCAST_WATCH_GROWTH(vertices);
+    RAYCAST_WATCH_GROWTH(table);
+
+    size_t size = 16;
+    while (size < 2 * (vertices.size() + 2 * lineSegments.size()))
     {
-        // Check if endpoint a of line segment is already in list
-        bool foundPointA = false;
-        for (auto v : vertices)
+        size *= 2;
+    }
+    table.assign(size, -1);
+
+    // Open addressing, each slot is -1 or a position in vertices. Vertex is p's position if
+    // it is already in the list, else -1 to append it.
+    const PointHash hash;
+    auto insert = [&](const Point p, const int vertex)
+    {
+        size_t slot = hash(p) & (size - 1);
+        while (table[slot] >= 0)
         {
-            if (ls.a == v)
+            if (vertices[table[slot]] == p)
             {
-                foundPointA = true;
-                break;
+                return;
             }
+            slot = (slot + 1) & (size - 1);
         }
 
-        // If endpoint a is not in list yet, add it now
-        if (!foundPointA)
+        table[slot] = vertex >= 0 ? vertex : (int) vertices.size();
+        if (vertex < 0)
         {
-            vertices.push_back(ls.a);
+            vertices.push_back(p);
         }
+    };
 
-        // Check if endpoint b of line segment is already in list
-        bool foundPointB = false;
-        for (auto v : vertices)
-        {
-            if (ls.b == v)
-            {
-                foundPointB = true;
-                break;
-            }
-        }
+    for (int i = 0; i < (int) vertices.size(); i++)
+    {
+        insert(vertices[i], i);
+    }
 
-        // If endpoint b is not in list yet, add it now
-        if (!foundPointB)
-        {
-            vertices.push_back(ls.b);
-        }
+    for (const LineSegment& ls : lineSegments)
+    {
+        insert(ls.a, -1);
+        insert(ls.b, -1);
     }
 }
 
 /**
  * Calculates the closest intersection of ray and sets it to result.
  * 
+ * See SegmentStore.h for an overload that takes a packed segment store.
+ * 
  * Returns true if intersection found, else false if no intersection was found.
  */
 bool getClosestIntersection(const Ray r, const std::vector<LineSegment> & lineSegments, Point& result)
 {
-    std::vector<Point> intersectionPoints;
-    std::vector<LineSegment> intersectionLineSegments;
+    return getClosestIntersection(r.base, r.direction(), lineSegments, result);
+}
 
-    // get intersection points and intersection line segments
-    getAllIntersectionsOfRay(r, lineSegments, intersectionPoints, intersectionLineSegments);
+/**
+ * Same as getClosestIntersection(), for the ray given by its base and unit direction, so a
+ * caller with a table of directions needs no trig.
+ */
+bool getClosestIntersection(const Point rayBase, const Point dir, const std::vector<LineSegment>& lineSegments, Point& result)
+{
+    RAYCAST_COUNT(raysCast, 1);
 
-    for (auto ls : intersectionLineSegments)
-    {
-        // Ray intersects with entire line segment
-        // Only the endpoints are needed since 
-        // we are looking for closest intersection point of ray 
-        intersectionPoints.push_back(ls.a);
-        intersectionPoints.push_back(ls.b);
-    }
+    float closestT = 0;
+    bool found = false;
 
-    // Ray does not intersect with any line segment
-    if (intersectionPoints.size() == 0)
+    // Same closest point as collecting all intersections with getAllIntersectionsOfRay(),
+    // but keeps only the best so far, so nothing is allocated
+    for (const LineSegment& ls : lineSegments)
     {
-        return false;
+        float t;
+        Point hit;
+        if (closestIntersectionOfRayAndLineSegment(rayBase, dir, ls, t, hit) && (!found || t < closestT))
+        {
+            closestT = t;
+            result = hit;
+            found = true;
+        }
     }
 
-    // get closest intersection point
-    result = r.closestPointOnRay(intersectionPoints);
-
-    return true;
+    return found;
 }
 
 /**
- * Casts 3 rays at each vertex of each line segment.
- * 
- * One directly at it, one slightly to its left, and one slightly to its right. 
- * Only the closest intersections of each ray are returned.
- * The points are sorted by angle.
+ * Same as getClosestIntersection(), but the line segment at hint is tested first, the one
+ * the ray hit last frame. Its hit bounds the ray, so the other line segments whose bounding
+ * box is apart from the ray up to there are skipped with a few comparisons, no intersection
+ * test. A light that moved a little hits mostly the same line segments each frame, which
+ * leaves only the few segments near the ray to test.
+ *
+ * The result is the same whatever the hint, a stale one only skips fewer line segments.
+ * Sets hint to the index of the line segment hit, or -1 if none was.
  */
-void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections)
+bool getClosestIntersection(const Ray r, const std::vector<LineSegment>& lineSegments, Point& result, int& hint)
 {
-    std::vector<Point> vertices;
+    return getClosestIntersection(r.base, r.direction(), lineSegments, result, hint);
+}
 
-    getVertices(lineSegments, vertices);
+/**
+ * Same as the hinted getClosestIntersection(), for the ray given by its base and unit direction.
+ */
+bool getClosestIntersection(const Point rayBase, const Point dir, const std::vector<LineSegment>& lineSegments, Point& result, int& hint)
+{
+    RAYCAST_COUNT(raysCast, 1);
 
-    const float delta = 0.0001f; // radians
+    float closestT = 0;
+    int closest = -1;
 
-    for (auto v : vertices)
+    if (hint >= 0 && hint < (int) lineSegments.size() && closestIntersectionOfRayAndLineSegment(rayBase, dir, lineSegments[hint], closestT, result))
     {
-        // Inside line segment
-        if (v == rayBase)
-        {
-            closestIntersections.clear();
-            return;
-        }
-
-        // Cast rays: one directly at v, one slightly to its left, another slightly to its right
-        const Ray direct = Ray(rayBase, v);
-        const Ray counterClockwise = Ray(direct.angle + delta, rayBase);
-        const Ray clockwise = Ray(direct.angle - delta, rayBase);
+        closest = hint;
+    }
 
-        // closest intersection points of rays
-        Point intDirect;
-        Point intCounterClockwise;
-        Point intClockwise;
+    // Box of the ray up to the closest hit so far, padded so a hit at the same distance
+    // (a shared endpoint) is not skipped
+    float minX = 0, minY = 0, maxX = 0, maxY = 0;
+    auto bound = [&]()
+    {
+        const Point end = Point(rayBase.x + closestT * dir.x, rayBase.y + closestT * dir.y);
+        const float pad = 1e-4f * (std::fabs(end.x) + std::fabs(end.y) + std::fabs(rayBase.x) + std::fabs(rayBase.y)) + 1e-6f;
+        minX = std::min(rayBase.x, end.x) - pad;
+        maxX = std::max(rayBase.x, end.x) + pad;
+        minY = std::min(rayBase.y, end.y) - pad;
+        maxY = std::max(rayBase.y, end.y) + pad;
+    };
+    if (closest >= 0)
+    {
+        bound();
+    }
 
-        // Direct ray at v
-        if (getClosestIntersection(direct, lineSegments, intDirect))
-        {
-            // Very important code: due to floating point errors, ray cast directly at v may not actual go through v.
-            // This code fixes this problem!
-            if (rayBase.distSquared(v) < rayBase.distSquared(intDirect))
-            {
-                closestIntersections.push_back(v);
-            }
-            else
-            {
-                closestIntersections.push_back(intDirect);
-            }
-        }
-        // Ray cast slightly to v's left
-        if (getClosestIntersection(counterClockwise, lineSegments, intCounterClockwise))
+    for (int i = 0; i < (int) lineSegments.size(); i++)
+    {
+        const LineSegment& ls = lineSegments[i];
+        if (i == hint)
         {
-            closestIntersections.push_back(intCounterClockwise);
+            continue;
         }
-        // Ray cast slightly to v's right
-        if (getClosestIntersection(clockwise, lineSegments, intClockwise))
+        if (closest >= 0 && (std::max(ls.a.x, ls.b.x) < minX || std::min(ls.a.x, ls.b.x) > maxX ||
+                             std::max(ls.a.y, ls.b.y) < minY || std::min(ls.a.y, ls.b.y) > maxY))
         {
-            closestIntersections.push_back(intClockwise);
+            RAYCAST_COUNT(boundRejects, 1);
+            continue;
         }
 
-        // Inside line segment
-        if ((intDirect == rayBase) || (intCounterClockwise == rayBase) || (intClockwise == rayBase))
+        // Ties go to the lower index, as in the scan without a hint
+        float t;
+        Point hit;
+        if (closestIntersectionOfRayAndLineSegment(rayBase, dir, ls, t, hit) && (closest < 0 || t < closestT || (t == closestT && i < closest)))
         {
-            closestIntersections.clear();
-            return;
+            closestT = t;
+            closest = i;
+            result = hit;
+            bound();
         }
     }
 
-    // Sort points by angle to create triangle fan
-    std::sort(closestIntersections.begin(), closestIntersections.end(), [&](Point &a, Point& b)
+    hint = closest;
+
+    return closest >= 0;
+}
+
+/**
+ * Same as getClosestIntersectionsOfRays(), with each ray hinted by the line segment it hit
+ * in the last call, see getClosestIntersection(). Keep hints from frame to frame, with the
+ * same rayCount, for a light that moves a little at a time. Hints of another size are
+ * reset, so an empty one is fine for the first frame.
+ */
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, std::vector<int>& hints)
+{
+    if (rayCount == 0)
+    {
+        return;
+    }
+    if ((int) hints.size() != rayCount)
+    {
+        hints.assign(rayCount, -1);
+    }
+    if (getClosestIntersectionsOfTabledRays(rayBase, rayCount, lineSegments, closestIntersections, hints))
+    {
+        return;
+    }
+
+    float angleBetweenRays = 2 * PI / rayCount;
+    for (int i = 0; i < rayCount; i++)
+    {
+        Point closest;
+        if (getClosestIntersection(Ray(angleBetweenRays * i, rayBase), lineSegments, closest, hints[i]))
+        {
+            closestIntersections.push_back(closest);
+        }
+    }
+}
+
+/**
+ * Checks if the line segment blocks the view from a to b, that is if it crosses or
+ * touches segment ab anywhere but at a and b. A line segment lying along ab blocks it
+ * if the two overlap.
+ *
+ * a and b themselves may be on a line segment (a light on a wall, a corner seen from
+ * afar), so hits within 1e-5 of the length of ab from either end do not count.
+ */
+bool blocksLineOfSight(const Point a, const Point b, const LineSegment& ls)
+{
+    RAYCAST_COUNT(segmentTests, 1);
+
+    // Cheap reject: bounding boxes apart
+    if (std::max(ls.a.x, ls.b.x) < std::min(a.x, b.x) || std::min(ls.a.x, ls.b.x) > std::max(a.x, b.x) ||
+        std::max(ls.a.y, ls.b.y) < std::min(a.y, b.y) || std::min(ls.a.y, ls.b.y) > std::max(a.y, b.y))
+    {
+        return false;
+    }
+
+    const float end = 1e-5f;
+    const Point dir = Point(b.x - a.x, b.y - a.y);
+    const Point e = Point(ls.b.x - ls.a.x, ls.b.y - ls.a.y);
+    const Point ba = Point(ls.a.x - a.x, ls.a.y - a.y);
+    const float denom = cross(dir, e);
+
+    // Parallel, same tolerance as intersectRayLineSegment() with dir scaled to unit length
+    const float dirLength = std::sqrt(dot(dir, dir));
+    if (std::fabs(denom) <= 1e-6f * dirLength * (std::fabs(e.x) + std::fabs(e.y)))
+    {
+        if (dirLength == 0 || std::fabs(cross(ba, dir)) > 1e-6f * dirLength * (std::fabs(ba.x) + std::fabs(ba.y)))
+        {
+            return false;
+        }
+
+        // Collinear: overlap of the line segment's span along ab with (0, 1)
+        const float ta = dot(ba, dir) / dot(dir, dir);
+        const float tb = dot(Point(ls.b.x - a.x, ls.b.y - a.y), dir) / dot(dir, dir);
+        return std::max(ta, tb) > end && std::min(ta, tb) < 1 - end;
+    }
+
+    const float t = cross(ba, e) / denom;
+    const float u = cross(ba, dir) / denom;
+
+    return t > end && t < 1 - end && u >= 0 && u <= 1;
+}
+
+/**
+ * Checks if b can be seen from a, see blocksLineOfSight().
+ *
+ * Stops at the first line segment in the way, so it never collects or sorts
+ * intersections the way getAllIntersectionsOfRay() does.
+ */
+bool hasLineOfSight(const Point a, const Point b, const std::vector<LineSegment>& lineSegments)
+{
+    RAYCAST_COUNT(sightQueries, 1);
+
+    for (const LineSegment& ls : lineSegments)
+    {
+        if (blocksLineOfSight(a, b, ls))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Checks each line of sight, a sight line from ls.a to ls.b, and sets visible[i] to 1 if
+ * the i-th one is clear, else 0.
+ */
+void hasLineOfSight(const std::vector<LineSegment>& sightLines, const std::vector<LineSegment>& lineSegments, std::vector<char>& visible)
+{
+    visible.resize(sightLines.size());
+    for (int i = 0; i < (int) sightLines.size(); i++)
+    {
+        visible[i] = hasLineOfSight(sightLines[i].a, sightLines[i].b, lineSegments);
+    }
+}
+
+/**
+ * Casts 3 rays at each vertex of each line segment.
+ * 
+ * One directly at it, one slightly to its left, and one slightly to its right. 
+ * Only the closest intersections of each ray are returned.
+ * The points are sorted by angle.
+ */
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections)
+{
+    RayCastScratch scratch;
+
+    getClosestIntersectionOfRays(rayBase, lineSegments, closestIntersections, scratch);
+}
+
+/**
+ * Same as getClosestIntersectionOfRays(), but the working buffers live in scratch.
+ * 
+ * Reusing one scratch (and a cleared closestIntersections) across calls means no heap
+ * allocations once the buffers have grown to fit the map.
+ */
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, RayCastScratch& scratch)
+{
+    scratch.vertices.clear();
+
+    {
+        RAYCAST_TIME(vertexNs);
+        getVertices(lineSegments, scratch.vertices, scratch.vertexTable);
+    }
+
+    getClosestIntersectionOfRays(rayBase, scratch.vertices, [&](const Ray r, Point& result)
+    {
+        return getClosestIntersection(r, lineSegments, result);
+    }, closestIntersections);
+}
+
+/**
+ * Same as getClosestIntersectionOfRays(), with the vertices of the line segments already
+ * known, like the vertex table Map keeps. Nothing is derived from the line segments again.
+ */
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, const std::vector<Point>& vertices, std::vector<Point>& closestIntersections)
+{
+    getClosestIntersectionOfRays(rayBase, vertices, [&](const Ray r, Point& result)
+    {
+        return getClosestIntersection(r, lineSegments, result);
+    }, closestIntersections);
+}
+
+/**
+ * Casts 3 rays at each of the given vertices, same as the line segment version.
+ * 
+ * The closest intersection of each ray is found by getClosest, so any segment source
+ * (vector, SegmentStore, BVH, ...) can be used to build the fan.
+ */
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<Point>& vertices, const ClosestIntersectionQuery& getClosest, std::vector<Point>& closestIntersections)
+{
+    const float delta = 0.0001f; // radians
+
+    RAYCAST_WATCH_GROWTH(closestIntersections);
+    {
+        RAYCAST_TIME(castNs);
+
+        for (auto v : vertices)
+        {
+            // Inside line segment
+            if (v == rayBase)
+            {
+                closestIntersections.clear();
+                return;
+            }
+
+            // Cast rays: one directly at v, one slightly to its left, another slightly to its right
+            const Ray direct = Ray(rayBase, v);
+            const Ray counterClockwise = Ray(direct.angle + delta, rayBase);
+            const Ray clockwise = Ray(direct.angle - delta, rayBase);
+
+            // closest intersection points of rays
+            Point intDirect;
+            Point intCounterClockwise;
+            Point intClockwise;
+
+            // Direct ray at v
+            const bool hitDirect = getClosest(direct, intDirect);
+            if (hitDirect)
+            {
+                // Very important code: due to floating point errors, ray cast directly at v may not actual go through v.
+                // This code fixes this problem!
+                if (rayBase.distSquared(v) < rayBase.distSquared(intDirect))
+                {
+                    closestIntersections.push_back(v);
+                }
+                else
+                {
+                    closestIntersections.push_back(intDirect);
+                }
+            }
+            // Ray cast slightly to v's left
+            const bool hitCounterClockwise = getClosest(counterClockwise, intCounterClockwise);
+            if (hitCounterClockwise)
+            {
+                closestIntersections.push_back(intCounterClockwise);
+            }
+            // Ray cast slightly to v's right
+            const bool hitClockwise = getClosest(clockwise, intClockwise);
+            if (hitClockwise)
+            {
+                closestIntersections.push_back(intClockwise);
+            }
+
+            // Inside line segment. A ray that hit nothing leaves its point at (0,0), which is
+            // not a hit on the base even when the base is there.
+            if ((hitDirect && intDirect == rayBase) || (hitCounterClockwise && intCounterClockwise == rayBase) || (hitClockwise && intClockwise == rayBase))
+            {
+                closestIntersections.clear();
+                return;
+            }
+        }
+    }
+
+    // Sort points by angle to create triangle fan
+    RAYCAST_COUNT(sorts, 1);
+    RAYCAST_COUNT(sortedPoints, closestIntersections.size());
+    RAYCAST_MAX(maxSortSize, closestIntersections.size());
+    RAYCAST_TIME(sortNs);
+    std::sort(closestIntersections.begin(), closestIntersections.end(), [&](Point &a, Point& b)
     {
         return Ray(rayBase, a).toLine().normalizedAngle() > Ray(rayBase, b).toLine().normalizedAngle();
     });
-}
\ No newline at end of file
+}
+
+/**
+ * Returns the position of v in the vertex rays' order, by half turn around rayBase: 0 for
+ * angles in [π, 2π), 1 for angles in [0, π). Exact.
+ */
+static inline int halfTurn(const Point rayBase, const Point v)
+{
+    return v.y < rayBase.y || (v.y == rayBase.y && v.x < rayBase.x) ? 0 : 1;
+}
+
+/**
+ * Checks if a is closer to rayBase than b, for points in the same direction from it. Exact.
+ */
+static inline bool isCloserOnRay(const Point rayBase, const Point a, const Point b)
+{
+    if (a.x != b.x)
+    {
+        return a.x > rayBase.x ? a.x < b.x : a.x > b.x;
+    }
+
+    return a.y > rayBase.y ? a.y < b.y : a.y > b.y;
+}
+
+/**
+ * Returns the position of p in vertices, looked up in the hash table getVertices() left,
+ * or -1 if p is not there.
+ */
+static int findVertex(const std::vector<Point>& vertices, const std::vector<int>& table, const Point p)
+{
+    const size_t mask = table.size() - 1;
+    size_t slot = PointHash()(p) & mask;
+    while (table[slot] >= 0)
+    {
+        if (vertices[table[slot]] == p)
+        {
+            return table[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return -1;
+}
+
+/**
+ * Builds the same fan as getClosestIntersectionOfRays(), with a single ray at each vertex
+ * instead of three, see the scratch version.
+ */
+void getClosestIntersectionOfVertexRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections)
+{
+    RayCastScratch scratch;
+
+    getClosestIntersectionOfVertexRays(rayBase, lineSegments, closestIntersections, scratch);
+}
+
+/**
+ * Builds the same fan as getClosestIntersectionOfRays(), with a single ray at each vertex
+ * instead of three. The points are in the same order, by angle.
+ *
+ * The rays slightly to the left and right of a vertex only find out which sides of the
+ * vertex its own line segments block. That is known exactly from orient2d(): a line segment
+ * from v to w blocks the left side of the ray through v if w is to the left of the ray.
+ * So each ray skips the line segments that end on it, and finds the closest line segment
+ * that crosses it. Then the vertices on the ray are walked from the base out to that line
+ * segment: the fan goes on along the ray on each side until a vertex blocks it, else up to
+ * the hit. Vertices in the same direction share one ray.
+ *
+ * No angle is ever nudged, so no ray sweeps across geometry at large coordinates, and
+ * vertices that are hit end the fan exactly, not at a float error away from them.
+ *
+ * scratch holds the working buffers, as for getClosestIntersectionOfRays().
+ */
+void getClosestIntersectionOfVertexRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, RayCastScratch& scratch)
+{
+    const char counterclockwise = 1;
+    const char clockwise = 2;
+
+    std::vector<Point>& vertices = scratch.vertices;
+    std::vector<int>& endpoints = scratch.endpoints;
+    std::vector<char>& sides = scratch.sides;
+    std::vector<int>& order = scratch.order;
+    std::vector<int>& directions = scratch.directions;
+
+    vertices.clear();
+    {
+        RAYCAST_TIME(vertexNs);
+        getVertices(lineSegments, vertices, scratch.vertexTable);
+    }
+
+    RAYCAST_WATCH_GROWTH(closestIntersections);
+    RAYCAST_WATCH_GROWTH(endpoints);
+    RAYCAST_WATCH_GROWTH(sides);
+    RAYCAST_WATCH_GROWTH(order);
+    RAYCAST_WATCH_GROWTH(directions);
+
+    // Sides of the ray through each vertex that the vertex's own line segments block
+    endpoints.resize(2 * lineSegments.size());
+    sides.assign(vertices.size(), 0);
+    for (int i = 0; i < (int) lineSegments.size(); i++)
+    {
+        const LineSegment& ls = lineSegments[i];
+
+        // Inside line segment
+        if (isOnLineSegment(rayBase, ls))
+        {
+            closestIntersections.clear();
+            return;
+        }
+
+        const int a = findVertex(vertices, scratch.vertexTable, ls.a);
+        const int b = findVertex(vertices, scratch.vertexTable, ls.b);
+        endpoints[2 * i] = a;
+        endpoints[2 * i + 1] = b;
+
+        // On the ray's line, the line segment blocks neither side
+        const int turn = orient2d(rayBase, ls.a, ls.b);
+        if (turn != 0)
+        {
+            sides[a] |= turn > 0 ? counterclockwise : clockwise;
+            sides[b] |= turn > 0 ? clockwise : counterclockwise;
+        }
+    }
+
+    // Vertices by angle, same order as the fan of getClosestIntersectionOfRays(), closest
+    // first in the same direction
+    order.resize(vertices.size());
+    {
+        RAYCAST_COUNT(sorts, 1);
+        RAYCAST_COUNT(sortedPoints, vertices.size());
+        RAYCAST_MAX(maxSortSize, vertices.size());
+        RAYCAST_TIME(sortNs);
+
+        for (int i = 0; i < (int) order.size(); i++)
+        {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](const int i, const int j)
+        {
+            const Point a = vertices[i];
+            const Point b = vertices[j];
+            const int halfA = halfTurn(rayBase, a);
+            const int halfB = halfTurn(rayBase, b);
+            if (halfA != halfB)
+            {
+                return halfA < halfB;
+            }
+
+            const int turn = orient2d(rayBase, a, b);
+            return turn != 0 ? turn < 0 : isCloserOnRay(rayBase, a, b);
+        });
+    }
+
+    RAYCAST_TIME(castNs);
+
+    // Vertices in the same direction as the closest one share its ray
+    directions.resize(vertices.size());
+    for (int k = 0, first = 0; k < (int) order.size(); k++)
+    {
+        const Point v = vertices[order[k]];
+        const Point closestVertex = vertices[order[first]];
+        if (halfTurn(rayBase, v) != halfTurn(rayBase, closestVertex) || orient2d(rayBase, closestVertex, v) != 0)
+        {
+            first = k;
+        }
+        directions[order[k]] = first;
+    }
+
+    for (int first = 0, last; first < (int) order.size(); first = last)
+    {
+        const Point closestVertex = vertices[order[first]];
+        for (last = first + 1; last < (int) order.size() && directions[order[last]] == first; last++);
+
+        // Closest line segment that crosses the ray. Line segments that end on the ray are
+        // skipped, they are in sides.
+        RAYCAST_COUNT(raysCast, 1);
+        Point dir = Point(closestVertex.x - rayBase.x, closestVertex.y - rayBase.y);
+        const float length = std::sqrt(dot(dir, dir));
+        dir = Point(dir.x / length, dir.y / length);
+
+        float closestT = 0;
+        int closest = -1;
+        Point hit;
+        for (int i = 0; i < (int) lineSegments.size(); i++)
+        {
+            if (directions[endpoints[2 * i]] == first || directions[endpoints[2 * i + 1]] == first)
+            {
+                continue;
+            }
+
+            float t;
+            Point p;
+            if (closestIntersectionOfRayAndLineSegment(rayBase, dir, lineSegments[i], t, p) && (closest < 0 || t < closestT))
+            {
+                closestT = t;
+                closest = i;
+                hit = p;
+            }
+        }
+
+        // Walk out along the ray until both sides are blocked
+        Point counterclockwiseEnd, clockwiseEnd;
+        bool counterclockwiseBlocked = false;
+        bool clockwiseBlocked = false;
+        for (int k = first; k < last && !(counterclockwiseBlocked && clockwiseBlocked); k++)
+        {
+            const Point v = vertices[order[k]];
+            if (closest >= 0)
+            {
+                // At or past the line segment hit, on the other side of it from the base
+                const LineSegment& ls = lineSegments[closest];
+                const int side = orient2d(ls.a, ls.b, v);
+                if (side != orient2d(ls.a, ls.b, rayBase))
+                {
+                    if (side == 0)
+                    {
+                        hit = v;
+                    }
+                    break;
+                }
+            }
+
+            if (!counterclockwiseBlocked && (sides[order[k]] & counterclockwise))
+            {
+                counterclockwiseEnd = v;
+                counterclockwiseBlocked = true;
+            }
+            if (!clockwiseBlocked && (sides[order[k]] & clockwise))
+            {
+                clockwiseEnd = v;
+                clockwiseBlocked = true;
+            }
+        }
+
+        // Sides left open end at the hit, or the ray escapes there. Counterclockwise first,
+        // as the fan goes clockwise.
+        if (!counterclockwiseBlocked && closest >= 0)
+        {
+            counterclockwiseEnd = hit;
+            counterclockwiseBlocked = true;
+        }
+        if (!clockwiseBlocked && closest >= 0)
+        {
+            clockwiseEnd = hit;
+            clockwiseBlocked = true;
+        }
+        if (counterclockwiseBlocked)
+        {
+            closestIntersections.push_back(counterclockwiseEnd);
+        }
+        if (clockwiseBlocked && !(counterclockwiseBlocked && clockwiseEnd == counterclockwiseEnd))
+        {
+            closestIntersections.push_back(clockwiseEnd);
+        }
+    }
+}
+
+/**
+ * Returns the angle in [0, 2π).
+ */
+static inline float wrapAngle(const float angle)
+{
+    float wrapped = std::fmod(angle, 2 * PI);
+    if (wrapped < 0)
+    {
+        wrapped += 2 * PI;
+    }
+    return wrapped >= 2 * PI ? 0 : wrapped;
+}
+
+/**
+ * Returns how far the arc of a light goes counterclockwise from startAngle, 2π for a full circle.
+ */
+float lightSpan(const float startAngle, const float endAngle)
+{
+    if (endAngle - startAngle >= 2 * PI)
+    {
+        return 2 * PI;
+    }
+
+    const float span = wrapAngle(endAngle - startAngle);
+    return span == 0 && endAngle != startAngle ? 2 * PI : span;
+}
+
+/**
+ * Cuts the line segment down to the part a light at rayBase can reach: the part inside the
+ * circle of the given radius. Line segments that are out of the light's cone as a whole are
+ * dropped as well; the rest are kept whole, as rays out of the cone are never cast.
+ *
+ * Endpoints inside the circle are kept exactly, so line segments that share a vertex still
+ * share it after clipping.
+ *
+ * Returns true and sets clipped if some of the line segment is left, else false.
+ */
+bool clipToLight(const Point rayBase, const LineSegment& ls, const float radius, const float startAngle, const float endAngle, LineSegment& clipped)
+{
+    clipped = ls;
+
+    if (!std::isinf(radius))
+    {
+        // Solve |ls.a + s * d - rayBase| = radius for s
+        const Point d = Point(ls.b.x - ls.a.x, ls.b.y - ls.a.y);
+        const Point f = Point(ls.a.x - rayBase.x, ls.a.y - rayBase.y);
+        const float a = dot(d, d);
+        const float b = 2 * dot(f, d);
+        const float c = dot(f, f) - radius * radius;
+
+        if (a == 0)
+        {
+            if (c > 0)
+            {
+                RAYCAST_COUNT(culledSegments, 1);
+                return false;
+            }
+        }
+        else
+        {
+            const float discriminant = b * b - 4 * a * c;
+            if (discriminant < 0)
+            {
+                RAYCAST_COUNT(culledSegments, 1);
+                return false;
+            }
+
+            const float root = std::sqrt(discriminant);
+            const float enter = (-b - root) / (2 * a);
+            const float leave = (-b + root) / (2 * a);
+            if (enter > 1 || leave < 0)
+            {
+                RAYCAST_COUNT(culledSegments, 1);
+                return false;
+            }
+
+            if (enter > 0)
+            {
+                clipped.a = Point(ls.a.x + enter * d.x, ls.a.y + enter * d.y);
+            }
+            if (leave < 1)
+            {
+                clipped.b = Point(ls.a.x + leave * d.x, ls.a.y + leave * d.y);
+            }
+        }
+    }
+
+    const float span = lightSpan(startAngle, endAngle);
+    if (span < 2 * PI)
+    {
+        const Point start = Point(std::cos(startAngle), std::sin(startAngle));
+        const Point end = Point(std::cos(startAngle + span), std::sin(startAngle + span));
+        const Point a = Point(clipped.a.x - rayBase.x, clipped.a.y - rayBase.y);
+        const Point b = Point(clipped.b.x - rayBase.x, clipped.b.y - rayBase.y);
+
+        bool outside;
+        if (span <= PI)
+        {
+            // The cone is convex: out if both ends are past the same edge
+            outside = (cross(start, a) < 0 && cross(start, b) < 0) || (cross(end, a) > 0 && cross(end, b) > 0);
+        }
+        else
+        {
+            // The dark part is convex: out if both ends are in it
+            auto dark = [&](const Point p) { return cross(end, p) > 0 && cross(start, p) < 0; };
+            outside = dark(a) && dark(b);
+        }
+
+        if (outside)
+        {
+            RAYCAST_COUNT(culledSegments, 1);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Same fan as getClosestIntersectionOfRays(), for a light that reaches only radius far, into
+ * the arc counterclockwise from startAngle to endAngle. clipped are line segments already
+ * cut down by clipToLight().
+ *
+ * Rays at vertices out of the cone are not cast, rays are cast along both edges of the
+ * cone instead. Where the rays reach the radius without a hit, the fan follows the circle,
+ * with a point every 2π / 64 along it. A cone's fan ends with rayBase, so it is the closed
+ * outline of the lit area. The points are sorted by angle, clockwise from endAngle.
+ */
+void getClosestIntersectionOfClippedRays(const Point rayBase, const std::vector<LineSegment>& clipped, const float radius, const float startAngle, const float endAngle, std::vector<Point>& closestIntersections, RayCastScratch& scratch)
+{
+    const float delta = 0.0001f; // radians
+    const int arcSegments = 64; // of a full circle
+
+    const float span = lightSpan(startAngle, endAngle);
+    const bool cone = span < 2 * PI;
+    const float radiusSquared = radius * radius;
+
+    scratch.vertices.clear();
+    scratch.arc.clear();
+
+    {
+        RAYCAST_TIME(vertexNs);
+        getVertices(clipped, scratch.vertices, scratch.vertexTable);
+    }
+
+    // Casts a ray at angle from startAngle, false if the base is on a line segment
+    auto cast = [&](const float angle, const Point* vertex)
+    {
+        const Ray r = Ray(startAngle + angle, rayBase);
+
+        Point hit;
+        if (getClosestIntersection(r, clipped, hit) && rayBase.distSquared(hit) <= radiusSquared)
+        {
+            if (hit == rayBase)
+            {
+                return false;
+            }
+
+            // Same fix as the full fan: the ray cast directly at a vertex may miss it
+            if (vertex && rayBase.distSquared(*vertex) < rayBase.distSquared(hit))
+            {
+                hit = *vertex;
+            }
+            scratch.arc.push_back({ angle, hit });
+        }
+        else if (!std::isinf(radius))
+        {
+            const Point dir = r.direction();
+            scratch.arc.push_back({ angle, Point(rayBase.x + radius * dir.x, rayBase.y + radius * dir.y) });
+        }
+        return true;
+    };
+
+    bool onSegment = false;
+    {
+        RAYCAST_WATCH_GROWTH(scratch.arc);
+        RAYCAST_TIME(castNs);
+
+        for (int i = 0; !onSegment && i < (int) scratch.vertices.size(); i++)
+        {
+            const Point v = scratch.vertices[i];
+            if (v == rayBase)
+            {
+                onSegment = true;
+                continue;
+            }
+
+            const float angle = wrapAngle(Ray(rayBase, v).angle - startAngle);
+            const float angles[3] = { angle, angle + delta, angle - delta };
+            for (int j = 0; !onSegment && j < 3; j++)
+            {
+                float a = angles[j];
+                if (!cone)
+                {
+                    a = wrapAngle(a);
+                }
+                else if (a < 0 || a > span)
+                {
+                    continue;
+                }
+                onSegment = !cast(a, j == 0 ? &v : nullptr);
+            }
+        }
+
+        // The edges of the cone, and points along the circle
+        if (cone)
+        {
+            onSegment = onSegment || !cast(0, nullptr) || !cast(span, nullptr);
+        }
+        if (!std::isinf(radius))
+        {
+            const float step = 2 * PI / arcSegments;
+            for (int k = cone ? 1 : 0; !onSegment && k * step < span; k++)
+            {
+                onSegment = !cast(k * step, nullptr);
+            }
+        }
+    }
+
+    if (onSegment)
+    {
+        closestIntersections.clear();
+        return;
+    }
+
+    RAYCAST_COUNT(sorts, 1);
+    RAYCAST_COUNT(sortedPoints, scratch.arc.size());
+    RAYCAST_MAX(maxSortSize, scratch.arc.size());
+    {
+        RAYCAST_TIME(sortNs);
+        std::sort(scratch.arc.begin(), scratch.arc.end(), [](const std::pair<float, Point>& a, const std::pair<float, Point>& b)
+        {
+            return a.first > b.first;
+        });
+    }
+
+    for (const std::pair<float, Point>& point : scratch.arc)
+    {
+        closestIntersections.push_back(point.second);
+    }
+    if (cone && !closestIntersections.empty())
+    {
+        closestIntersections.push_back(rayBase);
+    }
+}
+
+/**
+ * Fan of a light that reaches only radius far, into the arc counterclockwise from startAngle
+ * to endAngle, see getClosestIntersectionOfClippedRays().
+ *
+ * Line segments out of reach are culled before any ray is cast, so a small light on a large
+ * map casts rays at few vertices and against few line segments.
+ */
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, const float radius, const float startAngle, const float endAngle, std::vector<Point>& closestIntersections, RayCastScratch& scratch)
+{
+    scratch.clipped.clear();
+
+    {
+        RAYCAST_WATCH_GROWTH(scratch.clipped);
+        LineSegment clipped;
+        for (const LineSegment& ls : lineSegments)
+        {
+            if (clipToLight(rayBase, ls, radius, startAngle, endAngle, clipped))
+            {
+                scratch.clipped.push_back(clipped);
+            }
+        }
+    }
+
+    getClosestIntersectionOfClippedRays(rayBase, scratch.clipped, radius, startAngle, endAngle, closestIntersections, scratch);
+}
+
+/**
+ * Fan of a light with a limited radius and cone, see above.
+ */
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, const float radius, const float startAngle, const float endAngle, std::vector<Point>& closestIntersections)
+{
+    RayCastScratch scratch;
+
+    getClosestIntersectionOfRays(rayBase, lineSegments, radius, startAngle, endAngle, closestIntersections, scratch);
+}
+
+/**
+ * Fan of a light that shines all around, but only radius far.
+ */
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, const float radius, std::vector<Point>& closestIntersections)
+{
+    getClosestIntersectionOfRays(rayBase, lineSegments, radius, 0, 2 * PI, closestIntersections);
+}
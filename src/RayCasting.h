@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <functional>
 
 const float PI = 3.14159265359f;
 
@@ -30,6 +31,11 @@ struct Point
     float distSquared(const Point other) const;
 };
 
+struct PointHash
+{
+    size_t operator()(const Point& p) const;
+};
+
 struct Line
 {
     float angle; // in radians
@@ -61,6 +67,7 @@ struct Ray
     Ray(const Point base, const Point pointOnRay);
 
     RayDirection getDirection() const;
+    Point direction() const;
     bool  hasOverlap(const Point point) const;
     Line  toLine() const;
     Point closestPointOnRay(const std::vector<Point> & points) const;
@@ -78,12 +85,93 @@ struct LineSegment
     bool operator==(const LineSegment& other) const;
 };
 
+// Reusable working buffers, so repeated queries do not allocate
+struct RayCastScratch
+{
+    std::vector<Point> vertices;
+    std::vector<int> vertexTable; // hash slots used by getVertices()
+    std::vector<LineSegment> clipped; // line segments left by clipToLight()
+    std::vector<std::pair<float, Point>> arc; // fan points of a limited light, by angle
+    std::vector<int> indices; // line segments near a light, from BVH::query()
+    std::vector<int> endpoints; // vertex of each line segment's a and b, for the vertex rays
+    std::vector<char> sides; // sides of the ray through each vertex that its line segments block
+    std::vector<int> order; // vertices by angle
+    std::vector<int> directions; // first vertex in order with the same direction as each vertex
+};
+
 // Functions to use for ray-intersection detection:
 
 void getAllIntersectionsOfRay(const Ray r, const std::vector<LineSegment>& lineSegments, std::vector<Point>& intersectionPoints, std::vector<LineSegment>& intersectionLineSegments);
 
+// Exact predicates, with no float error whatever the coordinates
+
+int  orient2d(const Point a, const Point b, const Point c);
+
+bool isOnLineSegment(const Point p, const LineSegment& ls);
+
+IntersectionCount intersectRayLineSegment(const Point base, const Point dir, const LineSegment& ls, float& t, float& u);
+
+bool closestIntersectionOfRayAndLineSegment(const Point base, const Point dir, const LineSegment& ls, float& t, Point& hit);
+
+void getAllIntersectionsOfRayParametric(const Ray r, const std::vector<LineSegment>& lineSegments, std::vector<Point>& intersectionPoints, std::vector<LineSegment>& intersectionLineSegments);
+
 std::vector<Ray> getAllIntersectionsOfRays(const Point rayBase, const int rayCount, const std::vector<LineSegment>& lineSegments, std::vector<Point>& intersectionPoints, std::vector<LineSegment>& intersectionLineSegments);
 
+bool getClosestIntersection(const Ray r, const std::vector<LineSegment>& lineSegments, Point& result);
+
+bool getClosestIntersection(const Point rayBase, const Point dir, const std::vector<LineSegment>& lineSegments, Point& result);
+
+// Frame to frame coherence: hint is the index of the line segment the ray hit last frame
+// (-1 for none), and is set to the one it hits now. hints holds one per ray of a batch.
+
+bool getClosestIntersection(const Ray r, const std::vector<LineSegment>& lineSegments, Point& result, int& hint);
+
+bool getClosestIntersection(const Point rayBase, const Point dir, const std::vector<LineSegment>& lineSegments, Point& result, int& hint);
+
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, std::vector<int>& hints);
+
+// Line of sight: can a see b? Each line of sight in a batch is a LineSegment from a to b.
+
+bool blocksLineOfSight(const Point a, const Point b, const LineSegment& ls);
+
+bool hasLineOfSight(const Point a, const Point b, const std::vector<LineSegment>& lineSegments);
+
+void hasLineOfSight(const std::vector<LineSegment>& sightLines, const std::vector<LineSegment>& lineSegments, std::vector<char>& visible);
+
 void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections);
 
-void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections);
\ No newline at end of file
+void getVertices(const std::vector<LineSegment>& lineSegments, std::vector<Point>& vertices);
+
+void getVertices(const std::vector<LineSegment>& lineSegments, std::vector<Point>& vertices, std::vector<int>& table);
+
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections);
+
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, const std::vector<Point>& vertices, std::vector<Point>& closestIntersections);
+
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, RayCastScratch& scratch);
+
+// Closest-hit query used to build a fan from any segment source
+typedef std::function<bool(const Ray r, Point& result)> ClosestIntersectionQuery;
+
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<Point>& vertices, const ClosestIntersectionQuery& getClosest, std::vector<Point>& closestIntersections);
+
+// Same fan with a single ray per vertex, sides of each vertex decided with orient2d()
+
+void getClosestIntersectionOfVertexRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections);
+
+void getClosestIntersectionOfVertexRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, RayCastScratch& scratch);
+
+// Lights that reach radius far (infinity for no limit), into the arc counterclockwise from
+// startAngle to endAngle (a full circle if they are 2π or more apart):
+
+float lightSpan(const float startAngle, const float endAngle);
+
+bool clipToLight(const Point rayBase, const LineSegment& ls, const float radius, const float startAngle, const float endAngle, LineSegment& clipped);
+
+void getClosestIntersectionOfClippedRays(const Point rayBase, const std::vector<LineSegment>& clipped, const float radius, const float startAngle, const float endAngle, std::vector<Point>& closestIntersections, RayCastScratch& scratch);
+
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, const float radius, const float startAngle, const float endAngle, std::vector<Point>& closestIntersections, RayCastScratch& scratch);
+
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, const float radius, const float startAngle, const float endAngle, std::vector<Point>& closestIntersections);
+
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, const float radius, std::vector<Point>& closestIntersections);
\ No newline at end of file
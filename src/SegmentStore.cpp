@@ -0,0 +1,711 @@
+#include <cmath>
+#include <limits>
+#include "SegmentStore.h"
+#include "RayCastStats.h"
+#include "UniformRays.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SEGMENT_STORE_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * Creates an empty store.
+ */
+SegmentStore::SegmentStore() : viewAx(nullptr), viewAy(nullptr), viewBx(nullptr), viewBy(nullptr), count(0), padded(0), bucketed(false) {}
+
+/**
+ * Creates a store holding the given line segments.
+ */
+SegmentStore::SegmentStore(const std::vector<LineSegment>& lineSegments) : SegmentStore()
+{
+    build(lineSegments);
+}
+
+/**
+ * Rounds count up to a multiple of SEGMENT_STORE_WIDTH.
+ */
+static int padToWidth(const int count)
+{
+    return (count + SegmentStore::SEGMENT_STORE_WIDTH - 1) / SegmentStore::SEGMENT_STORE_WIDTH * SegmentStore::SEGMENT_STORE_WIDTH;
+}
+
+void AxisSegments::clear()
+{
+    c.clear();
+    a.clear();
+    e.clear();
+    index.clear();
+}
+
+int AxisSegments::paddedSize() const
+{
+    return c.size();
+}
+
+void GeneralSegments::clear()
+{
+    ax.clear();
+    ay.clear();
+    bx.clear();
+    by.clear();
+    index.clear();
+}
+
+int GeneralSegments::paddedSize() const
+{
+    return ax.size();
+}
+
+/**
+ * Pads the bucket with NaN segments, which never count as a hit, and index 0.
+ */
+static void pad(AxisSegments& bucket)
+{
+    const int size = padToWidth(bucket.c.size());
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    bucket.c.resize(size, nan);
+    bucket.a.resize(size, nan);
+    bucket.e.resize(size, nan);
+    bucket.index.resize(size, 0);
+}
+
+static void pad(GeneralSegments& bucket)
+{
+    const int size = padToWidth(bucket.ax.size());
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    bucket.ax.resize(size, nan);
+    bucket.ay.resize(size, nan);
+    bucket.bx.resize(size, nan);
+    bucket.by.resize(size, nan);
+    bucket.index.resize(size, 0);
+}
+
+/**
+ * Replaces the contents of the store with the given line segments.
+ *
+ * Segments are kept in the same order, so index i in the store is index i in lineSegments.
+ * The arrays are padded with NaN segments, which never count as a hit.
+ *
+ * The segments are also sorted into buckets: horizontal, vertical and the rest, each in
+ * store order. Tile maps are mostly horizontal and vertical walls, whose kernel needs
+ * fewer multiplications and one division instead of two.
+ */
+void SegmentStore::build(const std::vector<LineSegment>& lineSegments)
+{
+    viewAx = viewAy = viewBx = viewBy = nullptr;
+    count = lineSegments.size();
+    padded = padToWidth(count);
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+
+    ax.assign(padded, nan);
+    ay.assign(padded, nan);
+    bx.assign(padded, nan);
+    by.assign(padded, nan);
+
+    horizontal.clear();
+    vertical.clear();
+    general.clear();
+
+    for (int i = 0; i < count; i++)
+    {
+        const LineSegment& ls = lineSegments[i];
+
+        ax[i] = ls.a.x;
+        ay[i] = ls.a.y;
+        bx[i] = ls.b.x;
+        by[i] = ls.b.y;
+
+        if (ls.a.y == ls.b.y && ls.a.x != ls.b.x)
+        {
+            horizontal.c.push_back(ls.a.y);
+            horizontal.a.push_back(ls.a.x);
+            horizontal.e.push_back(ls.b.x - ls.a.x);
+            horizontal.index.push_back(i);
+        }
+        else if (ls.a.x == ls.b.x && ls.a.y != ls.b.y)
+        {
+            vertical.c.push_back(ls.a.x);
+            vertical.a.push_back(ls.a.y);
+            vertical.e.push_back(ls.b.y - ls.a.y);
+            vertical.index.push_back(i);
+        }
+        else
+        {
+            general.ax.push_back(ls.a.x);
+            general.ay.push_back(ls.a.y);
+            general.bx.push_back(ls.b.x);
+            general.by.push_back(ls.b.y);
+            general.index.push_back(i);
+        }
+    }
+
+    pad(horizontal);
+    pad(vertical);
+    pad(general);
+    bucketed = true;
+}
+
+/**
+ * Uses arrays the store does not own, like those of a MapFile, instead of copying them.
+ * They must be laid out the same as build() lays them out, padded with NaN up to paddedSize,
+ * and stay valid and unchanged for as long as the store is used.
+ *
+ * A view has no buckets, sorting the segments would copy them. Its closest hits go
+ * through the general kernel.
+ */
+void SegmentStore::view(const float* ax, const float* ay, const float* bx, const float* by, const int count, const int paddedSize)
+{
+    // Free the owned arrays, nothing reads them anymore
+    this->ax = std::vector<float>();
+    this->ay = std::vector<float>();
+    this->bx = std::vector<float>();
+    this->by = std::vector<float>();
+    horizontal = AxisSegments();
+    vertical = AxisSegments();
+    general = GeneralSegments();
+    bucketed = false;
+
+    viewAx = ax;
+    viewAy = ay;
+    viewBx = bx;
+    viewBy = by;
+    this->count = count;
+    padded = paddedSize;
+}
+
+/**
+ * Count of line segments, not including padding.
+ */
+int SegmentStore::size() const
+{
+    return count;
+}
+
+/**
+ * Count of line segments, including padding.
+ */
+int SegmentStore::paddedSize() const
+{
+    return padded;
+}
+
+/**
+ * Returns the i-th line segment.
+ */
+LineSegment SegmentStore::get(const int i) const
+{
+    return LineSegment(Point(dataAx()[i], dataAy()[i]), Point(dataBx()[i], dataBy()[i]));
+}
+
+/**
+ * Checks if the segments are sorted into buckets, true unless the store is a view.
+ */
+bool SegmentStore::isBucketed() const
+{
+    return bucketed;
+}
+
+const AxisSegments& SegmentStore::getHorizontal() const
+{
+    return horizontal;
+}
+
+const AxisSegments& SegmentStore::getVertical() const
+{
+    return vertical;
+}
+
+const GeneralSegments& SegmentStore::getGeneral() const
+{
+    return general;
+}
+
+const float* SegmentStore::dataAx() const { return viewAx ? viewAx : ax.data(); }
+const float* SegmentStore::dataAy() const { return viewAy ? viewAy : ay.data(); }
+const float* SegmentStore::dataBx() const { return viewBx ? viewBx : bx.data(); }
+const float* SegmentStore::dataBy() const { return viewBy ? viewBy : by.data(); }
+
+/**
+ * Tests one segment with the scalar kernel, and keeps it if it is closer than the best so far.
+ *
+ * Ties go to the lower index, so every kernel picks the same segment.
+ */
+static inline void closestHitOne(const SegmentStore& store, const int i, const Point base, const Point dir, float& bestT, int& bestIndex)
+{
+    float t;
+    Point hit;
+    if (closestIntersectionOfRayAndLineSegment(base, dir, store.get(i), t, hit))
+    {
+        if (t < bestT || (t == bestT && i < bestIndex))
+        {
+            bestT = t;
+            bestIndex = i;
+        }
+    }
+}
+
+static void closestHitScalar(const SegmentStore& store, const Point base, const Point dir, float& bestT, int& bestIndex)
+{
+    for (int i = 0; i < store.size(); i++)
+    {
+        closestHitOne(store, i, base, dir, bestT, bestIndex);
+    }
+}
+
+/**
+ * Keeps the best lane, lanes holding store indices or -1.
+ */
+static inline void mergeLanes(const float* lanesT, const int* lanesIndex, const int lanes, float& bestT, int& bestIndex)
+{
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        if (lanesIndex[lane] >= 0 && (lanesT[lane] < bestT || (lanesT[lane] == bestT && lanesIndex[lane] < bestIndex)))
+        {
+            bestT = lanesT[lane];
+            bestIndex = lanesIndex[lane];
+        }
+    }
+}
+
+#ifdef SEGMENT_STORE_X86
+
+/**
+ * SSE2 kernel, 4 segments per iteration, over arrays laid out like the store's. indices
+ * holds the store index of each segment, or is null when the arrays are the store's own.
+ *
+ * Lanes where the ray and segment are parallel are left to the scalar kernel,
+ * since they need the collinear overlap test.
+ */
+__attribute__((target("sse2")))
+static void closestHitSSE(const SegmentStore& store, const float* pax, const float* pay, const float* pbx, const float* pby, const int* indices, const int size, const Point base, const Point dir, float& bestT, int& bestIndex)
+{
+    const __m128 ox = _mm_set1_ps(base.x);
+    const __m128 oy = _mm_set1_ps(base.y);
+    const __m128 dx = _mm_set1_ps(dir.x);
+    const __m128 dy = _mm_set1_ps(dir.y);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 eps = _mm_set1_ps(1e-6f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    __m128  laneBestT = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    __m128i laneBestIndex = _mm_set1_epi32(-1);
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i step = _mm_set1_epi32(4);
+
+    for (int i = 0; i < size; i += 4)
+    {
+        const __m128 ax = _mm_loadu_ps(pax + i);
+        const __m128 ay = _mm_loadu_ps(pay + i);
+        const __m128 ex = _mm_sub_ps(_mm_loadu_ps(pbx + i), ax);
+        const __m128 ey = _mm_sub_ps(_mm_loadu_ps(pby + i), ay);
+        const __m128 bax = _mm_sub_ps(ax, ox);
+        const __m128 bay = _mm_sub_ps(ay, oy);
+
+        const __m128 denom = _mm_sub_ps(_mm_mul_ps(dx, ey), _mm_mul_ps(dy, ex));
+        const __m128 t = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(bax, ey), _mm_mul_ps(bay, ex)), denom);
+        const __m128 u = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(bax, dy), _mm_mul_ps(bay, dx)), denom);
+
+        const __m128 parallel = _mm_cmple_ps(_mm_and_ps(denom, absMask), _mm_mul_ps(eps, _mm_add_ps(_mm_and_ps(ex, absMask), _mm_and_ps(ey, absMask))));
+
+        __m128 hit = _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, laneBestT));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+        hit = _mm_andnot_ps(parallel, hit);
+
+        const __m128i laneIndex = indices ? _mm_loadu_si128((const __m128i*) (indices + i)) : index;
+        laneBestT = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, laneBestT));
+        const __m128i hitI = _mm_castps_si128(hit);
+        laneBestIndex = _mm_or_si128(_mm_and_si128(hitI, laneIndex), _mm_andnot_si128(hitI, laneBestIndex));
+
+        int parallelMask = _mm_movemask_ps(parallel);
+        while (parallelMask)
+        {
+            const int lane = __builtin_ctz(parallelMask);
+            closestHitOne(store, indices ? indices[i + lane] : i + lane, base, dir, bestT, bestIndex);
+            parallelMask &= parallelMask - 1;
+        }
+
+        index = _mm_add_epi32(index, step);
+    }
+
+    float lanesT[4];
+    int   lanesIndex[4];
+    _mm_storeu_ps(lanesT, laneBestT);
+    _mm_storeu_si128((__m128i*) lanesIndex, laneBestIndex);
+    mergeLanes(lanesT, lanesIndex, 4, bestT, bestIndex);
+}
+
+/**
+ * SSE2 kernel for the horizontal or vertical bucket, 4 segments per iteration.
+ *
+ * With ey (or ex) exactly 0 the terms of the general kernel that multiply it drop out, and
+ * what is left gives the same t bit for bit: (bc * e) / (dc * e), in the notation below.
+ * The segment's parameter u is not divided out. Its range is checked by comparing its
+ * numerator m with its denominator q instead, after moving the sign of q onto m. Lanes
+ * where that comparison cannot tell how the division would round, such as a ray through an
+ * endpoint, go to the scalar kernel with the parallel ones, so the hits are the same as
+ * with the general kernel.
+ */
+__attribute__((target("sse2")))
+static void closestHitAxisSSE(const SegmentStore& store, const AxisSegments& bucket, const bool isVertical, const Point base, const Point dir, float& bestT, int& bestIndex)
+{
+    // A vertical segment is a horizontal one with x and y swapped: c is along the fixed
+    // coordinate, a along the segment
+    const __m128 oc = _mm_set1_ps(isVertical ? base.x : base.y);
+    const __m128 oa = _mm_set1_ps(isVertical ? base.y : base.x);
+    const __m128 dc = _mm_set1_ps(isVertical ? dir.x : dir.y);
+    const __m128 da = _mm_set1_ps(isVertical ? dir.y : dir.x);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 eps = _mm_set1_ps(1e-6f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 nearOne = _mm_set1_ps(1 + 0x1p-20f); // u may round to 1 below this
+    const __m128 nearZero = _mm_set1_ps(-0x1p-100f); // u may round to -0 above this
+
+    __m128  laneBestT = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    __m128i laneBestIndex = _mm_set1_epi32(-1);
+
+    const float* pc = bucket.c.data();
+    const float* pa = bucket.a.data();
+    const float* pe = bucket.e.data();
+    const int* indices = bucket.index.data();
+
+    for (int i = 0; i < bucket.paddedSize(); i += 4)
+    {
+        const __m128 e = _mm_loadu_ps(pe + i);
+        const __m128 bc = _mm_sub_ps(_mm_loadu_ps(pc + i), oc);
+        const __m128 ba = _mm_sub_ps(_mm_loadu_ps(pa + i), oa);
+
+        const __m128 q = _mm_mul_ps(dc, e);
+        const __m128 t = _mm_div_ps(_mm_mul_ps(bc, e), q);
+        const __m128 m = _mm_sub_ps(_mm_mul_ps(bc, da), _mm_mul_ps(ba, dc)); // u = m / q
+
+        // u = mq / |q|, mq being m with the sign of q flipped in
+        const __m128 signQ = _mm_andnot_ps(absMask, q);
+        const __m128 absQ = _mm_xor_ps(q, signQ);
+        const __m128 mq = _mm_xor_ps(m, signQ);
+        const __m128 parallel = _mm_cmple_ps(absQ, _mm_mul_ps(eps, _mm_and_ps(e, absMask)));
+
+        // 0 <= u <= 1, and the lanes too close to 1 or to -0 to tell
+        const __m128 inside = _mm_and_ps(_mm_cmpge_ps(mq, zero), _mm_cmple_ps(mq, absQ));
+        const __m128 nearEnd = _mm_and_ps(_mm_cmpgt_ps(mq, absQ), _mm_cmple_ps(mq, _mm_mul_ps(absQ, nearOne)));
+        const __m128 nearStart = _mm_and_ps(_mm_cmplt_ps(mq, zero), _mm_cmpge_ps(mq, _mm_mul_ps(absQ, nearZero)));
+        const __m128 scalar = _mm_or_ps(parallel, _mm_or_ps(nearEnd, nearStart));
+
+        __m128 hit = _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, laneBestT));
+        hit = _mm_andnot_ps(scalar, _mm_and_ps(hit, inside));
+
+        laneBestT = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, laneBestT));
+        const __m128i hitI = _mm_castps_si128(hit);
+        const __m128i laneIndex = _mm_loadu_si128((const __m128i*) (indices + i));
+        laneBestIndex = _mm_or_si128(_mm_and_si128(hitI, laneIndex), _mm_andnot_si128(hitI, laneBestIndex));
+
+        int scalarMask = _mm_movemask_ps(scalar);
+        while (scalarMask)
+        {
+            const int lane = __builtin_ctz(scalarMask);
+            closestHitOne(store, indices[i + lane], base, dir, bestT, bestIndex);
+            scalarMask &= scalarMask - 1;
+        }
+    }
+
+    float lanesT[4];
+    int   lanesIndex[4];
+    _mm_storeu_ps(lanesT, laneBestT);
+    _mm_storeu_si128((__m128i*) lanesIndex, laneBestIndex);
+    mergeLanes(lanesT, lanesIndex, 4, bestT, bestIndex);
+}
+
+/**
+ * AVX2 kernel, 8 segments per iteration. Same as closestHitSSE() otherwise.
+ *
+ * Note: FMA is left off on purpose, so t and u round the same as in the scalar kernel.
+ */
+__attribute__((target("avx2")))
+static void closestHitAVX2(const SegmentStore& store, const float* pax, const float* pay, const float* pbx, const float* pby, const int* indices, const int size, const Point base, const Point dir, float& bestT, int& bestIndex)
+{
+    const __m256 ox = _mm256_set1_ps(base.x);
+    const __m256 oy = _mm256_set1_ps(base.y);
+    const __m256 dx = _mm256_set1_ps(dir.x);
+    const __m256 dy = _mm256_set1_ps(dir.y);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 eps = _mm256_set1_ps(1e-6f);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+    __m256  laneBestT = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    __m256i laneBestIndex = _mm256_set1_epi32(-1);
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i step = _mm256_set1_epi32(8);
+
+    for (int i = 0; i < size; i += 8)
+    {
+        const __m256 ax = _mm256_loadu_ps(pax + i);
+        const __m256 ay = _mm256_loadu_ps(pay + i);
+        const __m256 ex = _mm256_sub_ps(_mm256_loadu_ps(pbx + i), ax);
+        const __m256 ey = _mm256_sub_ps(_mm256_loadu_ps(pby + i), ay);
+        const __m256 bax = _mm256_sub_ps(ax, ox);
+        const __m256 bay = _mm256_sub_ps(ay, oy);
+
+        const __m256 denom = _mm256_sub_ps(_mm256_mul_ps(dx, ey), _mm256_mul_ps(dy, ex));
+        const __m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(bax, ey), _mm256_mul_ps(bay, ex)), denom);
+        const __m256 u = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(bax, dy), _mm256_mul_ps(bay, dx)), denom);
+
+        const __m256 parallel = _mm256_cmp_ps(_mm256_and_ps(denom, absMask), _mm256_mul_ps(eps, _mm256_add_ps(_mm256_and_ps(ex, absMask), _mm256_and_ps(ey, absMask))), _CMP_LE_OQ);
+
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GE_OQ), _mm256_cmp_ps(t, laneBestT, _CMP_LT_OQ));
+        hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+        hit = _mm256_andnot_ps(parallel, hit);
+
+        const __m256i laneIndex = indices ? _mm256_loadu_si256((const __m256i*) (indices + i)) : index;
+        laneBestT = _mm256_blendv_ps(laneBestT, t, hit);
+        laneBestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(laneBestIndex), _mm256_castsi256_ps(laneIndex), hit));
+
+        int parallelMask = _mm256_movemask_ps(parallel);
+        while (parallelMask)
+        {
+            const int lane = __builtin_ctz(parallelMask);
+            closestHitOne(store, indices ? indices[i + lane] : i + lane, base, dir, bestT, bestIndex);
+            parallelMask &= parallelMask - 1;
+        }
+
+        index = _mm256_add_epi32(index, step);
+    }
+
+    float lanesT[8];
+    int   lanesIndex[8];
+    _mm256_storeu_ps(lanesT, laneBestT);
+    _mm256_storeu_si256((__m256i*) lanesIndex, laneBestIndex);
+    mergeLanes(lanesT, lanesIndex, 8, bestT, bestIndex);
+}
+
+/**
+ * AVX2 kernel for the horizontal or vertical bucket, 8 segments per iteration. Same as
+ * closestHitAxisSSE() otherwise.
+ */
+__attribute__((target("avx2")))
+static void closestHitAxisAVX2(const SegmentStore& store, const AxisSegments& bucket, const bool isVertical, const Point base, const Point dir, float& bestT, int& bestIndex)
+{
+    const __m256 oc = _mm256_set1_ps(isVertical ? base.x : base.y);
+    const __m256 oa = _mm256_set1_ps(isVertical ? base.y : base.x);
+    const __m256 dc = _mm256_set1_ps(isVertical ? dir.x : dir.y);
+    const __m256 da = _mm256_set1_ps(isVertical ? dir.y : dir.x);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 eps = _mm256_set1_ps(1e-6f);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 nearOne = _mm256_set1_ps(1 + 0x1p-20f);
+    const __m256 nearZero = _mm256_set1_ps(-0x1p-100f);
+
+    __m256  laneBestT = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    __m256i laneBestIndex = _mm256_set1_epi32(-1);
+
+    const float* pc = bucket.c.data();
+    const float* pa = bucket.a.data();
+    const float* pe = bucket.e.data();
+    const int* indices = bucket.index.data();
+
+    for (int i = 0; i < bucket.paddedSize(); i += 8)
+    {
+        const __m256 e = _mm256_loadu_ps(pe + i);
+        const __m256 bc = _mm256_sub_ps(_mm256_loadu_ps(pc + i), oc);
+        const __m256 ba = _mm256_sub_ps(_mm256_loadu_ps(pa + i), oa);
+
+        const __m256 q = _mm256_mul_ps(dc, e);
+        const __m256 t = _mm256_div_ps(_mm256_mul_ps(bc, e), q);
+        const __m256 m = _mm256_sub_ps(_mm256_mul_ps(bc, da), _mm256_mul_ps(ba, dc));
+
+        const __m256 signQ = _mm256_andnot_ps(absMask, q);
+        const __m256 absQ = _mm256_xor_ps(q, signQ);
+        const __m256 mq = _mm256_xor_ps(m, signQ);
+        const __m256 parallel = _mm256_cmp_ps(absQ, _mm256_mul_ps(eps, _mm256_and_ps(e, absMask)), _CMP_LE_OQ);
+
+        const __m256 inside = _mm256_and_ps(_mm256_cmp_ps(mq, zero, _CMP_GE_OQ), _mm256_cmp_ps(mq, absQ, _CMP_LE_OQ));
+        const __m256 nearEnd = _mm256_and_ps(_mm256_cmp_ps(mq, absQ, _CMP_GT_OQ), _mm256_cmp_ps(mq, _mm256_mul_ps(absQ, nearOne), _CMP_LE_OQ));
+        const __m256 nearStart = _mm256_and_ps(_mm256_cmp_ps(mq, zero, _CMP_LT_OQ), _mm256_cmp_ps(mq, _mm256_mul_ps(absQ, nearZero), _CMP_GE_OQ));
+        const __m256 scalar = _mm256_or_ps(parallel, _mm256_or_ps(nearEnd, nearStart));
+
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GE_OQ), _mm256_cmp_ps(t, laneBestT, _CMP_LT_OQ));
+        hit = _mm256_andnot_ps(scalar, _mm256_and_ps(hit, inside));
+
+        const __m256i laneIndex = _mm256_loadu_si256((const __m256i*) (indices + i));
+        laneBestT = _mm256_blendv_ps(laneBestT, t, hit);
+        laneBestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(laneBestIndex), _mm256_castsi256_ps(laneIndex), hit));
+
+        int scalarMask = _mm256_movemask_ps(scalar);
+        while (scalarMask)
+        {
+            const int lane = __builtin_ctz(scalarMask);
+            closestHitOne(store, indices[i + lane], base, dir, bestT, bestIndex);
+            scalarMask &= scalarMask - 1;
+        }
+    }
+
+    float lanesT[8];
+    int   lanesIndex[8];
+    _mm256_storeu_ps(lanesT, laneBestT);
+    _mm256_storeu_si256((__m256i*) lanesIndex, laneBestIndex);
+    mergeLanes(lanesT, lanesIndex, 8, bestT, bestIndex);
+}
+
+#endif
+
+/**
+ * The best SIMD level this CPU supports.
+ */
+static SimdLevel detectSimdLevel()
+{
+#ifdef SEGMENT_STORE_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return SimdLevel::SSE;
+    }
+#endif
+
+    return SimdLevel::Scalar;
+}
+
+static const SimdLevel supportedSimdLevel = detectSimdLevel();
+static SimdLevel currentSimdLevel = supportedSimdLevel;
+
+/**
+ * The SIMD level the closest-hit kernel currently runs at.
+ */
+SimdLevel getSimdLevel()
+{
+    return currentSimdLevel;
+}
+
+/**
+ * Forces the closest-hit kernel to a SIMD level, e.g. to compare kernels in tests.
+ *
+ * Levels the CPU does not support are lowered to the best one it does.
+ * Returns the level actually used.
+ */
+SimdLevel setSimdLevel(const SimdLevel level)
+{
+    currentSimdLevel = (int) level > (int) supportedSimdLevel ? supportedSimdLevel : level;
+    return currentSimdLevel;
+}
+
+/**
+ * Finds the segment whose hit is closest to the base of the ray, given by its base and unit direction.
+ *
+ * Sets t to the ray parameter of that hit and index to the segment's index.
+ * Dispatches to the widest kernel the CPU supports, run over each bucket with its own kernel.
+ * Same result at every level.
+ *
+ * Returns true if the ray hits any segment, else false and t and index are meaningless.
+ */
+bool SegmentStore::closestHit(const Point base, const Point dir, float& t, int& index) const
+{
+    float bestT = std::numeric_limits<float>::infinity();
+    int bestIndex = -1;
+
+#ifdef SEGMENT_STORE_X86
+    if (currentSimdLevel == SimdLevel::AVX2 && bucketed)
+    {
+        RAYCAST_COUNT(segmentTests, horizontal.paddedSize() + vertical.paddedSize() + general.paddedSize());
+        closestHitAxisAVX2(*this, horizontal, false, base, dir, bestT, bestIndex);
+        closestHitAxisAVX2(*this, vertical, true, base, dir, bestT, bestIndex);
+        closestHitAVX2(*this, general.ax.data(), general.ay.data(), general.bx.data(), general.by.data(), general.index.data(), general.paddedSize(), base, dir, bestT, bestIndex);
+    }
+    else if (currentSimdLevel == SimdLevel::AVX2)
+    {
+        RAYCAST_COUNT(segmentTests, paddedSize());
+        closestHitAVX2(*this, dataAx(), dataAy(), dataBx(), dataBy(), nullptr, paddedSize(), base, dir, bestT, bestIndex);
+    }
+    else if (currentSimdLevel == SimdLevel::SSE && bucketed)
+    {
+        RAYCAST_COUNT(segmentTests, horizontal.paddedSize() + vertical.paddedSize() + general.paddedSize());
+        closestHitAxisSSE(*this, horizontal, false, base, dir, bestT, bestIndex);
+        closestHitAxisSSE(*this, vertical, true, base, dir, bestT, bestIndex);
+        closestHitSSE(*this, general.ax.data(), general.ay.data(), general.bx.data(), general.by.data(), general.index.data(), general.paddedSize(), base, dir, bestT, bestIndex);
+    }
+    else if (currentSimdLevel == SimdLevel::SSE)
+    {
+        RAYCAST_COUNT(segmentTests, paddedSize());
+        closestHitSSE(*this, dataAx(), dataAy(), dataBx(), dataBy(), nullptr, paddedSize(), base, dir, bestT, bestIndex);
+    }
+    else
+    {
+        RAYCAST_COUNT(segmentTests, paddedSize());
+        closestHitScalar(*this, base, dir, bestT, bestIndex);
+    }
+#else
+    RAYCAST_COUNT(segmentTests, paddedSize());
+    closestHitScalar(*this, base, dir, bestT, bestIndex);
+#endif
+
+    if (bestIndex < 0)
+    {
+        return false;
+    }
+
+    t = bestT;
+    index = bestIndex;
+    return true;
+}
+
+/**
+ * Calculates the closest intersection of ray and sets it to result.
+ *
+ * Returns true if intersection found, else false if no intersection was found.
+ */
+bool getClosestIntersection(const Ray r, const SegmentStore& store, Point& result)
+{
+    return getClosestIntersection(r.base, r.direction(), store, result);
+}
+
+/**
+ * Same as getClosestIntersection(), for the ray given by its base and unit direction.
+ */
+bool getClosestIntersection(const Point rayBase, const Point dir, const SegmentStore& store, Point& result)
+{
+    RAYCAST_COUNT(raysCast, 1);
+
+    float t;
+    int index;
+    if (!store.closestHit(rayBase, dir, t, index))
+    {
+        return false;
+    }
+
+    // Recompute the winning hit in scalar, so the point is exactly the same as the vector version
+    return closestIntersectionOfRayAndLineSegment(rayBase, dir, store.get(index), t, result);
+}
+
+/**
+ * Calculates the CLOSEST intersection point for each ray. Essentially, the triangle fan.
+ *
+ * Rays are cast at equally spaced angled intervals starting from angle 0 radian.
+ */
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const SegmentStore& store, std::vector<Point>& closestIntersections)
+{
+    if (rayCount == 0)
+    {
+        return;
+    }
+    if (getClosestIntersectionsOfTabledRays(rayBase, rayCount, store, closestIntersections))
+    {
+        return;
+    }
+
+    float angleBetweenRays = 2 * PI / rayCount;
+    for (int i = 0; i < rayCount; i++)
+    {
+        Point closest;
+        if (getClosestIntersection(Ray(angleBetweenRays * i, rayBase), store, closest))
+        {
+            closestIntersections.push_back(closest);
+        }
+    }
+}
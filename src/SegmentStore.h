@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include "RayCasting.h"
+
+enum class SimdLevel
+{
+    Scalar, SSE, AVX2
+};
+
+// Horizontal or vertical line segments of a store, padded like the store. For a horizontal
+// segment c is its y, a is ax and e is bx - ax. For a vertical one, c is its x, a is ay and
+// e is by - ay.
+struct AxisSegments
+{
+    std::vector<float> c, a, e;
+    std::vector<int> index; // of each line segment in the store
+
+    void clear();
+    int  paddedSize() const;
+};
+
+// The other line segments of a store, padded like the store
+struct GeneralSegments
+{
+    std::vector<float> ax, ay, bx, by;
+    std::vector<int> index; // of each line segment in the store
+
+    void clear();
+    int  paddedSize() const;
+};
+
+class SegmentStore
+{
+private:
+    // Structure-of-arrays endpoints, padded with NaN up to a multiple of SEGMENT_STORE_WIDTH
+    std::vector<float> ax, ay, bx, by;
+    const float* viewAx, * viewAy, * viewBx, * viewBy; // arrays the store does not own, see view()
+    int count, padded;
+    AxisSegments horizontal, vertical; // buckets of build(), empty for a view
+    GeneralSegments general;
+    bool bucketed;
+
+public:
+    static const int SEGMENT_STORE_WIDTH = 8;
+
+    SegmentStore();
+    SegmentStore(const std::vector<LineSegment>& lineSegments);
+
+    void build(const std::vector<LineSegment>& lineSegments);
+    void view(const float* ax, const float* ay, const float* bx, const float* by, const int count, const int paddedSize);
+    int  size() const;
+    int  paddedSize() const;
+    LineSegment get(const int i) const;
+    bool closestHit(const Point base, const Point dir, float& t, int& index) const;
+    bool isBucketed() const;
+    const AxisSegments& getHorizontal() const;
+    const AxisSegments& getVertical() const;
+    const GeneralSegments& getGeneral() const;
+
+    const float* dataAx() const;
+    const float* dataAy() const;
+    const float* dataBx() const;
+    const float* dataBy() const;
+};
+
+SimdLevel getSimdLevel();
+SimdLevel setSimdLevel(const SimdLevel level);
+
+bool getClosestIntersection(const Ray r, const SegmentStore& store, Point& result);
+
+bool getClosestIntersection(const Point rayBase, const Point dir, const SegmentStore& store, Point& result);
+
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const SegmentStore& store, std::vector<Point>& closestIntersections);
@@ -0,0 +1,230 @@
+#include <memory>
+#include "ThreadPool.h"
+
+/**
+ * Creates a pool that runs jobs on threadCount threads, the calling thread being one of them.
+ *
+ * A threadCount of 0 uses one thread per hardware thread. The workers are started once
+ * and sleep between jobs.
+ */
+ThreadPool::ThreadPool(const int threadCount)
+    : job(nullptr), busyWorkers(0), generation(0), stopping(false)
+{
+    int total = threadCount > 0 ? threadCount : (int) std::thread::hardware_concurrency();
+    if (total < 1)
+    {
+        total = 1;
+    }
+
+    // The calling thread is thread 0
+    for (int i = 1; i < total; i++)
+    {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+/**
+ * Stops and joins the workers.
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+/**
+ * Count of threads that run a job, including the calling thread.
+ */
+int ThreadPool::size() const
+{
+    return workers.size() + 1;
+}
+
+void ThreadPool::workerLoop(const int thread)
+{
+    unsigned long seen = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+
+            if (stopping)
+            {
+                return;
+            }
+
+            seen = generation;
+        }
+
+        (*job)(thread);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers--;
+            if (busyWorkers == 0)
+            {
+                finished.notify_one();
+            }
+        }
+    }
+}
+
+/**
+ * Runs job(thread) once on every thread of the pool, and returns when all are done.
+ *
+ * Warning: not reentrant, only one thread may run a job on a pool at a time.
+ */
+void ThreadPool::run(const std::function<void(int thread)>& job)
+{
+    if (workers.empty())
+    {
+        job(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->job = &job;
+        busyWorkers = workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    job(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return busyWorkers == 0; });
+    this->job = nullptr;
+}
+
+/**
+ * Calls body(begin, end) over [0, count) in chunks of grain indices, spread over the pool.
+ *
+ * Chunks are handed out from a shared counter, so uneven chunks balance out. Returns once
+ * every chunk is done. body must be safe to call from several threads at once.
+ */
+void ThreadPool::parallelFor(const int count, const int grain, const std::function<void(int begin, int end)>& body)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    if (workers.empty() || count <= grain)
+    {
+        body(0, count);
+        return;
+    }
+
+    const int step = grain > 0 ? grain : 1;
+    std::atomic<int> next(0);
+
+    run([&](const int)
+    {
+        while (true)
+        {
+            const int begin = next.fetch_add(step);
+            if (begin >= count)
+            {
+                return;
+            }
+
+            body(begin, begin + step < count ? begin + step : count);
+        }
+    });
+}
+
+/**
+ * Calls body(index, thread) for every index in [0, count), with work stealing.
+ *
+ * Each thread starts with an equal contiguous range and works through it from the front.
+ * A thread that runs out steals the back half of another thread's remaining range, so
+ * a few expensive indices do not leave the other threads idle. thread is in [0, size()),
+ * for per-thread buffers. Returns once every index is done.
+ */
+void ThreadPool::parallelForStealing(const int count, const std::function<void(int index, int thread)>& body)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    struct alignas(64) Range
+    {
+        std::mutex mutex;
+        int begin, end;
+    };
+
+    const int threads = size();
+    std::unique_ptr<Range[]> ranges(new Range[threads]);
+    for (int t = 0; t < threads; t++)
+    {
+        ranges[t].begin = (long) count * t / threads;
+        ranges[t].end = (long) count * (t + 1) / threads;
+    }
+
+    run([&](const int thread)
+    {
+        Range& own = ranges[thread];
+
+        while (true)
+        {
+            int index = -1;
+            {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (own.begin < own.end)
+                {
+                    index = own.begin++;
+                }
+            }
+
+            if (index >= 0)
+            {
+                body(index, thread);
+                continue;
+            }
+
+            // Out of work, steal the back half of someone else's range
+            bool stole = false;
+            for (int offset = 1; offset < threads && !stole; offset++)
+            {
+                Range& victim = ranges[(thread + offset) % threads];
+
+                int begin, end;
+                {
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+                    const int remaining = victim.end - victim.begin;
+                    if (remaining <= 0)
+                    {
+                        continue;
+                    }
+
+                    begin = victim.end - (remaining + 1) / 2;
+                    end = victim.end;
+                    victim.end = begin;
+                }
+
+                std::lock_guard<std::mutex> lock(own.mutex);
+                own.begin = begin;
+                own.end = end;
+                stole = true;
+            }
+
+            // Nothing left anywhere, indices still running belong to other threads
+            if (!stole)
+            {
+                return;
+            }
+        }
+    });
+}
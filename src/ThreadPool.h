@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+
+    // Current job, run once by every thread
+    const std::function<void(int thread)>* job;
+    int busyWorkers;
+    unsigned long generation;
+    bool stopping;
+
+    void workerLoop(const int thread);
+    void run(const std::function<void(int thread)>& job);
+
+public:
+    ThreadPool(const int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int  size() const;
+    void parallelFor(const int count, const int grain, const std::function<void(int begin, int end)>& body);
+    void parallelForStealing(const int count, const std::function<void(int index, int thread)>& body);
+};
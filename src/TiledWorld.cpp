@@ -0,0 +1,475 @@
+#include <cmath>
+#include <algorithm>
+#include "TiledWorld.h"
+#include "MapFile.h"
+
+/**
+ * Creates the key of tile (0,0).
+ */
+TileKey::TileKey() : x(0), y(0) {}
+
+TileKey::TileKey(const int x, const int y) : x(x), y(y) {}
+
+bool TileKey::operator==(const TileKey other) const
+{
+    return x == other.x && y == other.y;
+}
+
+size_t TileKeyHash::operator()(const TileKey& key) const
+{
+    return std::hash<unsigned long long>()(((unsigned long long) (unsigned int) key.x << 32) ^ (unsigned int) key.y);
+}
+
+/**
+ * Creates a world of square tiles of the given size, loaded by loader.
+ *
+ * About maxTiles tiles are kept in memory, see update(). Tiles are loaded on a background
+ * thread, started here and stopped when the world is destroyed.
+ */
+TiledWorld::TiledWorld(const float tileSize, const TileLoader& loader, const int maxTiles)
+    : tileSize(tileSize), maxTiles(maxTiles), loader(loader), frame(0), backgroundLoads(0), blockingLoads(0), stopping(false)
+{
+    loading = std::thread(&TiledWorld::loadingLoop, this);
+}
+
+/**
+ * Stops the loading thread. A tile it is loading is finished first.
+ */
+TiledWorld::~TiledWorld()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    loading.join();
+}
+
+/**
+ * Returns the key of the tile the point is in.
+ */
+TileKey TiledWorld::tileOf(const Point p) const
+{
+    return TileKey((int) std::floor(p.x / tileSize), (int) std::floor(p.y / tileSize));
+}
+
+/**
+ * Loads requested tiles one at a time, and hands them over in done.
+ */
+void TiledWorld::loadingLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        wake.wait(lock, [this] { return stopping || !requests.empty(); });
+        if (stopping)
+        {
+            return;
+        }
+
+        const TileKey key = requests.front();
+        requests.pop_front();
+
+        lock.unlock();
+        std::vector<LineSegment> lineSegments;
+        loader(key, lineSegments);
+        lock.lock();
+
+        done.push_back({ key, std::move(lineSegments) });
+        pending.erase(key);
+        loaded.notify_all();
+    }
+}
+
+/**
+ * Makes the tiles the loading thread finished resident.
+ */
+void TiledWorld::takeLoaded()
+{
+    std::vector<std::pair<TileKey, std::vector<LineSegment>>> arrived;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        arrived.swap(done);
+    }
+
+    for (auto& tile : arrived)
+    {
+        if (!tiles.count(tile.first))
+        {
+            backgroundLoads++;
+        }
+        insert(tile.first, tile.second);
+    }
+}
+
+/**
+ * Makes the tile resident, unless it already is. A line segment already in the map, from
+ * another tile or twice in this one, is counted instead of added again.
+ */
+void TiledWorld::insert(const TileKey key, std::vector<LineSegment>& lineSegments)
+{
+    if (tiles.count(key))
+    {
+        return;
+    }
+
+    for (const LineSegment& ls : lineSegments)
+    {
+        if (tileCounts[ls]++ == 0)
+        {
+            map.addLineSegment(ls);
+        }
+    }
+
+    Tile& tile = tiles[key];
+    tile.lineSegments.swap(lineSegments);
+    tile.lastUsed = frame;
+}
+
+/**
+ * Makes the tile resident now, for a query. A tile the loading thread is working on is
+ * waited for, one it has not started on yet is loaded on this thread instead.
+ */
+void TiledWorld::require(const TileKey key)
+{
+    auto tile = tiles.find(key);
+    if (tile != tiles.end())
+    {
+        tile->second.lastUsed = frame;
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        auto queued = std::find(requests.begin(), requests.end(), key);
+        if (queued != requests.end())
+        {
+            requests.erase(queued);
+            pending.erase(key);
+        }
+        else
+        {
+            loaded.wait(lock, [&] { return !pending.count(key); });
+        }
+    }
+
+    takeLoaded();
+
+    tile = tiles.find(key);
+    if (tile != tiles.end())
+    {
+        tile->second.lastUsed = frame;
+        return;
+    }
+
+    std::vector<LineSegment> lineSegments;
+    loader(key, lineSegments);
+    blockingLoads++;
+    insert(key, lineSegments);
+}
+
+/**
+ * Drops the least recently used tiles while more than maxTiles are resident. Tiles used
+ * in the current frame are kept even past maxTiles. A line segment leaves the map with the
+ * last resident tile that has it.
+ */
+void TiledWorld::evict()
+{
+    if ((int) tiles.size() <= maxTiles)
+    {
+        return;
+    }
+
+    std::vector<std::pair<long long, TileKey>> unused;
+    for (const auto& tile : tiles)
+    {
+        if (tile.second.lastUsed < frame)
+        {
+            unused.push_back({ tile.second.lastUsed, tile.first });
+        }
+    }
+    std::sort(unused.begin(), unused.end(), [](const std::pair<long long, TileKey>& a, const std::pair<long long, TileKey>& b)
+    {
+        return a.first < b.first;
+    });
+
+    for (int i = 0; i < (int) unused.size() && (int) tiles.size() > maxTiles; i++)
+    {
+        auto tile = tiles.find(unused[i].second);
+        for (const LineSegment& ls : tile->second.lineSegments)
+        {
+            auto count = tileCounts.find(ls);
+            if (--count->second == 0)
+            {
+                tileCounts.erase(count);
+                map.removeLineSegment(ls);
+            }
+        }
+        tiles.erase(tile);
+    }
+}
+
+/**
+ * Appends the keys of the tiles within radius of base.
+ */
+void TiledWorld::tilesAround(const Point base, const float radius, std::vector<TileKey>& keys) const
+{
+    const TileKey low = tileOf(Point(base.x - radius, base.y - radius));
+    const TileKey high = tileOf(Point(base.x + radius, base.y + radius));
+
+    for (int y = low.y; y <= high.y; y++)
+    {
+        for (int x = low.x; x <= high.x; x++)
+        {
+            // Distance from the base to the closest point of the tile
+            const float dx = std::max(0.f, std::max(x * tileSize - base.x, base.x - (x + 1) * tileSize));
+            const float dy = std::max(0.f, std::max(y * tileSize - base.y, base.y - (y + 1) * tileSize));
+            if (dx * dx + dy * dy <= radius * radius)
+            {
+                keys.push_back(TileKey(x, y));
+            }
+        }
+    }
+}
+
+/**
+ * Call once a frame with the bases of the active lights and how far they reach.
+ *
+ * Tiles that arrived since the last call become resident. Tiles within radius of a light
+ * that are not resident are requested from the loading thread, and tiles no light needs
+ * are evicted, least recently used first, down to maxTiles. So memory follows the tiles
+ * around the lights, not the size of the world.
+ */
+void TiledWorld::update(const std::vector<Point>& lightBases, const float radius)
+{
+    frame++;
+    takeLoaded();
+
+    keys.clear();
+    for (const Point base : lightBases)
+    {
+        tilesAround(base, radius, keys);
+    }
+
+    bool requested = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const TileKey key : keys)
+        {
+            auto tile = tiles.find(key);
+            if (tile != tiles.end())
+            {
+                tile->second.lastUsed = frame;
+            }
+            else if (pending.insert(key).second)
+            {
+                requests.push_back(key);
+                requested = true;
+            }
+        }
+    }
+    if (requested)
+    {
+        wake.notify_one();
+    }
+
+    evict();
+}
+
+/**
+ * Blocks until every requested tile is loaded and resident.
+ */
+void TiledWorld::waitForLoads()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        loaded.wait(lock, [this] { return pending.empty(); });
+    }
+
+    takeLoaded();
+}
+
+/**
+ * Fan of a light at rayBase, see getClosestIntersectionOfClippedRays(). Only the tiles within
+ * radius are used; any of them that are not resident yet are loaded before the rays are
+ * cast, so radius must be finite.
+ */
+void TiledWorld::getClosestIntersectionOfRays(const Point rayBase, const float radius, const float startAngle, const float endAngle, std::vector<Point>& closestIntersections)
+{
+    keys.clear();
+    tilesAround(rayBase, radius, keys);
+
+    for (const TileKey key : keys)
+    {
+        require(key);
+    }
+
+    gathered.clear();
+    for (const TileKey key : keys)
+    {
+        const std::vector<LineSegment>& lineSegments = tiles[key].lineSegments;
+        gathered.insert(gathered.end(), lineSegments.begin(), lineSegments.end());
+    }
+
+    ::getClosestIntersectionOfRays(rayBase, gathered, radius, startAngle, endAngle, closestIntersections, scratch);
+}
+
+/**
+ * Fan of a light that shines all around, only radius far.
+ */
+void TiledWorld::getClosestIntersectionOfRays(const Point rayBase, const float radius, std::vector<Point>& closestIntersections)
+{
+    getClosestIntersectionOfRays(rayBase, radius, 0, 2 * PI, closestIntersections);
+}
+
+bool TiledWorld::isResident(const TileKey key) const
+{
+    return tiles.count(key) > 0;
+}
+
+int TiledWorld::residentTiles() const
+{
+    return tiles.size();
+}
+
+/**
+ * Count of tiles the loading thread loaded, that were made resident.
+ */
+int TiledWorld::getBackgroundLoads() const
+{
+    return backgroundLoads;
+}
+
+/**
+ * Count of tiles a query had to load itself, because they were not requested in time.
+ */
+int TiledWorld::getBlockingLoads() const
+{
+    return blockingLoads;
+}
+
+/**
+ * The line segments of the resident tiles. A line segment in several tiles is in the map once.
+ */
+Map& TiledWorld::getMap()
+{
+    return map;
+}
+
+/**
+ * Narrows [t0, t1] to where a + t * d is within [low, high] on one axis.
+ */
+static void clipAxis(const float a, const float d, const float low, const float high, float& t0, float& t1)
+{
+    if (d == 0)
+    {
+        if (a < low || a > high)
+        {
+            t1 = -1;
+        }
+        return;
+    }
+
+    float enter = (low - a) / d;
+    float leave = (high - a) / d;
+    if (enter > leave)
+    {
+        std::swap(enter, leave);
+    }
+    t0 = std::max(t0, enter);
+    t1 = std::min(t1, leave);
+}
+
+/**
+ * Cuts the line segments at tile borders and sorts the pieces into tiles.
+ *
+ * Both tiles compute the point where a line segment crosses their shared border the same
+ * way, so the pieces meet exactly. A piece along a border goes to the tile it is in going by
+ * the same half-open rule as TiledWorld::tileOf(), so no piece is in two tiles.
+ */
+void splitIntoTiles(const std::vector<LineSegment>& lineSegments, const float tileSize, TileSet& tiles)
+{
+    auto tileOf = [tileSize](const Point p) { return TileKey((int) std::floor(p.x / tileSize), (int) std::floor(p.y / tileSize)); };
+
+    for (const LineSegment& ls : lineSegments)
+    {
+        const TileKey a = tileOf(ls.a);
+        const TileKey b = tileOf(ls.b);
+        if (a == b)
+        {
+            tiles[a].push_back(ls);
+            continue;
+        }
+
+        const Point d = Point(ls.b.x - ls.a.x, ls.b.y - ls.a.y);
+        for (int y = std::min(a.y, b.y); y <= std::max(a.y, b.y); y++)
+        {
+            for (int x = std::min(a.x, b.x); x <= std::max(a.x, b.x); x++)
+            {
+                float t0 = 0;
+                float t1 = 1;
+                clipAxis(ls.a.x, d.x, x * tileSize, (x + 1) * tileSize, t0, t1);
+                clipAxis(ls.a.y, d.y, y * tileSize, (y + 1) * tileSize, t0, t1);
+                if (t0 >= t1)
+                {
+                    continue;
+                }
+
+                const Point p0 = t0 == 0 ? ls.a : Point(ls.a.x + t0 * d.x, ls.a.y + t0 * d.y);
+                const Point p1 = t1 == 1 ? ls.b : Point(ls.a.x + t1 * d.x, ls.a.y + t1 * d.y);
+                if (tileOf(Point((p0.x + p1.x) / 2, (p0.y + p1.y) / 2)) == TileKey(x, y))
+                {
+                    tiles[TileKey(x, y)].push_back(LineSegment(p0, p1));
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Path of the map file of a tile in directory.
+ */
+static std::string tilePath(const std::string& directory, const TileKey key)
+{
+    return directory + "/tile_" + std::to_string(key.x) + "_" + std::to_string(key.y) + ".rcmap";
+}
+
+/**
+ * Splits the line segments into tiles and writes each tile that has any as a map file in
+ * directory, which must exist.
+ *
+ * Returns true if all were written, else false.
+ */
+bool writeTiles(const std::vector<LineSegment>& lineSegments, const float tileSize, const std::string& directory)
+{
+    TileSet tiles;
+    splitIntoTiles(lineSegments, tileSize, tiles);
+
+    for (const auto& tile : tiles)
+    {
+        if (!writeMapFile(tilePath(directory, tile.first), tile.second, false))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Loader of the tiles writeTiles() wrote in directory. A tile without a file is empty.
+ */
+TileLoader mapFileTileLoader(const std::string& directory)
+{
+    return [directory](const TileKey key, std::vector<LineSegment>& lineSegments)
+    {
+        MapFile file;
+        if (file.open(tilePath(directory, key)))
+        {
+            file.getLineSegments(lineSegments);
+        }
+    };
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include "RayCasting.h"
+#include "Map.h"
+
+// Tile (x, y) covers [x * tileSize, (x + 1) * tileSize) by [y * tileSize, (y + 1) * tileSize)
+struct TileKey
+{
+    int x, y;
+
+    TileKey();
+    TileKey(const int x, const int y);
+
+    bool operator==(const TileKey other) const;
+};
+
+struct TileKeyHash
+{
+    size_t operator()(const TileKey& key) const;
+};
+
+typedef std::unordered_map<TileKey, std::vector<LineSegment>, TileKeyHash> TileSet;
+
+// Loads the line segments of one tile, as cut by splitIntoTiles(). Called from the loading
+// thread and from the thread that runs queries, so it must be safe to call from both at once.
+// A line segment may be in several tiles, it stays in the map while any of them is resident.
+typedef std::function<void(const TileKey key, std::vector<LineSegment>& lineSegments)> TileLoader;
+
+// A world too large to keep in memory, split into square tiles that are loaded around the lights
+class TiledWorld
+{
+private:
+    struct Tile
+    {
+        std::vector<LineSegment> lineSegments;
+        long long lastUsed; // frame
+    };
+
+    float tileSize;
+    int   maxTiles;
+    TileLoader loader;
+
+    std::unordered_map<TileKey, Tile, TileKeyHash> tiles; // resident tiles
+    Map map; // line segments of the resident tiles
+    std::unordered_map<LineSegment, int, LineSegmentHash> tileCounts; // resident tiles each line segment of map is in
+    long long frame;
+    int backgroundLoads, blockingLoads;
+
+    // Shared with the loading thread, under mutex
+    std::thread loading;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable loaded;
+    std::deque<TileKey> requests;
+    std::unordered_set<TileKey, TileKeyHash> pending; // requested and not yet done
+    std::vector<std::pair<TileKey, std::vector<LineSegment>>> done; // loaded, not yet resident
+    bool stopping;
+
+    // Working buffers of the queries
+    std::vector<TileKey> keys;
+    std::vector<LineSegment> gathered;
+    RayCastScratch scratch;
+
+    void loadingLoop();
+    void takeLoaded();
+    void insert(const TileKey key, std::vector<LineSegment>& lineSegments);
+    void require(const TileKey key);
+    void evict();
+    void tilesAround(const Point base, const float radius, std::vector<TileKey>& keys) const;
+
+public:
+    static const int DEFAULT_MAX_TILES = 64;
+
+    TiledWorld(const float tileSize, const TileLoader& loader, const int maxTiles = DEFAULT_MAX_TILES);
+    ~TiledWorld();
+
+    TiledWorld(const TiledWorld&) = delete;
+    TiledWorld& operator=(const TiledWorld&) = delete;
+
+    TileKey tileOf(const Point p) const;
+    void update(const std::vector<Point>& lightBases, const float radius);
+    void waitForLoads();
+    void getClosestIntersectionOfRays(const Point rayBase, const float radius, const float startAngle, const float endAngle, std::vector<Point>& closestIntersections);
+    void getClosestIntersectionOfRays(const Point rayBase, const float radius, std::vector<Point>& closestIntersections);
+    bool isResident(const TileKey key) const;
+    int  residentTiles() const;
+    int  getBackgroundLoads() const;
+    int  getBlockingLoads() const;
+    Map& getMap();
+};
+
+void splitIntoTiles(const std::vector<LineSegment>& lineSegments, const float tileSize, TileSet& tiles);
+
+bool writeTiles(const std::vector<LineSegment>& lineSegments, const float tileSize, const std::string& directory);
+
+TileLoader mapFileTileLoader(const std::string& directory);
@@ -0,0 +1,209 @@
+#include <limits>
+#include "TwoLevelBVH.h"
+#include "RayCastStats.h"
+
+/**
+ * Creates a scene with no line segments.
+ */
+TwoLevelBVH::TwoLevelBVH() : refitsSinceBuild(0), staticVertexCount(0) {}
+
+/**
+ * Creates a scene over the given static line segments, with no dynamic ones yet.
+ */
+TwoLevelBVH::TwoLevelBVH(const std::vector<LineSegment>& staticSegments) : TwoLevelBVH()
+{
+    buildStatic(staticSegments);
+}
+
+/**
+ * Builds the static tree, and the static part of the vertex list. Meant to be done once,
+ * when the level loads. The dynamic line segments are cleared.
+ */
+void TwoLevelBVH::buildStatic(const std::vector<LineSegment>& staticSegments)
+{
+    staticBVH.build(staticSegments);
+    dynamicBVH.build(std::vector<LineSegment>());
+    refitsSinceBuild = 0;
+
+    vertices.clear();
+    ::getVertices(staticSegments, vertices, vertexTable);
+    staticVertexCount = vertices.size();
+}
+
+/**
+ * Sets the dynamic line segments, once a frame after they moved.
+ *
+ * With the same count as before the tree is refitted, which keeps its shape. Segments that
+ * moved far make a refitted tree loose, so every MAX_REFITS frames it is built again. Only
+ * the dynamic tree is touched, however large the static one is.
+ */
+void TwoLevelBVH::setDynamic(const std::vector<LineSegment>& dynamicSegments)
+{
+    if (refitsSinceBuild < MAX_REFITS && dynamicBVH.refit(dynamicSegments))
+    {
+        refitsSinceBuild++;
+    }
+    else
+    {
+        dynamicBVH.build(dynamicSegments);
+        refitsSinceBuild = 0;
+    }
+
+    dynamicVertices.clear();
+    ::getVertices(dynamicSegments, dynamicVertices, vertexTable);
+    vertices.resize(staticVertexCount);
+    vertices.insert(vertices.end(), dynamicVertices.begin(), dynamicVertices.end());
+}
+
+int TwoLevelBVH::sizeStatic() const
+{
+    return staticBVH.size();
+}
+
+int TwoLevelBVH::sizeDynamic() const
+{
+    return dynamicBVH.size();
+}
+
+int TwoLevelBVH::size() const
+{
+    return staticBVH.size() + dynamicBVH.size();
+}
+
+/**
+ * Returns the line segment at index, the static segments coming before the dynamic ones.
+ */
+LineSegment TwoLevelBVH::get(const int index) const
+{
+    if (index < sizeStatic())
+    {
+        return staticBVH.getLineSegments()[index];
+    }
+
+    return dynamicBVH.getLineSegments()[index - sizeStatic()];
+}
+
+/**
+ * Vertices of all line segments, for the fans: those of the static segments, then those of
+ * the dynamic ones. A vertex shared by a static and a dynamic segment, like a door's hinge,
+ * is in both parts.
+ */
+const std::vector<Point>& TwoLevelBVH::getVertices() const
+{
+    return vertices;
+}
+
+const BVH& TwoLevelBVH::getStatic() const
+{
+    return staticBVH;
+}
+
+const BVH& TwoLevelBVH::getDynamic() const
+{
+    return dynamicBVH;
+}
+
+/**
+ * Finds the closest hit in either tree, see BVH::closestHit(). index is as in get().
+ *
+ * The dynamic tree is only walked up to the static hit, so it skips the occluders behind it.
+ * Only a hit strictly before the static one counts: on a tie the static segment wins, having
+ * the lower index, same as one BVH over both lists.
+ */
+bool TwoLevelBVH::closestHit(const Point base, const Point dir, float& t, int& index) const
+{
+    float staticT = std::numeric_limits<float>::infinity();
+    float dynamicT;
+    int staticIndex, dynamicIndex;
+
+    const bool hitStatic = staticBVH.closestHit(base, dir, staticT, staticIndex);
+    if (dynamicBVH.closestHit(base, dir, -1, staticT, dynamicT, dynamicIndex))
+    {
+        t = dynamicT;
+        index = sizeStatic() + dynamicIndex;
+        return true;
+    }
+    if (hitStatic)
+    {
+        t = staticT;
+        index = staticIndex;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Checks if a line segment of either tree blocks the view from a to b. The small dynamic
+ * tree is checked first, it is the cheaper one to walk.
+ */
+bool TwoLevelBVH::anyHit(const Point a, const Point b) const
+{
+    return dynamicBVH.anyHit(a, b) || staticBVH.anyHit(a, b);
+}
+
+/**
+ * Calculates the closest intersection of ray and sets it to result.
+ *
+ * Returns true if intersection found, else false if no intersection was found.
+ */
+bool getClosestIntersection(const Ray r, const TwoLevelBVH& scene, Point& result)
+{
+    RAYCAST_COUNT(raysCast, 1);
+
+    const Point dir = r.direction();
+
+    float t;
+    int index;
+    if (!scene.closestHit(r.base, dir, t, index))
+    {
+        return false;
+    }
+
+    return closestIntersectionOfRayAndLineSegment(r.base, dir, scene.get(index), t, result);
+}
+
+/**
+ * Calculates the CLOSEST intersection point for each ray. Essentially, the triangle fan.
+ *
+ * Rays are cast at equally spaced angled intervals starting from angle 0 radian.
+ */
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const TwoLevelBVH& scene, std::vector<Point>& closestIntersections)
+{
+    if (rayCount == 0)
+    {
+        return;
+    }
+
+    float angleBetweenRays = 2 * PI / rayCount;
+    for (int i = 0; i < rayCount; i++)
+    {
+        Point closest;
+        if (getClosestIntersection(Ray(angleBetweenRays * i, rayBase), scene, closest))
+        {
+            closestIntersections.push_back(closest);
+        }
+    }
+}
+
+/**
+ * Casts 3 rays at each vertex of each line segment, static and dynamic, with the closest
+ * hits found through both trees. The static vertices are not looked for again.
+ */
+void getClosestIntersectionOfRays(const Point rayBase, const TwoLevelBVH& scene, std::vector<Point>& closestIntersections)
+{
+    getClosestIntersectionOfRays(rayBase, scene.getVertices(), [&](const Ray r, Point& result)
+    {
+        return getClosestIntersection(r, scene, result);
+    }, closestIntersections);
+}
+
+/**
+ * Checks if b can be seen from a, with the static and dynamic line segments in the way.
+ */
+bool hasLineOfSight(const Point a, const Point b, const TwoLevelBVH& scene)
+{
+    RAYCAST_COUNT(sightQueries, 1);
+
+    return !scene.anyHit(a, b);
+}
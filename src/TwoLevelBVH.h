@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include "RayCasting.h"
+#include "BVH.h"
+
+// Static line segments (walls) in a BVH built once, moving ones (doors, crates) in a small
+// BVH updated every frame. Queries see both as one list: static segments first, then dynamic.
+class TwoLevelBVH
+{
+private:
+    BVH staticBVH;
+    BVH dynamicBVH;
+    int refitsSinceBuild;
+    std::vector<Point> vertices; // of the static segments, then of the dynamic ones
+    int staticVertexCount;
+    std::vector<Point> dynamicVertices; // working buffers of setDynamic()
+    std::vector<int> vertexTable;
+
+public:
+    static const int MAX_REFITS = 30;
+
+    TwoLevelBVH();
+    TwoLevelBVH(const std::vector<LineSegment>& staticSegments);
+
+    void buildStatic(const std::vector<LineSegment>& staticSegments);
+    void setDynamic(const std::vector<LineSegment>& dynamicSegments);
+    int  sizeStatic() const;
+    int  sizeDynamic() const;
+    int  size() const;
+    LineSegment get(const int index) const;
+    const std::vector<Point>& getVertices() const;
+    const BVH& getStatic() const;
+    const BVH& getDynamic() const;
+    bool closestHit(const Point base, const Point dir, float& t, int& index) const;
+    bool anyHit(const Point a, const Point b) const;
+};
+
+bool getClosestIntersection(const Ray r, const TwoLevelBVH& scene, Point& result);
+
+void getClosestIntersectionsOfRays(const Point rayBase, const int rayCount, const TwoLevelBVH& scene, std::vector<Point>& closestIntersections);
+
+void getClosestIntersectionOfRays(const Point rayBase, const TwoLevelBVH& scene, std::vector<Point>& closestIntersections);
+
+bool hasLineOfSight(const Point a, const Point b, const TwoLevelBVH& scene);
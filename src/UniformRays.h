@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include "RayCasting.h"
+
+// Fans of evenly spaced rays with the ray count fixed at compile time. The directions come
+// from a table, so casting a fan takes no trig, and the loop over the rays has a known trip
+// count. Works with any segment source that has a getClosestIntersection(base, dir, ...)
+// overload: a line segment list, a SegmentStore or a BVH.
+
+// Unit directions of RayCount evenly spaced rays, counterclockwise from angle 0. These are
+// exactly Ray(2π / RayCount * i, base).direction(), so the fans match those cast from
+// angles. Worked out on first use, once per ray count.
+template <int RayCount>
+const std::array<Point, RayCount>& uniformDirections()
+{
+    static_assert(RayCount > 0, "a fan needs at least one ray");
+
+    static const std::array<Point, RayCount> directions = []()
+    {
+        std::array<Point, RayCount> table;
+        const float angleBetweenRays = 2 * PI / RayCount;
+        for (int i = 0; i < RayCount; i++)
+        {
+            table[i] = Ray(angleBetweenRays * i, Point(0,0)).direction();
+        }
+
+        return table;
+    }();
+
+    return directions;
+}
+
+// Same fan as getClosestIntersectionsOfRays(rayBase, RayCount, segments, closestIntersections)
+template <int RayCount, typename Segments>
+void getClosestIntersectionsOfRays(const Point rayBase, const Segments& segments, std::vector<Point>& closestIntersections)
+{
+    const std::array<Point, RayCount>& directions = uniformDirections<RayCount>();
+
+    closestIntersections.reserve(closestIntersections.size() + RayCount);
+    for (int i = 0; i < RayCount; i++)
+    {
+        Point closest;
+        if (getClosestIntersection(rayBase, directions[i], segments, closest))
+        {
+            closestIntersections.push_back(closest);
+        }
+    }
+}
+
+// Same fan with each ray hinted, as getClosestIntersectionsOfRays(rayBase, RayCount, segments,
+// closestIntersections, hints). hints must hold RayCount entries.
+template <int RayCount, typename Segments>
+void getClosestIntersectionsOfRays(const Point rayBase, const Segments& segments, std::vector<Point>& closestIntersections, std::vector<int>& hints)
+{
+    const std::array<Point, RayCount>& directions = uniformDirections<RayCount>();
+
+    closestIntersections.reserve(closestIntersections.size() + RayCount);
+    for (int i = 0; i < RayCount; i++)
+    {
+        Point closest;
+        if (getClosestIntersection(rayBase, directions[i], segments, closest, hints[i]))
+        {
+            closestIntersections.push_back(closest);
+        }
+    }
+}
+
+// Casts the fan through a table if rayCount is one of the usual counts: 64, 256, 1024 or
+// 4096. Returns false for any other count, and casts nothing.
+template <typename Segments>
+bool getClosestIntersectionsOfTabledRays(const Point rayBase, const int rayCount, const Segments& segments, std::vector<Point>& closestIntersections)
+{
+    switch (rayCount)
+    {
+        case 64:
+            getClosestIntersectionsOfRays<64>(rayBase, segments, closestIntersections);
+            return true;
+        case 256:
+            getClosestIntersectionsOfRays<256>(rayBase, segments, closestIntersections);
+            return true;
+        case 1024:
+            getClosestIntersectionsOfRays<1024>(rayBase, segments, closestIntersections);
+            return true;
+        case 4096:
+            getClosestIntersectionsOfRays<4096>(rayBase, segments, closestIntersections);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Same as getClosestIntersectionsOfTabledRays(), with each ray hinted. hints must hold
+// rayCount entries.
+template <typename Segments>
+bool getClosestIntersectionsOfTabledRays(const Point rayBase, const int rayCount, const Segments& segments, std::vector<Point>& closestIntersections, std::vector<int>& hints)
+{
+    switch (rayCount)
+    {
+        case 64:
+            getClosestIntersectionsOfRays<64>(rayBase, segments, closestIntersections, hints);
+            return true;
+        case 256:
+            getClosestIntersectionsOfRays<256>(rayBase, segments, closestIntersections, hints);
+            return true;
+        case 1024:
+            getClosestIntersectionsOfRays<1024>(rayBase, segments, closestIntersections, hints);
+            return true;
+        case 4096:
+            getClosestIntersectionsOfRays<4096>(rayBase, segments, closestIntersections, hints);
+            return true;
+        default:
+            return false;
+    }
+}
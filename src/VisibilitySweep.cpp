@@ -0,0 +1,810 @@
+#include <cmath>
+#include <algorithm>
+#include "VisibilitySweep.h"
+
+/**
+ * Returns the distance from the base to segment i's line, along the current sweep ray.
+ */
+float SweepOrder::distance(const int i) const
+{
+    const LineSegment& ls = (*lineSegments)[i];
+    const Point e = Point(ls.b.x - ls.a.x, ls.b.y - ls.a.y);
+    const Point ba = Point(ls.a.x - base->x, ls.a.y - base->y);
+
+    return (ba.x * e.y - ba.y * e.x) / (dir->x * e.y - dir->y * e.x);
+}
+
+/**
+ * Orders segments by distance along the current sweep ray, ties by index.
+ *
+ * Segments that do not cross each other keep their order for as long as both are
+ * active, so comparing them along any ray they both span is enough.
+ */
+bool SweepOrder::operator()(const int a, const int b) const
+{
+    const float da = distance(a);
+    const float db = distance(b);
+
+    return da < db || (da == db && a < b);
+}
+
+/**
+ * Returns the normalized angle of p around base, in [0, 2 * PI).
+ */
+static float angleAround(const Point base, const Point p)
+{
+    float angle = std::atan2(p.y - base.y, p.x - base.x);
+
+    if (angle < 0)
+    {
+        angle += 2 * PI;
+    }
+    if (angle >= 2 * PI)
+    {
+        angle = 0;
+    }
+
+    return angle;
+}
+
+/**
+ * Returns the point where the ray from base through the event vertex hits the segment's line.
+ *
+ * If an endpoint of the segment is at the event's angle, that endpoint is returned, so
+ * corners come out exact.
+ */
+static Point hitAtEvent(const Point base, const SweepEvent& event, const LineSegment& ls)
+{
+    if (angleAround(base, ls.a) == event.angle)
+    {
+        return ls.a;
+    }
+    if (angleAround(base, ls.b) == event.angle)
+    {
+        return ls.b;
+    }
+
+    const Point dir = Point(event.vertex.x - base.x, event.vertex.y - base.y);
+    const Point e = Point(ls.b.x - ls.a.x, ls.b.y - ls.a.y);
+    const Point ba = Point(ls.a.x - base.x, ls.a.y - base.y);
+    const float t = (ba.x * e.y - ba.y * e.x) / (dir.x * e.y - dir.y * e.x);
+
+    return Point(base.x + t * dir.x, base.y + t * dir.y);
+}
+
+/**
+ * Checks if the two line segments cross, each going from one side of the other to the
+ * other side. Line segments that only touch, at an endpoint or along a line, keep their
+ * distance order and do not count. Exact, see orient2d().
+ */
+static bool crosses(const LineSegment& a, const LineSegment& b)
+{
+    return orient2d(a.a, a.b, b.a) * orient2d(a.a, a.b, b.b) < 0 && orient2d(b.a, b.b, a.a) * orient2d(b.a, b.b, a.b) < 0;
+}
+
+/**
+ * Checks if the active segment at it crosses either of its neighbours in the tree.
+ *
+ * Two segments that cross are next to each other in the tree just before the first angle
+ * they cross at, so checking the neighbours of every segment inserted, and the two
+ * segments that an erase leaves next to each other, finds a crossing if there is one.
+ */
+static bool crossesNeighbours(const std::vector<LineSegment>& lineSegments, const SweepSet& active, const SweepSet::const_iterator it)
+{
+    if (it == active.end())
+    {
+        return false;
+    }
+    if (it != active.begin() && crosses(lineSegments[*std::prev(it)], lineSegments[*it]))
+    {
+        return true;
+    }
+
+    const SweepSet::const_iterator next = std::next(it);
+    return next != active.end() && crosses(lineSegments[*it], lineSegments[*next]);
+}
+
+/**
+ * Builds the same triangle fan as getClosestIntersectionOfRays(), with a rotational sweep.
+ *
+ * Endpoint events are sorted by angle around the base, and the segments the sweep ray
+ * currently crosses are kept in a balanced tree ordered by distance. Whenever the closest
+ * segment changes, the hit on the old and on the new closest segment is emitted, so the
+ * whole fan takes O(N log N) instead of casting 3 rays per vertex against every segment.
+ *
+ * The points are sorted by angle, same order as getClosestIntersectionOfRays(). The fan is
+ * cleared if the base is on a line segment.
+ *
+ * Line segments that cross each other (they may share endpoints) change their distance
+ * order within a gap, which the sweep cannot follow. The sweep checks for that as it goes,
+ * and if it finds two that cross, the fan is built by getClosestIntersectionOfVertexRays()
+ * instead and false is returned. Segments that lie on a line through the base, or whose
+ * ends are at the same angle, have no width and are skipped.
+ */
+bool getClosestIntersectionOfRaysSweep(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections)
+{
+    SweepScratch scratch;
+
+    return getClosestIntersectionOfRaysSweep(rayBase, lineSegments, closestIntersections, scratch);
+}
+
+/**
+ * Same as getClosestIntersectionOfRaysSweep(), but the working buffers and the tree's
+ * nodes live in scratch, so a reused scratch makes no heap allocations once it has grown.
+ */
+bool getClosestIntersectionOfRaysSweep(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, SweepScratch& scratch)
+{
+    std::vector<SweepEvent>& events = scratch.events;
+    std::vector<int>& wrapping = scratch.wrapping; // segments that cross the ray at angle 0
+    events.clear();
+    wrapping.clear();
+
+    for (int i = 0; i < (int) lineSegments.size(); i++)
+    {
+        const LineSegment& ls = lineSegments[i];
+        const float orientation = (ls.a.x - rayBase.x) * (ls.b.y - rayBase.y) - (ls.a.y - rayBase.y) * (ls.b.x - rayBase.x);
+
+        if (orientation == 0)
+        {
+            // Inside line segment
+            if (ls.hasOverlap(rayBase))
+            {
+                closestIntersections.clear();
+                return true;
+            }
+
+            continue;
+        }
+
+        // Counterclockwise, the segment goes from start to end
+        const Point start = orientation > 0 ? ls.a : ls.b;
+        const Point end = orientation > 0 ? ls.b : ls.a;
+        const float startAngle = angleAround(rayBase, start);
+        const float endAngle = angleAround(rayBase, end);
+
+        // Too thin to see
+        if (startAngle == endAngle)
+        {
+            continue;
+        }
+
+        events.push_back({ startAngle, true, i, start });
+        events.push_back({ endAngle, false, i, end });
+
+        if (startAngle > endAngle)
+        {
+            wrapping.push_back(i);
+        }
+    }
+
+    if (events.empty())
+    {
+        return true;
+    }
+
+    // By angle, and ends before starts at the same angle
+    std::sort(events.begin(), events.end(), [](const SweepEvent& a, const SweepEvent& b)
+    {
+        return a.angle < b.angle || (a.angle == b.angle && !a.isStart && b.isStart);
+    });
+
+    Point dir = Point(1, 0);
+    SweepOrder order = { &lineSegments, &rayBase, &dir };
+    SweepSet active(order, &scratch.pool);
+    std::vector<SweepSet::iterator>& activeAt = scratch.activeAt;
+    activeAt.assign(lineSegments.size(), active.end());
+
+    // Segments crossing angle 0 are active from the start
+    const float firstMid = events.front().angle / 2;
+    dir = Point(std::cos(firstMid), std::sin(firstMid));
+    for (int i : wrapping)
+    {
+        activeAt[i] = active.insert(i).first;
+    }
+    bool crossing = false;
+    for (auto it = active.begin(); !crossing && it != active.end(); ++it)
+    {
+        crossing = crossesNeighbours(lineSegments, active, it);
+    }
+
+    std::vector<Point>& fan = scratch.fan;
+    fan.clear();
+
+    for (int group = 0; !crossing && group < (int) events.size(); )
+    {
+        const float angle = events[group].angle;
+        int next = group;
+        while (next < (int) events.size() && events[next].angle == angle)
+        {
+            next++;
+        }
+
+        const int closestBefore = active.empty() ? -1 : *active.begin();
+
+        for (int e = group; e < next; e++)
+        {
+            const int i = events[e].segment;
+            if (!events[e].isStart && activeAt[i] != active.end())
+            {
+                const SweepSet::iterator next = active.erase(activeAt[i]);
+                activeAt[i] = active.end();
+                crossing = crossing || (next != active.begin() && crossesNeighbours(lineSegments, active, std::prev(next)));
+            }
+        }
+
+        // Insert along the middle of the gap to the next event, where every active segment is crossed
+        const float nextAngle = next < (int) events.size() ? events[next].angle : 2 * PI;
+        const float mid = (angle + nextAngle) / 2;
+        dir = Point(std::cos(mid), std::sin(mid));
+
+        for (int e = group; e < next; e++)
+        {
+            const int i = events[e].segment;
+            if (events[e].isStart && activeAt[i] == active.end())
+            {
+                activeAt[i] = active.insert(i).first;
+                crossing = crossing || crossesNeighbours(lineSegments, active, activeAt[i]);
+            }
+        }
+
+        const int closestAfter = active.empty() ? -1 : *active.begin();
+
+        if (closestBefore != closestAfter)
+        {
+            if (closestBefore >= 0)
+            {
+                fan.push_back(hitAtEvent(rayBase, events[group], lineSegments[closestBefore]));
+            }
+            if (closestAfter >= 0)
+            {
+                // At a shared corner both hits are the same point
+                const Point hit = hitAtEvent(rayBase, events[group], lineSegments[closestAfter]);
+                if (fan.empty() || closestBefore < 0 || !(fan.back() == hit))
+                {
+                    fan.push_back(hit);
+                }
+            }
+        }
+
+        group = next;
+    }
+
+    if (crossing)
+    {
+        getClosestIntersectionOfVertexRays(rayBase, lineSegments, closestIntersections, scratch.rays);
+        return false;
+    }
+
+    // Sweep went counterclockwise, the fan is sorted by angle the other way
+    closestIntersections.insert(closestIntersections.end(), fan.rbegin(), fan.rend());
+
+    return true;
+}
+
+/**
+ * Returns the angle brought into [0, 2 * PI).
+ */
+static float turnAngle(const float angle)
+{
+    return angle - std::floor(angle / (2 * PI)) * 2 * PI;
+}
+
+IncrementalSweep::IncrementalSweep()
+{
+    lineSegments = nullptr;
+    base = Point(0,0);
+    dir = Point(1,0);
+    valid = false;
+    repairedGapCount = 0;
+    crossing = false;
+}
+
+/**
+ * Forgets the previous sweep, the next update sweeps from scratch. Has to be called
+ * whenever the line segments change.
+ */
+void IncrementalSweep::invalidate()
+{
+    valid = false;
+}
+
+/**
+ * Returns the number of gaps between event angles in the last update.
+ */
+int IncrementalSweep::gaps() const
+{
+    return groups.size();
+}
+
+/**
+ * Returns the number of gaps whose closest segment the last update had to compute again.
+ */
+int IncrementalSweep::repairedGaps() const
+{
+    return repairedGapCount;
+}
+
+/**
+ * Returns the angle in the middle of the gap after the given group of events.
+ */
+float IncrementalSweep::gapAngle(const int group) const
+{
+    const float angle = events[groups[group]].key;
+    const float next = group + 1 < (int) groups.size() ? events[groups[group + 1]].key : events[groups[0]].key + 2 * PI;
+
+    return (angle + next) / 2;
+}
+
+/**
+ * Same as hitAtEvent(), for the first event of the given group, but compares the keys the
+ * segment's endpoints already have instead of computing their angles again.
+ */
+Point IncrementalSweep::hitAtGroup(const int group, const int segment) const
+{
+    const SweepEvent& event = events[groups[group]].event;
+    const float key = events[groups[group]].key;
+    const LineSegment& ls = (*lineSegments)[segment];
+
+    if (segmentKeys[2 * segment] == key)
+    {
+        return orientations[segment] > 0 ? ls.a : ls.b;
+    }
+    if (segmentKeys[2 * segment + 1] == key)
+    {
+        return orientations[segment] > 0 ? ls.b : ls.a;
+    }
+
+    const Point dir = Point(event.vertex.x - base.x, event.vertex.y - base.y);
+    const Point e = Point(ls.b.x - ls.a.x, ls.b.y - ls.a.y);
+    const Point ba = Point(ls.a.x - base.x, ls.a.y - base.y);
+    const float t = (ba.x * e.y - ba.y * e.x) / (dir.x * e.y - dir.y * e.x);
+
+    return Point(base.x + t * dir.x, base.y + t * dir.y);
+}
+
+/**
+ * Brings the events up to date with the new base, and marks the events whose
+ * neighbourhood changed as dirty.
+ *
+ * Each event's key follows its angle continuously from the previous base, so events
+ * that cross angle 0 stay near their old place and the old order is nearly sorted. An
+ * insertion sort then only moves the few events whose order changed, and every event
+ * moved over is dirty. Segments the base went around swap start and end, and are dirty.
+ * Without a previous sweep, or if events moved too far, the events are made again and
+ * all of them are dirty.
+ */
+void IncrementalSweep::updateEvents(const bool sameMap)
+{
+    // By key, and ends before starts at the same key
+    auto before = [](const Event& a, const Event& b)
+    {
+        return a.key < b.key || (a.key == b.key && !a.event.isStart && b.event.isStart);
+    };
+
+    bool rebuild = !sameMap;
+
+    for (int i = 0; !rebuild && i < (int) events.size(); i++)
+    {
+        Event& e = events[i];
+        const float angle = angleAround(base, e.event.vertex);
+        const float oldKey = e.key;
+        const float turns = std::round((oldKey - angle) / (2 * PI));
+
+        e.key = angle + turns * 2 * PI;
+        e.event.angle = angle;
+        e.dirty = false;
+
+        if (flipped[e.event.segment])
+        {
+            e.event.isStart = !e.event.isStart;
+            e.dirty = true;
+        }
+
+        // Too far to follow, or drifted a whole turn away from the others
+        rebuild = std::fabs(e.key - oldKey) > PI / 2 || e.key < -PI || e.key >= 3 * PI;
+    }
+
+    // Events that passed each other where the keys wrap would leave the keys spanning more
+    // than a turn. They are brought back to the front, but the insertion sort then moves
+    // them over the wrong side of the circle, so every gap is swept again.
+    float minKey = 0;
+    bool folded = false;
+    for (int i = 0; !rebuild && i < (int) events.size(); i++)
+    {
+        minKey = i == 0 ? events[i].key : std::min(minKey, events[i].key);
+    }
+    for (int i = 0; !rebuild && i < (int) events.size(); i++)
+    {
+        if (events[i].key >= minKey + 2 * PI)
+        {
+            events[i].key -= 2 * PI;
+            folded = true;
+        }
+    }
+
+    int shifts = 0;
+    for (int i = 1; !rebuild && i < (int) events.size(); i++)
+    {
+        if (!before(events[i], events[i - 1]))
+        {
+            continue;
+        }
+
+        Event moving = events[i];
+        int j = i;
+        while (j > 0 && before(moving, events[j - 1]))
+        {
+            events[j] = events[j - 1];
+            events[j].dirty = true;
+            j--;
+        }
+        moving.dirty = true;
+        events[j] = moving;
+
+        shifts += i - j;
+        rebuild = shifts > (int) events.size();
+    }
+
+    if (rebuild)
+    {
+        events.clear();
+
+        for (int i = 0; i < (int) lineSegments->size(); i++)
+        {
+            const LineSegment& ls = (*lineSegments)[i];
+            const Point start = orientations[i] > 0 ? ls.a : ls.b;
+            const Point end = orientations[i] > 0 ? ls.b : ls.a;
+            const float startAngle = angleAround(base, start);
+            const float endAngle = angleAround(base, end);
+
+            events.push_back({ { startAngle, true, i, start }, startAngle, -1, true, false });
+            events.push_back({ { endAngle, false, i, end }, endAngle, -1, true, false });
+        }
+
+        std::sort(events.begin(), events.end(), before);
+    }
+    else
+    {
+        // Two events that start or stop sharing an angle split or merge a gap
+        for (int i = 0; i < (int) events.size(); i++)
+        {
+            const bool tied = i + 1 < (int) events.size() && events[i].key == events[i + 1].key;
+            if (folded || tied != events[i].tiedWithNext)
+            {
+                events[i].dirty = true;
+                events[i + (i + 1 < (int) events.size())].dirty = true;
+            }
+        }
+    }
+
+    groups.clear();
+    for (int i = 0; i < (int) events.size(); i++)
+    {
+        events[i].tiedWithNext = i + 1 < (int) events.size() && events[i].key == events[i + 1].key;
+
+        if (i == 0 || events[i].key != events[i - 1].key)
+        {
+            groups.push_back(i);
+        }
+    }
+}
+
+/**
+ * Computes the closest segment of count gaps, starting at the gap after group first.
+ *
+ * The active segments of the gap before are found by checking the keys of all segments,
+ * and from there the sweep goes on as in getClosestIntersectionOfRaysSweep().
+ */
+void IncrementalSweep::repairGaps(SweepSet& active, const int first, const int count)
+{
+    const int groupCount = groups.size();
+    std::vector<SweepSet::iterator>& activeAt = scratch.activeAt;
+
+    for (const int i : active)
+    {
+        activeAt[i] = active.end();
+    }
+    active.clear();
+
+    const float angle = gapAngle((first + groupCount - 1) % groupCount);
+    dir = Point(std::cos(angle), std::sin(angle));
+
+    // Same keys as the events, so the scan agrees with a sweep from the start
+    for (int i = 0; i < (int) lineSegments->size(); i++)
+    {
+        const float width = turnAngle(segmentKeys[2 * i + 1] - segmentKeys[2 * i]);
+        const float offset = turnAngle(angle - segmentKeys[2 * i]);
+
+        if (offset > 0 && offset < width)
+        {
+            activeAt[i] = active.insert(i).first;
+        }
+    }
+    for (auto it = active.begin(); !crossing && it != active.end(); ++it)
+    {
+        crossing = crossesNeighbours(*lineSegments, active, it);
+    }
+
+    for (int k = 0; k < count; k++)
+    {
+        const int group = (first + k) % groupCount;
+        const int next = group + 1 < groupCount ? groups[group + 1] : events.size();
+
+        for (int e = groups[group]; e < next; e++)
+        {
+            const int i = events[e].event.segment;
+            if (!events[e].event.isStart && activeAt[i] != active.end())
+            {
+                const SweepSet::iterator next = active.erase(activeAt[i]);
+                activeAt[i] = active.end();
+                crossing = crossing || (next != active.begin() && crossesNeighbours(*lineSegments, active, std::prev(next)));
+            }
+        }
+
+        const float mid = gapAngle(group);
+        dir = Point(std::cos(mid), std::sin(mid));
+
+        for (int e = groups[group]; e < next; e++)
+        {
+            const int i = events[e].event.segment;
+            if (events[e].event.isStart && activeAt[i] == active.end() && segmentKeys[2 * i] != segmentKeys[2 * i + 1])
+            {
+                activeAt[i] = active.insert(i).first;
+                crossing = crossing || crossesNeighbours(*lineSegments, active, activeAt[i]);
+            }
+        }
+
+        gapClosest[group] = active.empty() ? -1 : *active.begin();
+    }
+
+    repairedGapCount += count;
+}
+
+/**
+ * Builds the same triangle fan as getClosestIntersectionOfRaysSweep(), reusing the sweep
+ * of the previous call.
+ *
+ * Segments that do not cross keep their distance order, so the closest segment in a gap
+ * between two event angles can only change if an event moved into, out of or across
+ * that gap. Only those gaps are swept again, and the fan is made from the closest
+ * segment of every gap. Moving the light a little usually reorders a handful of events,
+ * so most of the sweep is reused. A clean stretch between two dirty gaps is swept again
+ * too if it has fewer gaps than one per SEGMENTS_PER_BRIDGED_GAP line segments, since
+ * going on through it is cheaper than starting the sweep again after it.
+ *
+ * Each update is still O(N) in the line segments: every event's angle is computed again,
+ * every segment's side of the base is checked, and each swept stretch of gaps first scans
+ * all segments for the ones active at its start. Bridging keeps those stretches at most
+ * 2 * SEGMENTS_PER_BRIDGED_GAP. What is saved is the O(N log N) of sorting the events and
+ * of the active set, which are the bulk of a full sweep. Only re-keying the events that
+ * can change order would need bounds on how far each angle moves, which is not done.
+ *
+ * If the first sweep of the line segments finds two that cross, every fan is built by
+ * getClosestIntersectionOfVertexRays() instead, until the line segments change.
+ *
+ * Warning: the line segments must stay at the same address and must not change between
+ * calls, or invalidate() has to be called first.
+ */
+void IncrementalSweep::update(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections)
+{
+    const bool sameMap = valid && this->lineSegments == &lineSegments && orientations.size() == lineSegments.size();
+
+    if (sameMap && crossing)
+    {
+        getClosestIntersectionOfVertexRays(rayBase, lineSegments, closestIntersections, scratch.rays);
+        return;
+    }
+    crossing = false;
+
+    const Point move = Point(rayBase.x - base.x, rayBase.y - base.y);
+    const Point oldBase = base;
+    bool crossed = false;
+
+    this->lineSegments = &lineSegments;
+    base = rayBase;
+    valid = false;
+    repairedGapCount = 0;
+
+    orientations.resize(lineSegments.size());
+    flipped.resize(lineSegments.size());
+
+    for (int i = 0; i < (int) lineSegments.size(); i++)
+    {
+        const LineSegment& ls = lineSegments[i];
+        const float orientation = (ls.a.x - rayBase.x) * (ls.b.y - rayBase.y) - (ls.a.y - rayBase.y) * (ls.b.x - rayBase.x);
+
+        // Inside line segment, or on the line of one, which the sweep has no events for
+        if (orientation == 0)
+        {
+            getClosestIntersectionOfRaysSweep(rayBase, lineSegments, closestIntersections, scratch);
+            return;
+        }
+
+        const signed char side = orientation > 0 ? 1 : -1;
+        flipped[i] = sameMap && side != orientations[i];
+        orientations[i] = side;
+
+        // Going around the end of a segment swaps its two events, which the sort sees. Going
+        // through it keeps them in place, but the segment now covers the other half turn.
+        if (flipped[i])
+        {
+            const float sideA = move.x * (ls.a.y - oldBase.y) - move.y * (ls.a.x - oldBase.x);
+            const float sideB = move.x * (ls.b.y - oldBase.y) - move.y * (ls.b.x - oldBase.x);
+            crossed = crossed || (sideA <= 0 && sideB >= 0) || (sideA >= 0 && sideB <= 0);
+        }
+    }
+
+    updateEvents(sameMap);
+    valid = true;
+
+    segmentKeys.resize(2 * lineSegments.size());
+    for (int i = 0; i < (int) events.size(); i++)
+    {
+        events[i].dirty = events[i].dirty || crossed;
+        segmentKeys[2 * events[i].event.segment + !events[i].event.isStart] = events[i].key;
+    }
+
+    const int groupCount = groups.size();
+    if (groupCount == 0)
+    {
+        return;
+    }
+
+    groupDirty.assign(groupCount, false);
+    gapClosest.resize(groupCount);
+    for (int group = 0; group < groupCount; group++)
+    {
+        const int next = group + 1 < groupCount ? groups[group + 1] : events.size();
+        for (int e = groups[group]; e < next; e++)
+        {
+            groupDirty[group] = groupDirty[group] || events[e].dirty;
+        }
+
+        gapClosest[group] = events[groups[group]].closest;
+    }
+
+    // A gap is dirty if an event on either side of it is
+    int dirty = -1;
+    gapDirty.resize(groupCount);
+    for (int group = 0; group < groupCount; group++)
+    {
+        gapDirty[group] = groupDirty[group] || groupDirty[(group + 1) % groupCount];
+        if (gapDirty[group])
+        {
+            dirty = group;
+        }
+    }
+
+    // Starting the sweep again scans all segments, going on through a short clean stretch is cheaper
+    const int bridge = lineSegments.size() / SEGMENTS_PER_BRIDGED_GAP;
+    for (int k = 1; dirty >= 0 && k < groupCount; )
+    {
+        if (gapDirty[(dirty + k) % groupCount])
+        {
+            k++;
+            continue;
+        }
+
+        int length = 0;
+        while (k + length < groupCount && !gapDirty[(dirty + k + length) % groupCount])
+        {
+            length++;
+        }
+        for (int j = 0; length < bridge && j < length; j++)
+        {
+            gapDirty[(dirty + k + j) % groupCount] = true;
+        }
+
+        k += length;
+    }
+
+    int clean = -1;
+    for (int group = 0; group < groupCount; group++)
+    {
+        if (!gapDirty[group])
+        {
+            clean = group;
+        }
+    }
+
+    SweepOrder order = { &lineSegments, &base, &dir };
+    SweepSet active(order, &scratch.pool);
+    scratch.activeAt.assign(lineSegments.size(), active.end());
+
+    if (clean < 0)
+    {
+        repairGaps(active, 0, groupCount);
+    }
+    else
+    {
+        for (int k = 1; k <= groupCount; k++)
+        {
+            const int group = (clean + k) % groupCount;
+            if (!gapDirty[group] || gapDirty[(group + groupCount - 1) % groupCount])
+            {
+                continue;
+            }
+
+            int count = 0;
+            while (gapDirty[(group + count) % groupCount])
+            {
+                count++;
+            }
+
+            repairGaps(active, group, count);
+        }
+    }
+
+    if (crossing)
+    {
+        getClosestIntersectionOfVertexRays(rayBase, lineSegments, closestIntersections, scratch.rays);
+        return;
+    }
+
+    // Keys may have left [0, 2 * PI), start where the normalized angles start
+    int start = 0;
+    for (int group = 1; group < groupCount; group++)
+    {
+        if (events[groups[group]].event.angle < events[groups[start]].event.angle)
+        {
+            start = group;
+        }
+    }
+
+    std::vector<Point>& fan = scratch.fan;
+    fan.clear();
+
+    for (int k = 0; k < groupCount; k++)
+    {
+        const int group = (start + k) % groupCount;
+        const int closestBefore = gapClosest[(group + groupCount - 1) % groupCount];
+        const int closestAfter = gapClosest[group];
+
+        if (closestBefore != closestAfter)
+        {
+            if (closestBefore >= 0)
+            {
+                fan.push_back(hitAtGroup(group, closestBefore));
+            }
+            if (closestAfter >= 0)
+            {
+                // At a shared corner both hits are the same point
+                const Point hit = hitAtGroup(group, closestAfter);
+                if (fan.empty() || closestBefore < 0 || !(fan.back() == hit))
+                {
+                    fan.push_back(hit);
+                }
+            }
+        }
+
+        const int next = group + 1 < groupCount ? groups[group + 1] : events.size();
+        for (int e = groups[group]; e < next; e++)
+        {
+            events[e].closest = closestAfter;
+        }
+    }
+
+    // Sweep went counterclockwise, the fan is sorted by angle the other way
+    closestIntersections.insert(closestIntersections.end(), fan.rbegin(), fan.rend());
+}
+
+/**
+ * Builds the triangle fan with the chosen engine.
+ *
+ * All engines give the same polygon, so they can be switched with a flag and compared.
+ */
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, const FanEngine engine)
+{
+    if (engine == FanEngine::Sweep)
+    {
+        getClosestIntersectionOfRaysSweep(rayBase, lineSegments, closestIntersections);
+    }
+    else if (engine == FanEngine::VertexRays)
+    {
+        getClosestIntersectionOfVertexRays(rayBase, lineSegments, closestIntersections);
+    }
+    else
+    {
+        getClosestIntersectionOfRays(rayBase, lineSegments, closestIntersections);
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <set>
+#include <memory_resource>
+#include "RayCasting.h"
+
+enum class FanEngine
+{
+    ThreeRays, Sweep, VertexRays
+};
+
+struct SweepEvent
+{
+    float angle; // normalized angle of the endpoint around the base, in [0, 2 * PI)
+    bool  isStart; // true if the segment starts here (going counterclockwise), false if it ends here
+    int   segment;
+    Point vertex;
+};
+
+struct SweepOrder
+{
+    const std::vector<LineSegment>* lineSegments;
+    const Point* base;
+    const Point* dir; // current sweep ray
+
+    float distance(const int i) const;
+    bool  operator()(const int a, const int b) const;
+};
+
+typedef std::pmr::set<int, SweepOrder> SweepSet;
+
+// Reusable working buffers for the sweep, so repeated queries do not allocate
+struct SweepScratch
+{
+    std::vector<SweepEvent> events;
+    std::vector<int> wrapping;
+    std::vector<SweepSet::iterator> activeAt;
+    std::vector<Point> fan;
+    std::pmr::unsynchronized_pool_resource pool; // nodes of the active segment tree
+    RayCastScratch rays; // for the vertex rays fan, when line segments cross
+};
+
+// Sweep that keeps its state between calls, for a light that moves a little at a time
+class IncrementalSweep
+{
+private:
+    struct Event
+    {
+        SweepEvent event; // angle is normalized, same as getClosestIntersectionOfRaysSweep()
+        float key; // angle followed continuously from the previous base, may leave [0, 2 * PI)
+        int   closest; // closest segment in the gap after this event's angle, -1 if none
+        bool  dirty;
+        bool  tiedWithNext; // next event has the same key
+    };
+
+    const std::vector<LineSegment>* lineSegments;
+    Point base;
+    Point dir;
+    bool  valid;
+    std::vector<Event> events;
+    std::vector<signed char> orientations; // side of the base for each segment, 1 or -1
+    std::vector<char> flipped;
+    std::vector<float> segmentKeys; // keys of each segment's start and end
+    std::vector<int> groups; // first event of each angle
+    std::vector<char> groupDirty;
+    std::vector<char> gapDirty;
+    std::vector<int> gapClosest;
+    SweepScratch scratch;
+    int repairedGapCount;
+    bool crossing; // two of the line segments cross, the fan is built by vertex rays
+
+    void  updateEvents(const bool sameMap);
+    void  repairGaps(SweepSet& active, const int first, const int count);
+    float gapAngle(const int group) const;
+    Point hitAtGroup(const int group, const int segment) const;
+
+public:
+    static const int SEGMENTS_PER_BRIDGED_GAP = 8;
+
+    IncrementalSweep();
+
+    void invalidate();
+    void update(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections);
+    int  gaps() const;
+    int  repairedGaps() const;
+};
+
+bool getClosestIntersectionOfRaysSweep(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections);
+
+bool getClosestIntersectionOfRaysSweep(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, SweepScratch& scratch);
+
+void getClosestIntersectionOfRays(const Point rayBase, const std::vector<LineSegment>& lineSegments, std::vector<Point>& closestIntersections, const FanEngine engine);
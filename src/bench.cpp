@@ -0,0 +1,763 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include "RayCasting.h"
+#include "SegmentStore.h"
+#include "BVH.h"
+#include "VisibilitySweep.h"
+#include "ParallelRayCasting.h"
+#include "MapGenerator.h"
+#include "RayCastStats.h"
+#include "LightMap.h"
+#include "MapFile.h"
+#include "TwoLevelBVH.h"
+#include "FanCache.h"
+#include "Map.h"
+
+/**
+ * Benchmarks of the ray casting engines.
+ *
+ * Workloads:
+ *  - closest-hit: one ray at a time against maps of growing size
+ *  - uniform-rays: getClosestIntersectionsOfRays() with 64 to 65536 rays
+ *  - uniform-rays-parallel: the same at 1, 2, 4, ... threads up to the hardware thread count
+ *  - fan: getClosestIntersectionOfRays() on maps of 10 to 1M line segments (--max-segments)
+ *  - limited-light: fans of a torch of radius 1/20 of the map, and of a 60 degree cone
+ *  - moving-occluders: a frame of 100 moving line segments on a static map, 1024 rays per frame
+ *  - coherent-rays: 1024 rays from a slowly moving light, hinted with last frame's hits or not
+ *  - fan-cache: fans of a light flickering around one spot, from a FanCache against casting them
+ *  - line-of-sight: 1024 hasLineOfSight() queries, against the closest or all hits they replace
+ *  - map-file: opening a map file, against building the BVH it stores (rays are line segments)
+ *  - light-map: filling a 1024 x 1024 LightMap from one fan, at each SIMD level
+ *
+ * All workloads run on generated maps of one kind (--map, random by default). Every case is
+ * timed call by call until it ran for its time budget. Results are printed as a table and
+ * written as JSON (--json), to compare engines and releases.
+ *
+ * Built with -DRAYCAST_STATS (make bench DEFINES=-DRAYCAST_STATS), the JSON also has the
+ * instrumentation counters of each case, and the timings include their overhead.
+ *
+ * Usage: bench.exe [--json file] [--filter text] [--map kind] [--max-segments n] [--budget ms] [--quick]
+ */
+
+struct BenchOptions
+{
+    std::string jsonPath;
+    std::string filter; // only cases whose name contains this
+    MapKind mapKind;
+    int   maxSegments;
+    double budgetMs; // time spent on each case, at least one call is always timed
+    int   minSamples;
+
+    BenchOptions() : jsonPath("./bin/bench.json"), filter(""), mapKind(MapKind::Random), maxSegments(1000000), budgetMs(300), minSamples(5) {}
+};
+
+struct BenchResult
+{
+    std::string workload;
+    std::string engine;
+    int    segments;
+    int    rays; // rays per call, for a fan three per vertex (also for the sweep, which casts none), for a light map its pixels
+    int    threads;
+    int    samples;
+    double nsPerRay;
+    double raysPerSecond;
+    double p50Us; // latency of one call
+    double p99Us;
+    RayCastStats stats; // of all calls, warm-up included, when built with RAYCAST_STATS
+};
+
+/**
+ * Returns the value below which the given fraction of the sorted samples lie.
+ */
+double percentile(const std::vector<double>& sorted, const double fraction)
+{
+    const int i = (int) std::ceil(fraction * sorted.size()) - 1;
+    return sorted[std::max(0, std::min(i, (int) sorted.size() - 1))];
+}
+
+/**
+ * Times call until the budget is used up and at least minSamples calls ran, or a single
+ * call used up the budget. One warm-up call before that is not counted.
+ */
+BenchResult measure(const std::string& workload, const std::string& engine, const int segments, const int rays, const int threads, const BenchOptions& options, const std::function<void()>& call)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    call();
+
+    std::vector<double> samples;
+    double totalNs = 0;
+    while ((int) samples.size() < options.minSamples || totalNs < options.budgetMs * 1e6)
+    {
+        const Clock::time_point start = Clock::now();
+        call();
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        samples.push_back(ns);
+        totalNs += ns;
+
+        // A single call that takes the whole budget already tells enough
+        if (ns >= options.budgetMs * 1e6)
+        {
+            break;
+        }
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    BenchResult result;
+    result.workload = workload;
+    result.engine = engine;
+    result.segments = segments;
+    result.rays = rays;
+    result.threads = threads;
+    result.samples = (int) samples.size();
+    result.nsPerRay = percentile(samples, 0.5) / rays;
+    result.raysPerSecond = (double) rays * samples.size() / (totalNs / 1e9);
+    result.p50Us = percentile(samples, 0.5) / 1000;
+    result.p99Us = percentile(samples, 0.99) / 1000;
+
+    return result;
+}
+
+class Bench
+{
+private:
+    BenchOptions options;
+    std::vector<BenchResult> results;
+
+    std::vector<LineSegment> map(const int count) const;
+    bool selected(const std::string& workload, const std::string& engine) const;
+    void run(const std::string& workload, const std::string& engine, const int segments, const int rays, const int threads, const std::function<void()>& call);
+
+public:
+    Bench(const BenchOptions& options);
+
+    void closestHit();
+    void uniformRays();
+    void uniformRaysParallel();
+    void fan();
+    void limitedLight();
+    void movingOccluders();
+    void coherentRays();
+    void fanCache();
+    void lineOfSight();
+    void mapFile();
+    void lightMap();
+    void writeJson(std::ostream& out) const;
+};
+
+Bench::Bench(const BenchOptions& options) : options(options) {}
+
+/**
+ * Generates the map of the chosen kind, the same one for every engine and run.
+ */
+std::vector<LineSegment> Bench::map(const int count) const
+{
+    std::vector<LineSegment> lineSegments;
+    generateMap(options.mapKind, count, 2024, lineSegments);
+
+    return lineSegments;
+}
+
+/**
+ * Checks the case against --filter, which matches on "workload/engine".
+ */
+bool Bench::selected(const std::string& workload, const std::string& engine) const
+{
+    return (workload + "/" + engine).find(options.filter) != std::string::npos;
+}
+
+/**
+ * Measures one case and prints its row of the table.
+ */
+void Bench::run(const std::string& workload, const std::string& engine, const int segments, const int rays, const int threads, const std::function<void()>& call)
+{
+    if (!selected(workload, engine))
+    {
+        return;
+    }
+
+    resetRayCastStats();
+    BenchResult r = measure(workload, engine, segments, rays, threads, options, call);
+    r.stats = getRayCastStats();
+    results.push_back(r);
+
+    std::cout << r.workload << "\t" << r.engine << "\t" << r.segments << "\t" << r.rays << "\t" << r.threads << "\t"
+              << r.samples << "\t" << r.nsPerRay << "\t" << (long long) r.raysPerSecond << "\t" << r.p50Us << "\t" << r.p99Us << std::endl;
+}
+
+/**
+ * One ray per call, turning a little each call so consecutive rays do not hit the same
+ * segment. Includes the cost of reading the clock, a few tens of ns.
+ */
+void Bench::closestHit()
+{
+    const int sizes[] = { 10, 1000, 100000 };
+    const float step = 2.39996f; // golden angle
+    auto turn = [step](float& angle) { angle = std::fmod(angle + step, 2 * PI); };
+
+    for (const int n : sizes)
+    {
+        if (n > options.maxSegments)
+        {
+            continue;
+        }
+
+        const std::vector<LineSegment> lineSegments = map(n);
+        const SegmentStore store(lineSegments);
+        const BVH bvh(lineSegments);
+        float angle = 0;
+        Point hit;
+
+        run("closest-hit", "linear", n, 1, 1, [&]() { turn(angle); getClosestIntersection(Ray(angle, Point(0,0)), lineSegments, hit); });
+        run("closest-hit", "segment-store", n, 1, 1, [&]() { turn(angle); getClosestIntersection(Ray(angle, Point(0,0)), store, hit); });
+        run("closest-hit", "bvh", n, 1, 1, [&]() { turn(angle); getClosestIntersection(Ray(angle, Point(0,0)), bvh, hit); });
+    }
+}
+
+/**
+ * Evenly spaced rays around the base on a 1000-segment map.
+ */
+void Bench::uniformRays()
+{
+    const int n = std::min(1000, options.maxSegments);
+    const std::vector<LineSegment> lineSegments = map(n);
+    const SegmentStore store(lineSegments);
+    const BVH bvh(lineSegments);
+    std::vector<Point> out;
+
+    for (int rays = 64; rays <= 65536; rays *= 4)
+    {
+        out.reserve(rays);
+        run("uniform-rays", "linear", n, rays, 1, [&]() { out.clear(); getClosestIntersectionsOfRays(Point(0,0), rays, lineSegments, out); });
+        run("uniform-rays", "segment-store", n, rays, 1, [&]() { out.clear(); getClosestIntersectionsOfRays(Point(0,0), rays, store, out); });
+        run("uniform-rays", "bvh", n, rays, 1, [&]() { out.clear(); getClosestIntersectionsOfRays(Point(0,0), rays, bvh, out); });
+    }
+}
+
+/**
+ * Scaling with thread count of a dense 4096-ray sweep over a 5000-segment map.
+ */
+void Bench::uniformRaysParallel()
+{
+    const int n = std::min(5000, options.maxSegments);
+    const int rays = 4096;
+    const std::vector<LineSegment> lineSegments = map(n);
+    std::vector<Point> out;
+    out.reserve(rays);
+
+    int maxThreads = std::thread::hardware_concurrency();
+    if (maxThreads < 1)
+    {
+        maxThreads = 1;
+    }
+
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2)
+    {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    for (const int threads : threadCounts)
+    {
+        ThreadPool pool(threads);
+        run("uniform-rays-parallel", "linear", n, rays, threads, [&]() { out.clear(); getClosestIntersectionsOfRays(Point(0,0), rays, lineSegments, out, pool); });
+    }
+}
+
+/**
+ * Full visibility fans, from three rays per vertex and from one (linear-vertex-rays).
+ * Checking every segment for each ray is quadratic, and rays through far vertices cross
+ * much of the BVH, so those engines stop at smaller maps than the sweep. The sweep only
+ * handles line segments that do not cross, on random and corridor maps it sweeps a maze
+ * of the same size (sweep-maze).
+ */
+void Bench::fan()
+{
+    const int linearLimit = 1000;
+    const int bvhLimit = 100000;
+    std::vector<Point> out;
+    RayCastScratch scratch;
+    SweepScratch sweepScratch;
+
+    for (int n = 10; n <= options.maxSegments; n *= 10)
+    {
+        const std::vector<LineSegment> lineSegments = map(n);
+        const BVH bvh(lineSegments);
+
+        std::vector<Point> vertices;
+        getVertices(lineSegments, vertices);
+        const int rays = 3 * (int) vertices.size();
+
+        if (n <= linearLimit)
+        {
+            run("fan", "linear", n, rays, 1, [&]() { out.clear(); getClosestIntersectionOfRays(Point(0,0), lineSegments, out, scratch); });
+            run("fan", "linear-vertex-rays", n, (int) vertices.size(), 1, [&]() { out.clear(); getClosestIntersectionOfVertexRays(Point(0,0), lineSegments, out, scratch); });
+        }
+        if (n <= bvhLimit)
+        {
+            run("fan", "bvh", n, rays, 1, [&]() { out.clear(); getClosestIntersectionOfRays(Point(0,0), bvh, out); });
+        }
+
+        // The sweep falls back to vertex rays where line segments cross, which is quadratic.
+        // On maps that cross it sweeps a maze of the same size instead.
+        std::vector<LineSegment> swept = lineSegments;
+        const char* sweepEngine = "sweep";
+        if (mapKindCrosses(options.mapKind))
+        {
+            swept.clear();
+            generateMap(MapKind::Maze, n, 2024, swept);
+            sweepEngine = "sweep-maze";
+        }
+        std::vector<Point> sweptVertices;
+        getVertices(swept, sweptVertices);
+
+        out.clear();
+        if (getClosestIntersectionOfRaysSweep(Point(0,0), swept, out, sweepScratch))
+        {
+            run("fan", sweepEngine, n, 3 * (int) sweptVertices.size(), 1, [&]() { out.clear(); getClosestIntersectionOfRaysSweep(Point(0,0), swept, out, sweepScratch); });
+        }
+        else
+        {
+            std::cerr << "fan/" << sweepEngine << " skipped at " << n << " line segments, they cross\n";
+        }
+    }
+}
+
+/**
+ * Fans of small lights in the middle of large maps: all around with a radius of 1/20 of
+ * the map's size, and a cone of 60 degrees as far. rays is the number of fan points.
+ */
+void Bench::limitedLight()
+{
+    std::vector<Point> out;
+    RayCastScratch scratch;
+
+    for (int n = 1000; n <= options.maxSegments; n *= 10)
+    {
+        const std::vector<LineSegment> lineSegments = map(n);
+        const BVH bvh(lineSegments);
+
+        AABB bounds;
+        for (const LineSegment& ls : lineSegments)
+        {
+            bounds.grow(ls.a);
+            bounds.grow(ls.b);
+        }
+        const float radius = std::max(bounds.maxX - bounds.minX, bounds.maxY - bounds.minY) / 20;
+        const float cone = PI / 3;
+
+        out.clear();
+        getClosestIntersectionOfRays(Point(0,0), lineSegments, radius, 0, 2 * PI, out, scratch);
+        const int torchRays = out.size();
+        out.clear();
+        getClosestIntersectionOfRays(Point(0,0), lineSegments, radius, 0, cone, out, scratch);
+        const int coneRays = out.size();
+
+        run("limited-light", "linear-torch", n, torchRays, 1, [&]() { out.clear(); getClosestIntersectionOfRays(Point(0,0), lineSegments, radius, 0, 2 * PI, out, scratch); });
+        run("limited-light", "bvh-torch", n, torchRays, 1, [&]() { out.clear(); getClosestIntersectionOfRays(Point(0,0), bvh, radius, 0, 2 * PI, out, scratch); });
+        run("limited-light", "linear-cone", n, coneRays, 1, [&]() { out.clear(); getClosestIntersectionOfRays(Point(0,0), lineSegments, radius, 0, cone, out, scratch); });
+        run("limited-light", "bvh-cone", n, coneRays, 1, [&]() { out.clear(); getClosestIntersectionOfRays(Point(0,0), bvh, radius, 0, cone, out, scratch); });
+    }
+}
+
+/**
+ * One frame with 100 crates moving over a static map: update the acceleration structure,
+ * then cast 1024 evenly spaced rays. rebuild-all builds one BVH over every line segment each
+ * frame, two-level only updates the BVH of the crates.
+ */
+void Bench::movingOccluders()
+{
+    const int crateCount = 100;
+    const int rays = 1024;
+    std::vector<Point> out;
+    out.reserve(rays);
+
+    for (int n = 1000; n <= options.maxSegments; n *= 10)
+    {
+        const std::vector<LineSegment> walls = map(n);
+        std::vector<LineSegment> crates;
+        generateMap(MapKind::Random, crateCount, 99, crates);
+
+        float step = 0;
+        auto move = [&]()
+        {
+            step += 0.01f;
+            for (LineSegment& crate : crates)
+            {
+                crate.a = Point(crate.a.x + std::sin(step), crate.a.y + std::cos(step));
+                crate.b = Point(crate.b.x + std::sin(step), crate.b.y + std::cos(step));
+            }
+        };
+
+        std::vector<LineSegment> all;
+        BVH single;
+        run("moving-occluders", "rebuild-all", n, rays, 1, [&]()
+        {
+            move();
+            all = walls;
+            all.insert(all.end(), crates.begin(), crates.end());
+            single.build(all);
+            out.clear();
+            getClosestIntersectionsOfRays(Point(0,0), rays, single, out);
+        });
+
+        TwoLevelBVH scene(walls);
+        run("moving-occluders", "two-level", n, rays, 1, [&]()
+        {
+            move();
+            scene.setDynamic(crates);
+            out.clear();
+            getClosestIntersectionsOfRays(Point(0,0), rays, scene, out);
+        });
+    }
+}
+
+/**
+ * Frames of 1024 evenly spaced rays from a light walking slowly through the map. The hinted
+ * engines keep the line segment each ray hit for the next frame, see getClosestIntersection().
+ */
+void Bench::coherentRays()
+{
+    const int linearLimit = 10000;
+    const int rays = 1024;
+    std::vector<Point> out;
+    out.reserve(rays);
+
+    for (int n = 1000; n <= options.maxSegments; n *= 10)
+    {
+        const std::vector<LineSegment> lineSegments = map(n);
+        const BVH bvh(lineSegments);
+
+        int frame = 0;
+        auto walk = [&frame]() { frame++; return Point(0.01f * (frame % 1000), 0.005f * (frame % 1000)); };
+
+        std::vector<int> linearHints, bvhHints;
+        if (n <= linearLimit)
+        {
+            run("coherent-rays", "linear", n, rays, 1, [&]() { out.clear(); getClosestIntersectionsOfRays(walk(), rays, lineSegments, out); });
+            run("coherent-rays", "linear-hinted", n, rays, 1, [&]() { out.clear(); getClosestIntersectionsOfRays(walk(), rays, lineSegments, out, linearHints); });
+        }
+        run("coherent-rays", "bvh", n, rays, 1, [&]() { out.clear(); getClosestIntersectionsOfRays(walk(), rays, bvh, out); });
+        run("coherent-rays", "bvh-hinted", n, rays, 1, [&]() { out.clear(); getClosestIntersectionsOfRays(walk(), rays, bvh, out, bvhHints); });
+    }
+}
+
+/**
+ * A light flickering within 1 unit of the middle of the map, as a torch held by an idle
+ * character. With a quantum of 0.5 that is at most 25 fans, which the cache casts once,
+ * after that every call is a lookup. uncached casts the same fans each call.
+ */
+void Bench::fanCache()
+{
+    const int sizes[] = { 100, 1000 };
+    std::vector<Point> out;
+
+    for (const int n : sizes)
+    {
+        if (n > options.maxSegments)
+        {
+            continue;
+        }
+
+        Map m;
+        m.addLineSegments(map(n));
+        const int rays = 3 * m.sizeVertices();
+
+        int frame = 0;
+        auto flicker = [&frame]() { frame++; return Point(std::sin(frame * 2.39996f), std::cos(frame * 2.39996f * 3)); };
+
+        // Cast every fan once, so the cached case times lookups only
+        FanCache cache(0.5);
+        for (int i = 0; i < 1000; i++)
+        {
+            cache.getFan(flicker(), m);
+        }
+
+        run("fan-cache", "uncached", n, rays, 1, [&]()
+        {
+            out.clear();
+            getClosestIntersectionOfRays(cache.quantize(flicker()), m.getLineSegments(), m.getVertices(), out);
+        });
+        run("fan-cache", "cached", n, rays, 1, [&]() { cache.getFan(flicker(), m); });
+    }
+}
+
+/**
+ * Line of sight between 1024 random pairs of points spread over the map, most of them
+ * blocked, against what the query replaces: casting a ray from a towards b and comparing
+ * the distance of the closest hit with the distance of b, or of every hit. The linear
+ * closest-hit and all-hits cases test every line segment, so like the linear query they
+ * only run up to 1000 line segments; closest-hit-bvh casts the ray through the BVH.
+ */
+void Bench::lineOfSight()
+{
+    const int sizes[] = { 1000, 100000 };
+    const int queries = 1024;
+
+    for (const int n : sizes)
+    {
+        if (n > options.maxSegments)
+        {
+            continue;
+        }
+
+        const std::vector<LineSegment> lineSegments = map(n);
+        const BVH bvh(lineSegments);
+
+        AABB bounds;
+        for (const LineSegment& ls : lineSegments)
+        {
+            bounds.grow(ls.a);
+            bounds.grow(ls.b);
+        }
+
+        MapRandom random(7);
+        std::vector<LineSegment> sightLines;
+        for (int i = 0; i < queries; i++)
+        {
+            const Point a = Point(random.uniform(bounds.minX, bounds.maxX), random.uniform(bounds.minY, bounds.maxY));
+            const Point b = Point(random.uniform(bounds.minX, bounds.maxX), random.uniform(bounds.minY, bounds.maxY));
+            sightLines.push_back(LineSegment(a, b));
+        }
+
+        std::vector<char> visible(queries);
+        auto closer = [](const Point a, const Point b, const Point hit)
+        {
+            return (hit.x - a.x) * (hit.x - a.x) + (hit.y - a.y) * (hit.y - a.y) < (b.x - a.x) * (b.x - a.x) + (b.y - a.y) * (b.y - a.y);
+        };
+        auto closestHit = [&](auto closestIntersection)
+        {
+            for (int i = 0; i < queries; i++)
+            {
+                const Point a = sightLines[i].a;
+                const Point b = sightLines[i].b;
+                Point hit;
+                visible[i] = !closestIntersection(Ray(a, b), hit) || !closer(a, b, hit);
+            }
+        };
+
+        std::vector<Point> hits;
+        std::vector<LineSegment> hitLineSegments;
+        auto allHits = [&]()
+        {
+            for (int i = 0; i < queries; i++)
+            {
+                const Point a = sightLines[i].a;
+                const Point b = sightLines[i].b;
+                hits.clear();
+                hitLineSegments.clear();
+                getAllIntersectionsOfRay(Ray(a, b), lineSegments, hits, hitLineSegments);
+                visible[i] = std::none_of(hits.begin(), hits.end(), [&](const Point hit) { return closer(a, b, hit); });
+            }
+        };
+
+        if (n <= 1000)
+        {
+            run("line-of-sight", "linear", n, queries, 1, [&]() { hasLineOfSight(sightLines, lineSegments, visible); });
+            run("line-of-sight", "closest-hit-linear", n, queries, 1, [&]()
+            {
+                closestHit([&](const Ray r, Point& hit) { return getClosestIntersection(r, lineSegments, hit); });
+            });
+            run("line-of-sight", "all-hits", n, queries, 1, allHits);
+        }
+        run("line-of-sight", "closest-hit-bvh", n, queries, 1, [&]()
+        {
+            closestHit([&](const Ray r, Point& hit) { return getClosestIntersection(r, bvh, hit); });
+        });
+        run("line-of-sight", "bvh", n, queries, 1, [&]() { hasLineOfSight(sightLines, bvh, visible); });
+    }
+}
+
+/**
+ * Loading maps of 1000 line segments and up from map files with a BVH: just opening it,
+ * opening and checking the checksum, and opening and taking the stored BVH, against
+ * building the BVH from the line segments.
+ */
+void Bench::mapFile()
+{
+    const std::string path = "./bin/bench_map.rcmap";
+
+    // Writing the files takes longer than the cases, skip it when none of them run
+    bool any = false;
+    for (const char* engine : { "open", "open-verify", "restore-bvh", "build-bvh" })
+    {
+        any = any || selected("map-file", engine);
+    }
+    if (!any)
+    {
+        return;
+    }
+
+    for (int n = 1000; n <= options.maxSegments; n *= 10)
+    {
+        const std::vector<LineSegment> lineSegments = map(n);
+        if (!writeMapFile(path, lineSegments))
+        {
+            std::cerr << "could not write " << path << "\n";
+            return;
+        }
+
+        MapFile file;
+        BVH bvh;
+
+        run("map-file", "open", n, n, 1, [&]() { file.open(path); file.close(); });
+        run("map-file", "open-verify", n, n, 1, [&]() { file.open(path, true); file.close(); });
+        run("map-file", "restore-bvh", n, n, 1, [&]() { file.open(path); file.getBVH(bvh); file.close(); });
+        run("map-file", "build-bvh", n, n, 1, [&]() { bvh.build(lineSegments); });
+    }
+
+    std::remove(path.c_str());
+}
+
+/**
+ * Rasterizes the fan of a light in the middle of a 1000-segment map into a light map that
+ * covers the whole map, with linear falloff.
+ */
+void Bench::lightMap()
+{
+    const int n = std::min(1000, options.maxSegments);
+    const int size = 1024;
+    const std::vector<LineSegment> lineSegments = map(n);
+
+    AABB bounds;
+    for (const LineSegment& ls : lineSegments)
+    {
+        bounds.grow(ls.a);
+        bounds.grow(ls.b);
+    }
+
+    std::vector<Point> fan;
+    getClosestIntersectionOfRaysSweep(Point(0,0), lineSegments, fan);
+
+    const float pixelSize = std::max(bounds.maxX - bounds.minX, bounds.maxY - bounds.minY) / size;
+    LightMap lights(size, size, Point(bounds.minX, bounds.minY), pixelSize);
+    const Light light(1, Falloff::Linear, size * pixelSize / 2);
+
+    const SimdLevel level = getSimdLevel();
+    const char* names[] = { "scalar", "sse", "avx2" };
+    for (int l = (int) SimdLevel::Scalar; l <= (int) level; l++)
+    {
+        setSimdLevel((SimdLevel) l);
+        run("light-map", names[l], n, size * size, 1, [&]() { lights.addLight(Point(0,0), fan, light); });
+    }
+    setSimdLevel(level);
+}
+
+/**
+ * Writes the results with a little about the machine they ran on.
+ */
+void Bench::writeJson(std::ostream& out) const
+{
+    const char* simdNames[] = { "scalar", "sse", "avx2" };
+
+    out << "{\n";
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+    out << "  \"hardwareThreads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"simd\": \"" << simdNames[(int) getSimdLevel()] << "\",\n";
+    out << "  \"map\": \"" << mapKindName(options.mapKind) << "\",\n";
+    out << "  \"budgetMs\": " << options.budgetMs << ",\n";
+    out << "  \"results\": [";
+
+    for (int i = 0; i < (int) results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\"workload\": \"" << r.workload << "\", \"engine\": \"" << r.engine << "\""
+            << ", \"segments\": " << r.segments << ", \"rays\": " << r.rays << ", \"threads\": " << r.threads
+            << ", \"samples\": " << r.samples << ", \"nsPerRay\": " << r.nsPerRay << ", \"raysPerSecond\": " << r.raysPerSecond
+            << ", \"p50Us\": " << r.p50Us << ", \"p99Us\": " << r.p99Us;
+
+        if (rayCastStatsEnabled())
+        {
+            out << ", \"stats\": {";
+            const char* separator = "";
+#define BENCH_WRITE_STAT(name, comment) out << separator << "\"" #name "\": " << r.stats.name; separator = ", ";
+            RAYCAST_STATS_FIELDS(BENCH_WRITE_STAT)
+#undef BENCH_WRITE_STAT
+            out << "}";
+        }
+
+        out << "}";
+    }
+
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--json") == 0 && hasValue)
+        {
+            options.jsonPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--filter") == 0 && hasValue)
+        {
+            options.filter = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--map") == 0 && hasValue && mapKindFromName(argv[i + 1], options.mapKind))
+        {
+            i++;
+        }
+        else if (std::strcmp(argv[i], "--max-segments") == 0 && hasValue)
+        {
+            options.maxSegments = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--budget") == 0 && hasValue)
+        {
+            options.budgetMs = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--quick") == 0)
+        {
+            options.maxSegments = 10000;
+            options.budgetMs = 50;
+        }
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--json file] [--filter text] [--map random|maze|city|forest|corridors] [--max-segments n] [--budget ms] [--quick]\n";
+            return 1;
+        }
+    }
+
+    Bench bench(options);
+
+    std::cout << "workload\tengine\tsegments\trays\tthreads\tsamples\tns/ray\trays/s\tp50 us\tp99 us\n";
+    bench.closestHit();
+    bench.uniformRays();
+    bench.uniformRaysParallel();
+    bench.fan();
+    bench.limitedLight();
+    bench.movingOccluders();
+    bench.coherentRays();
+    bench.fanCache();
+    bench.lineOfSight();
+    bench.mapFile();
+    bench.lightMap();
+
+    std::ofstream json(options.jsonPath);
+    if (!json)
+    {
+        std::cerr << "could not write " << options.jsonPath << "\n";
+        return 1;
+    }
+
+    bench.writeJson(json);
+    std::cout << "results written to " << options.jsonPath << "\n";
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include "MapFile.h"
+#include "MapGenerator.h"
+
+/**
+ * Writes map files, and checks them.
+ *
+ * Usage:
+ *   mapconvert.exe input.txt output.rcmap [--no-bvh]          text map to map file
+ *   mapconvert.exe --generate kind count seed output.rcmap    generated map to map file
+ *   mapconvert.exe --check file.rcmap                         header and checksum
+ */
+
+static int usage(const char* program)
+{
+    std::cerr << "usage: " << program << " input.txt output.rcmap [--no-bvh]\n"
+              << "       " << program << " --generate random|maze|city|forest|corridors count seed output.rcmap [--no-bvh]\n"
+              << "       " << program << " --check file.rcmap\n";
+    return 1;
+}
+
+static int check(const std::string& path)
+{
+    MapFile file;
+    if (!file.open(path, true))
+    {
+        std::cerr << file.getError() << "\n";
+        return 1;
+    }
+
+    BVH bvh;
+    if (file.hasBVH() && !file.getBVH(bvh))
+    {
+        std::cerr << path << " has a damaged BVH\n";
+        return 1;
+    }
+
+    std::cout << path << ": " << file.size() << " line segments, " << (file.hasBVH() ? std::to_string(bvh.nodeCount()) + " BVH nodes" : "no BVH") << ", checksum ok\n";
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 3 && std::strcmp(argv[1], "--check") == 0)
+    {
+        return check(argv[2]);
+    }
+
+    const bool withBVH = std::strcmp(argv[argc - 1], "--no-bvh") != 0;
+    const int args = withBVH ? argc : argc - 1;
+
+    std::string output;
+    std::vector<LineSegment> lineSegments;
+    std::string error;
+
+    if (args == 6 && std::strcmp(argv[1], "--generate") == 0)
+    {
+        MapKind kind;
+        if (!mapKindFromName(argv[2], kind))
+        {
+            return usage(argv[0]);
+        }
+
+        generateMap(kind, std::atoi(argv[3]), std::strtoul(argv[4], nullptr, 10), lineSegments);
+        output = argv[5];
+    }
+    else if (args == 3 && argv[1][0] != '-')
+    {
+        if (!readTextMap(argv[1], lineSegments, error))
+        {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        output = argv[2];
+    }
+    else
+    {
+        return usage(argv[0]);
+    }
+
+    if (!writeMapFile(output, lineSegments, withBVH))
+    {
+        std::cerr << "could not write " << output << "\n";
+        return 1;
+    }
+
+    return check(output);
+}
@@ -1,8 +1,54 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <fstream>
 #include "RayCasting.h"
+#include "SegmentStore.h"
+#include "BVH.h"
+#include "RayCastStats.h"
+#include "LightMap.h"
+#include "VisibilitySweep.h"
+#include "ParallelRayCasting.h"
+#include "MapFile.h"
+#include "TwoLevelBVH.h"
+#include "UniformRays.h"
+
+
+// Counts every heap allocation, so tests can check that a query path allocates nothing.
+// Atomic, as the thread pool's workers allocate too.
+static std::atomic<long> allocationCount(0);
+
+void* operator new(std::size_t size)
+{
+    allocationCount++;
+
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
 
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void printTest(const std::string& description, bool result)
+{
+    std::cout << "Test: " << (result ? "PASSED" : "FAILED") << "\n" << "    Description: " << description << "\n";
+}
 
 void testClosestPointOnRay(Ray r, std::vector<Point> & points, const Point actual, std::string description)
 {
@@ -22,12 +68,14 @@ void testClosestPointOnRay(Ray r, std::vector<Point> & points, const Point actua
     }
 }
 
-void testGetIntersections(const Ray r, const std::vector<LineSegment>& lineSegments, std::vector<Point>& actualIntersectionPoints, std::vector<LineSegment>& actualIntersectionLineSegments, const std::string description)
+typedef void (*IntersectionsOfRayFunc)(const Ray, const std::vector<LineSegment>&, std::vector<Point>&, std::vector<LineSegment>&);
+
+void testGetIntersections(const Ray r, const std::vector<LineSegment>& lineSegments, std::vector<Point>& actualIntersectionPoints, std::vector<LineSegment> actualIntersectionLineSegments, const std::string description, IntersectionsOfRayFunc getIntersections = getAllIntersectionsOfRay)
 {
     std::vector<Point> resultIntersectionPoints;
     std::vector<LineSegment> resultIntersectionLineSegments;
 
-    getAllIntersectionsOfRay(r, lineSegments, resultIntersectionPoints, resultIntersectionLineSegments);
+    getIntersections(r, lineSegments, resultIntersectionPoints, resultIntersectionLineSegments);
 
 
     if (resultIntersectionLineSegments.size() != actualIntersectionLineSegments.size())
@@ -157,6 +205,94 @@ void testIntersectionCount(LineSegment a, LineSegment b, IntersectionCount actua
     std::cout << "Result = " << (result == IntersectionCount::Zero ? "ZERO" : result == IntersectionCount::Many ? "MANY" : "ONE") << ", Actual = " << (actual == IntersectionCount::Zero ? "ZERO" : actual == IntersectionCount::Many ? "MANY" : "ONE") << "\n";
 }
 
+void testClosestIntersectionQuery(const std::vector<LineSegment>& lineSegments, const Point base, const int rayCount, const ClosestIntersectionQuery& getClosest, const std::string description)
+{
+    float angleBetweenRays = 2 * PI / rayCount;
+    for (int i = 0; i < rayCount; i++)
+    {
+        Ray r = Ray(angleBetweenRays * i, base);
+
+        Point actual, result;
+        bool actualFound = getClosestIntersection(r, lineSegments, actual);
+        bool resultFound = getClosest(r, result);
+
+        if (actualFound != resultFound || (actualFound && (std::fabs(actual.x - result.x) > 1e-3f || std::fabs(actual.y - result.y) > 1e-3f)))
+        {
+            std::cout << "Test: FAILED [ray " << i << " of " << rayCount << "]\n" << "    Description: " << description << "\n";
+            std::cout << "    Result = " << resultFound << " (" << result.x << ", " << result.y << ")\n";
+            std::cout << "    Actual = " << actualFound << " (" << actual.x << ", " << actual.y << ")\n";
+            return;
+        }
+    }
+
+    std::cout << "Test: PASSED\n" << "    Description: " << description << "\n";
+}
+
+void testClosestIntersectionStore(const std::vector<LineSegment>& lineSegments, const Point base, const int rayCount, const SimdLevel level, const std::string description)
+{
+    SegmentStore store(lineSegments);
+    SimdLevel previous = getSimdLevel();
+    SimdLevel used = setSimdLevel(level);
+
+    testClosestIntersectionQuery(lineSegments, base, rayCount, [&](const Ray r, Point& result)
+    {
+        return getClosestIntersection(r, store, result);
+    }, description + " (SimdLevel " + std::to_string((int) used) + ")");
+
+    setSimdLevel(previous);
+}
+
+std::vector<LineSegment> randomLineSegments(const int count, const float range, unsigned int seed)
+{
+    std::vector<LineSegment> ls;
+
+    for (int i = 0; i < count; i++)
+    {
+        float coords[4];
+        for (int j = 0; j < 4; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            coords[j] = (float) ((seed >> 8) % 8000) / 8000.f * range - range / 2;
+        }
+        ls.push_back(LineSegment(Point(coords[0], coords[1]), Point(coords[2], coords[3])));
+    }
+
+    return ls;
+}
+
+float fanArea(const std::vector<Point>& fan)
+{
+    float area = 0;
+    for (int i = 0; i < (int) fan.size(); i++)
+    {
+        const Point p = fan[i];
+        const Point q = fan[(i + 1) % fan.size()];
+        area += p.x * q.y - q.x * p.y;
+    }
+
+    return area / 2;
+}
+
+void testFanEngine(const std::vector<LineSegment>& lineSegments, const Point base, const FanEngine engine, const std::string description)
+{
+    std::vector<Point> actual, result;
+    getClosestIntersectionOfRays(base, lineSegments, actual, FanEngine::ThreeRays);
+    getClosestIntersectionOfRays(base, lineSegments, result, engine);
+
+    const float actualArea = fanArea(actual);
+    const float resultArea = fanArea(result);
+
+    if (std::fabs(actualArea - resultArea) > 1e-3f * std::fabs(actualArea) + 1e-3f)
+    {
+        std::cout << "Test: FAILED [fan area differs]\n" << "    Description: " << description << "\n";
+        std::cout << "    Result area = " << resultArea << " (" << result.size() << " points)\n";
+        std::cout << "    Actual area = " << actualArea << " (" << actual.size() << " points)\n";
+        return;
+    }
+
+    std::cout << "Test: PASSED\n" << "    Description: " << description << "\n";
+}
+
 void testIntersectionCount(Line a, Line b, IntersectionCount actual)
 {
     IntersectionCount result = a.intersectionCount(b);
@@ -246,6 +382,7 @@ int main(int argc, char* argv[])
         std::vector<LineSegment> actualIntersectionLineSegments;
 
         testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "4 line segments, with 2 intersection points");
+        testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "4 line segments, with 2 intersection points [parametric]", getAllIntersectionsOfRayParametric);
     }
     {
         // Test 2: 1 line segment intersection, 1 intersection point, and 3 not intersected line segments
@@ -268,6 +405,7 @@ int main(int argc, char* argv[])
         actualIntersectionLineSegments.push_back(LineSegment(Point(8,0), Point(24,0))); // ils1
 
         testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "1 line segment intersection, 1 intersection point, and 3 not intersected line segments");
+        testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "1 line segment intersection, 1 intersection point, and 3 not intersected line segments [parametric]", getAllIntersectionsOfRayParametric);
     }
     {
         // Test 3: ray base between endpoints of line segment 
@@ -284,6 +422,7 @@ int main(int argc, char* argv[])
         actualIntersectionLineSegments.push_back(LineSegment(Point(-10,-10), Point(0,0))); // ils1
 
         testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "ray base between endpoints of line segment");
+        testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "ray base between endpoints of line segment [parametric]", getAllIntersectionsOfRayParametric);
     }
     {
         // Test 4: no intersections
@@ -300,6 +439,7 @@ int main(int argc, char* argv[])
         std::vector<LineSegment> actualIntersectionLineSegments;
 
         testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "3 line segments, no intersections");
+        testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "3 line segments, no intersections [parametric]", getAllIntersectionsOfRayParametric);
     }
     {
         // Test 5: no duplicate intersection points
@@ -317,6 +457,1255 @@ int main(int argc, char* argv[])
         std::vector<LineSegment> actualIntersectionLineSegments;
 
         testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "two line segments with same endpoints which ray goes through, no duplicates intersection points");
+        testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "two line segments with same endpoints which ray goes through, no duplicates intersection points [parametric]", getAllIntersectionsOfRayParametric);
+    }
+
+    std::cout << "Test: getAllIntersectionsOfRayParametric()\n";
+    {
+        // parallel line segments, one collinear with ray and one not
+
+        const Ray r = Ray(Point(0,0), Point(10,0));
+        std::vector<LineSegment> ls;
+
+        ls.push_back(LineSegment(Point(-5,3), Point(5,3))); // ls1
+        ls.push_back(LineSegment(Point(-20,0), Point(-10,0))); // ls2
+
+        std::vector<Point> actualIntersectionPoints;
+
+        std::vector<LineSegment> actualIntersectionLineSegments;
+
+        testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "parallel line segments, no intersections", getAllIntersectionsOfRayParametric);
+    }
+    {
+        // line segment crosses ray exactly at ray base
+
+        const Ray r = Ray(Point(3,4), Point(3,10));
+        std::vector<LineSegment> ls;
+
+        ls.push_back(LineSegment(Point(-1,4), Point(7,4))); // ls1
+
+        std::vector<Point> actualIntersectionPoints;
+
+        actualIntersectionPoints.push_back(Point(3,4)); // i1
+
+        std::vector<LineSegment> actualIntersectionLineSegments;
+
+        testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "intersection exactly at ray base", getAllIntersectionsOfRayParametric);
+    }
+    {
+        // angled ray, collinear line segment overlaps ray base
+
+        const Ray r = Ray(Point(1,1), Point(4,4));
+        std::vector<LineSegment> ls;
+
+        ls.push_back(LineSegment(Point(-2,-2), Point(6,6))); // ls1
+        ls.push_back(LineSegment(Point(10,0), Point(0,10))); // ls2
+
+        std::vector<Point> actualIntersectionPoints;
+
+        actualIntersectionPoints.push_back(Point(5,5)); // i1
+
+        std::vector<LineSegment> actualIntersectionLineSegments;
+
+        actualIntersectionLineSegments.push_back(LineSegment(Point(6,6), Point(1,1))); // ils1
+
+        testGetIntersections(r, ls, actualIntersectionPoints, actualIntersectionLineSegments, "angled ray, collinear overlap at ray base", getAllIntersectionsOfRayParametric);
+    }
+
+    std::cout << "Test: SegmentStore closest hit\n";
+    {
+        std::vector<LineSegment> ls;
+
+        // box, with a collinear wall along the x-axis and a segment through the base
+        ls.push_back(LineSegment(Point(-50,-50), Point(50,-50)));
+        ls.push_back(LineSegment(Point(50,-50), Point(50,50)));
+        ls.push_back(LineSegment(Point(50,50), Point(-50,50)));
+        ls.push_back(LineSegment(Point(-50,50), Point(-50,-50)));
+        ls.push_back(LineSegment(Point(10,0), Point(30,0)));
+        ls.push_back(LineSegment(Point(-5,-5), Point(5,5)));
+
+        // pseudo-random clutter, count not a multiple of the vector width
+        std::vector<LineSegment> clutter = randomLineSegments(37, 80, 12345);
+        ls.insert(ls.end(), clutter.begin(), clutter.end());
+
+        SegmentStore store(ls);
+        printTest("store is padded to vector width", store.size() == 43 && store.paddedSize() % SegmentStore::SEGMENT_STORE_WIDTH == 0 && store.paddedSize() >= 43);
+
+        for (int level = (int) SimdLevel::Scalar; level <= (int) SimdLevel::AVX2; level++)
+        {
+            testClosestIntersectionStore(ls, Point(0,0), 256, (SimdLevel) level, "store matches vector closest hit, base on segment");
+            testClosestIntersectionStore(ls, Point(-33.3f,12.5f), 256, (SimdLevel) level, "store matches vector closest hit, base in clutter");
+            testClosestIntersectionStore(ls, Point(0,100), 64, (SimdLevel) level, "store matches vector closest hit, base outside box");
+        }
+    }
+
+    std::cout << "Test: SegmentStore buckets\n";
+    {
+        // Tile map: walls along a grid, some of them missing, and a few diagonal ones
+        std::vector<LineSegment> ls;
+        unsigned int seed = 31;
+        for (int i = -8; i < 8; i++)
+        {
+            for (int j = -8; j < 8; j++)
+            {
+                seed = seed * 1103515245 + 12345;
+                if (seed >> 8 & 1)
+                {
+                    ls.push_back(LineSegment(Point(i * 10.f, j * 10.f), Point(i * 10.f + 10, j * 10.f)));
+                }
+                if (seed >> 9 & 1)
+                {
+                    ls.push_back(LineSegment(Point(i * 10.f, j * 10.f + 10), Point(i * 10.f, j * 10.f)));
+                }
+                if ((seed >> 10 & 15) == 0)
+                {
+                    ls.push_back(LineSegment(Point(i * 10.f, j * 10.f), Point(i * 10.f + 10, j * 10.f + 10)));
+                }
+            }
+        }
+
+        const SegmentStore store(ls);
+        int horizontal = 0, vertical = 0;
+        for (const LineSegment& wall : ls)
+        {
+            horizontal += wall.a.y == wall.b.y;
+            vertical += wall.a.x == wall.b.x;
+        }
+        const LineSegment firstHorizontal = store.get(store.getHorizontal().index[0]);
+        const LineSegment firstVertical = store.get(store.getVertical().index[0]);
+        const bool indexed = firstHorizontal.a.y == store.getHorizontal().c[0] && firstHorizontal.b.x - firstHorizontal.a.x == store.getHorizontal().e[0] &&
+                             firstVertical.a.x == store.getVertical().c[0] && firstVertical.b.y - firstVertical.a.y == store.getVertical().e[0];
+        printTest("line segments are sorted into horizontal, vertical and general buckets",
+                  store.isBucketed() && indexed && store.getHorizontal().paddedSize() >= horizontal && store.getHorizontal().paddedSize() < horizontal + SegmentStore::SEGMENT_STORE_WIDTH &&
+                  store.getVertical().paddedSize() >= vertical && store.getVertical().paddedSize() < vertical + SegmentStore::SEGMENT_STORE_WIDTH &&
+                  store.getGeneral().paddedSize() >= (int) ls.size() - horizontal - vertical && store.getGeneral().paddedSize() > 0);
+
+        // Fans aim rays at the corners, where walls meet and hits are closest to a tie
+        SegmentStore view;
+        view.view(store.dataAx(), store.dataAy(), store.dataBx(), store.dataBy(), store.size(), store.paddedSize());
+        const Point bases[] = { Point(5,5), Point(-33.3f,12.5f), Point(0,0), Point(10,-40) };
+        std::vector<Point> vertices;
+        getVertices(ls, vertices);
+        const SimdLevel previous = getSimdLevel();
+        for (int level = (int) SimdLevel::Scalar; level <= (int) SimdLevel::AVX2; level++)
+        {
+            const SimdLevel used = setSimdLevel((SimdLevel) level);
+            bool sameFans = true;
+            for (const Point base : bases)
+            {
+                std::vector<Point> expected, result;
+                getClosestIntersectionOfRays(base, ls, expected);
+                getClosestIntersectionOfRays(base, vertices, [&](const Ray r, Point& hit) { return getClosestIntersection(r, store, hit); }, result);
+                sameFans = sameFans && result == expected;
+            }
+            printTest("fans through the buckets match the line segment fans (SimdLevel " + std::to_string((int) used) + ")", sameFans);
+        }
+        setSimdLevel(previous);
+
+        testClosestIntersectionQuery(ls, Point(3,7), 1024, [&](const Ray r, Point& result) { return getClosestIntersection(r, view, result); }, "view without buckets matches vector closest hit");
+    }
+
+    std::cout << "Test: BVH closest hit\n";
+    {
+        std::vector<LineSegment> ls = randomLineSegments(2000, 1000, 777);
+
+        // axis-aligned walls, which give flat boxes
+        for (int i = -10; i <= 10; i++)
+        {
+            ls.push_back(LineSegment(Point(i * 50.f, -20), Point(i * 50.f, 20)));
+            ls.push_back(LineSegment(Point(-20, i * 50.f), Point(20, i * 50.f)));
+        }
+
+        BVH bvh(ls);
+        printTest("bvh has all line segments", bvh.size() == (int) ls.size() && bvh.nodeCount() > 1);
+
+        auto query = [&](const Ray r, Point& result)
+        {
+            return getClosestIntersection(r, bvh, result);
+        };
+
+        testClosestIntersectionQuery(ls, Point(0,0), 512, query, "bvh matches vector closest hit, base on walls");
+        testClosestIntersectionQuery(ls, Point(123.4f,-321.5f), 512, query, "bvh matches vector closest hit, base inside map");
+        testClosestIntersectionQuery(ls, Point(5000,5000), 128, query, "bvh matches vector closest hit, base outside map");
+
+        // Move some endpoints in place, like Map::moveEndPoint(), then refit
+        ls[5].a = Point(-400,400);
+        ls[17].b = Point(450,-450);
+        printTest("bvh refits after endpoint move", bvh.refit(ls));
+        testClosestIntersectionQuery(ls, Point(10,-10), 512, query, "bvh matches vector closest hit after refit");
+
+        std::vector<LineSegment> fewer(ls.begin(), ls.end() - 1);
+        printTest("bvh refuses refit when segment count changes", bvh.refit(fewer) == false);
+    }
+    {
+        std::vector<LineSegment> ls;
+        ls.push_back(LineSegment(Point(-50,-50), Point(50,-50)));
+        ls.push_back(LineSegment(Point(50,-50), Point(50,50)));
+        ls.push_back(LineSegment(Point(50,50), Point(-50,50)));
+        ls.push_back(LineSegment(Point(-50,50), Point(-50,-50)));
+        ls.push_back(LineSegment(Point(-10,-10), Point(10,-10)));
+        ls.push_back(LineSegment(Point(10,-10), Point(0,10)));
+        ls.push_back(LineSegment(Point(0,10), Point(-10,-10)));
+
+        BVH bvh(ls);
+
+        std::vector<Point> actual, result;
+        getClosestIntersectionOfRays(Point(-30,-20), ls, actual);
+        getClosestIntersectionOfRays(Point(-30,-20), bvh, result);
+
+        bool same = actual.size() == result.size();
+        for (int i = 0; same && i < (int) actual.size(); i++)
+        {
+            same = std::fabs(actual[i].x - result[i].x) < 1e-3f && std::fabs(actual[i].y - result[i].y) < 1e-3f;
+        }
+        printTest("bvh fan matches vector fan", same);
+    }
+
+    std::cout << "Test: getVertices()\n";
+    {
+        std::vector<LineSegment> ls = randomLineSegments(300, 100, 555);
+        for (int i = 0; i < 300; i += 3)
+        {
+            // Share endpoints, in both orders
+            ls.push_back(LineSegment(ls[i].b, ls[i + 1].a));
+            ls.push_back(LineSegment(ls[i + 2].b, ls[i].b));
+        }
+        ls.push_back(LineSegment(Point(-0.f, 0), Point(0, 5)));
+        ls.push_back(LineSegment(Point(0, 5), Point(0, 0)));
+
+        // Checks every vertex found so far
+        std::vector<Point> actual;
+        for (const LineSegment& l : ls)
+        {
+            for (const Point p : { l.a, l.b })
+            {
+                if (std::find(actual.begin(), actual.end(), p) == actual.end())
+                {
+                    actual.push_back(p);
+                }
+            }
+        }
+
+        std::vector<Point> result;
+        getVertices(ls, result);
+        printTest("same vertices in the same order as checking every vertex found so far", result == actual);
+
+        std::vector<Point> appended(actual.begin(), actual.begin() + 10);
+        getVertices(ls, appended);
+        printTest("vertices already in the list are not added again", appended == actual);
+    }
+
+    std::cout << "Test: getClosestIntersectionOfRaysSweep()\n";
+    {
+        std::vector<LineSegment> ls;
+        ls.push_back(LineSegment(Point(-150,-100), Point(-150,100)));
+        ls.push_back(LineSegment(Point(-150,100), Point(150,100)));
+        ls.push_back(LineSegment(Point(150,100), Point(150,-100)));
+        ls.push_back(LineSegment(Point(150,-100), Point(-150,-100)));
+
+        std::vector<Point> fan;
+        getClosestIntersectionOfRaysSweep(Point(0,0), ls, fan);
+
+        printTest("box from inside gives its 4 corners, sorted by angle", fan.size() == 4 && fan[0] == Point(150,-100) && fan[1] == Point(-150,-100) && fan[2] == Point(-150,100) && fan[3] == Point(150,100));
+
+        fan.clear();
+        getClosestIntersectionOfRaysSweep(Point(150,0), ls, fan);
+        printTest("base on line segment gives empty fan", fan.empty());
+
+        // inner rectangle and triangle of the visual test's default map
+        ls.push_back(LineSegment(Point(-110,-80), Point(-110,80)));
+        ls.push_back(LineSegment(Point(-110,80), Point(-70,80)));
+        ls.push_back(LineSegment(Point(-70,80), Point(-70,-80)));
+        ls.push_back(LineSegment(Point(-70,-80), Point(-110,-80)));
+        ls.push_back(LineSegment(Point(30,0), Point(130,60)));
+        ls.push_back(LineSegment(Point(130,60), Point(130,-60)));
+        ls.push_back(LineSegment(Point(130,-60), Point(30,0)));
+
+        testFanEngine(ls, Point(7,5), FanEngine::Sweep, "sweep fan matches 3 rays fan, default map");
+        testFanEngine(ls, Point(-130,0), FanEngine::Sweep, "sweep fan matches 3 rays fan, base behind rectangle");
+        testFanEngine(ls, Point(140,3.5f), FanEngine::Sweep, "sweep fan matches 3 rays fan, base behind triangle");
+        testFanEngine(ls, Point(0,-90), FanEngine::Sweep, "sweep fan matches 3 rays fan, base near wall");
+        testFanEngine(ls, Point(-120,90), FanEngine::Sweep, "sweep fan matches 3 rays fan, base in corner");
+
+        std::vector<Point> swept;
+        printTest("line segments that do not cross are swept", getClosestIntersectionOfRaysSweep(Point(7,5), ls, swept));
+
+        // Random line segments cross each other, and so does an X in front of the base
+        std::vector<LineSegment> crossing = randomLineSegments(100, 200, 99);
+        crossing.insert(crossing.end(), ls.begin(), ls.begin() + 4);
+        std::vector<LineSegment> cross(ls.begin(), ls.begin() + 4);
+        cross.push_back(LineSegment(Point(20,-30), Point(60,30)));
+        cross.push_back(LineSegment(Point(20,30), Point(60,-30)));
+
+        bool fellBack = true;
+        IncrementalSweep incremental;
+        for (const Point base : { Point(0,0), Point(1,0.5f), Point(-7,3) })
+        {
+            for (const std::vector<LineSegment>* segments : { &crossing, &cross })
+            {
+                std::vector<Point> actual, result;
+                getClosestIntersectionOfVertexRays(base, *segments, actual);
+                fellBack = fellBack && !getClosestIntersectionOfRaysSweep(base, *segments, result) && result == actual;
+            }
+
+            std::vector<Point> actual, updated;
+            getClosestIntersectionOfVertexRays(base, crossing, actual);
+            incremental.update(base, crossing, updated);
+            fellBack = fellBack && updated == actual;
+        }
+        printTest("crossing line segments fall back to the vertex rays fan, also in IncrementalSweep", fellBack);
+    }
+
+    std::cout << "Test: getClosestIntersectionOfVertexRays()\n";
+    {
+        // Points on the line y = x, far apart, so the determinant in doubles is all rounding
+        const Point onLine = Point(3,3);
+        const Point aboveLine = Point(3, std::nextafter(3.f, 4.f));
+        printTest("orient2d() is exact on nearly collinear points", orient2d(Point(1e-20f,1e-20f), Point(1e20f,1e20f), onLine) == 0 &&
+                  orient2d(Point(1e-20f,1e-20f), Point(1e20f,1e20f), aboveLine) == 1 && orient2d(Point(1e20f,1e20f), Point(1e-20f,1e-20f), aboveLine) == -1);
+        printTest("isOnLineSegment() is exact", isOnLineSegment(Point(0.1f,0.1f), LineSegment(Point(0,0), Point(1e10f,1e10f))) &&
+                  !isOnLineSegment(Point(0.1f, std::nextafter(0.1f, 1.f)), LineSegment(Point(0,0), Point(1e10f,1e10f))));
+
+        std::vector<LineSegment> ls;
+        ls.push_back(LineSegment(Point(-150,-100), Point(-150,100)));
+        ls.push_back(LineSegment(Point(-150,100), Point(150,100)));
+        ls.push_back(LineSegment(Point(150,100), Point(150,-100)));
+        ls.push_back(LineSegment(Point(150,-100), Point(-150,-100)));
+
+        std::vector<Point> fan;
+        getClosestIntersectionOfVertexRays(Point(0,0), ls, fan);
+        printTest("box from inside gives exactly its 4 corners, sorted by angle", fan.size() == 4 && fan[0] == Point(150,-100) && fan[1] == Point(-150,-100) && fan[2] == Point(-150,100) && fan[3] == Point(150,100));
+
+        fan.clear();
+        getClosestIntersectionOfVertexRays(Point(150,0), ls, fan);
+        printTest("base on line segment gives empty fan", fan.empty());
+
+        // Far from the origin, where floats are 1 apart and a ray at an angle cannot aim at a corner
+        const float far = 16777216;
+        std::vector<LineSegment> farBox;
+        farBox.push_back(LineSegment(Point(far - 64, far - 32), Point(far - 64, far + 32)));
+        farBox.push_back(LineSegment(Point(far - 64, far + 32), Point(far + 64, far + 32)));
+        farBox.push_back(LineSegment(Point(far + 64, far + 32), Point(far + 64, far - 32)));
+        farBox.push_back(LineSegment(Point(far + 64, far - 32), Point(far - 64, far - 32)));
+        fan.clear();
+        getClosestIntersectionOfVertexRays(Point(far + 4, far - 6), farBox, fan);
+        printTest("box at large coordinates gives exactly its 4 corners", fan.size() == 4 && fan[0] == Point(far + 64, far - 32) && fan[1] == Point(far - 64, far - 32) && fan[2] == Point(far - 64, far + 32) && fan[3] == Point(far + 64, far + 32));
+
+        // Slit 1 wide, 100000 away: 0.0001 rad there is 10 wide, rays nudged by it miss the slit
+        std::vector<LineSegment> slit;
+        slit.push_back(LineSegment(Point(100000,-1000), Point(100000,-0.5f)));
+        slit.push_back(LineSegment(Point(100000,0.5f), Point(100000,1000)));
+        slit.push_back(LineSegment(Point(200000,-100000), Point(200000,100000)));
+        fan.clear();
+        getClosestIntersectionOfVertexRays(Point(0,0), slit, fan);
+        int throughSlit = 0;
+        for (const Point p : fan)
+        {
+            throughSlit += p.x == 200000 && std::fabs(std::fabs(p.y) - 1) < 1e-2f;
+        }
+        printTest("light through a far slit reaches the wall behind it", throughSlit == 2);
+
+        // T-junction and line segments along the ray through a vertex
+        std::vector<LineSegment> junctions = ls;
+        junctions.push_back(LineSegment(Point(-50,-100), Point(-50,0)));
+        junctions.push_back(LineSegment(Point(20,20), Point(40,40)));
+        junctions.push_back(LineSegment(Point(40,40), Point(60,60)));
+        junctions.push_back(LineSegment(Point(60,60), Point(60,80)));
+        junctions.push_back(LineSegment(Point(-20,40), Point(-40,40)));
+        junctions.push_back(LineSegment(Point(-40,40), Point(-60,40)));
+        junctions.push_back(LineSegment(Point(100,-50), Point(100,50)));
+        junctions.push_back(LineSegment(Point(100,0), Point(120,0)));
+
+        // inner rectangle and triangle of the visual test's default map
+        ls.push_back(LineSegment(Point(-110,-80), Point(-110,80)));
+        ls.push_back(LineSegment(Point(-110,80), Point(-70,80)));
+        ls.push_back(LineSegment(Point(-70,80), Point(-70,-80)));
+        ls.push_back(LineSegment(Point(-70,-80), Point(-110,-80)));
+        ls.push_back(LineSegment(Point(30,0), Point(130,60)));
+        ls.push_back(LineSegment(Point(130,60), Point(130,-60)));
+        ls.push_back(LineSegment(Point(130,-60), Point(30,0)));
+
+        testFanEngine(ls, Point(7,5), FanEngine::VertexRays, "vertex rays fan matches 3 rays fan, default map");
+        testFanEngine(ls, Point(-130,0), FanEngine::VertexRays, "vertex rays fan matches 3 rays fan, base behind rectangle");
+        testFanEngine(ls, Point(140,3.5f), FanEngine::VertexRays, "vertex rays fan matches 3 rays fan, base behind triangle");
+        testFanEngine(ls, Point(0,-90), FanEngine::VertexRays, "vertex rays fan matches 3 rays fan, base near wall");
+        testFanEngine(ls, Point(-120,90), FanEngine::VertexRays, "vertex rays fan matches 3 rays fan, base in corner");
+        testFanEngine(junctions, Point(0,0), FanEngine::VertexRays, "vertex rays fan matches 3 rays fan, vertices in line with the base");
+        testFanEngine(junctions, Point(7,-3), FanEngine::VertexRays, "vertex rays fan matches 3 rays fan, T-junctions");
+
+        // Crossing line segments, the fan still only turns at vertices
+        std::vector<LineSegment> random = randomLineSegments(150, 300, 31337);
+        random.insert(random.end(), ls.begin(), ls.begin() + 4);
+        testFanEngine(random, Point(3.3f,-7.1f), FanEngine::VertexRays, "vertex rays fan matches 3 rays fan, random line segments");
+
+        bool sameAsSweep = true;
+        for (const Point base : { Point(7,5), Point(-130,0), Point(140,3.5f), Point(0,-90) })
+        {
+            std::vector<Point> actual, result;
+            getClosestIntersectionOfRaysSweep(base, ls, actual);
+            getClosestIntersectionOfVertexRays(base, ls, result);
+            sameAsSweep = sameAsSweep && std::fabs(fanArea(result) - fanArea(actual)) <= 1e-5f * std::fabs(fanArea(actual));
+        }
+        printTest("vertex rays fan has the same area as the sweep fan, with no angle nudged", sameAsSweep);
+    }
+
+    std::cout << "Test: IncrementalSweep.update()\n";
+    {
+        std::vector<LineSegment> ls;
+        ls.push_back(LineSegment(Point(-150,-150), Point(-150,150)));
+        ls.push_back(LineSegment(Point(-150,150), Point(150,150)));
+        ls.push_back(LineSegment(Point(150,150), Point(150,-150)));
+        ls.push_back(LineSegment(Point(150,-150), Point(-150,-150)));
+
+        // One segment inside each cell of a grid, so none of them cross
+        std::vector<LineSegment> clutter = randomLineSegments(100, 24, 2024);
+        for (int i = 0; i < (int) clutter.size(); i++)
+        {
+            const float cx = (i % 10) * 28.f - 126;
+            const float cy = (i / 10) * 28.f - 126;
+            ls.push_back(LineSegment(Point(clutter[i].a.x + cx, clutter[i].a.y + cy), Point(clutter[i].b.x + cx, clutter[i].b.y + cy)));
+        }
+
+        IncrementalSweep sweep;
+        Point base = Point(3.3f, 1.7f);
+        unsigned int seed = 17;
+        bool same = true;
+        int gaps = 0;
+        int repaired = 0;
+
+        for (int step = 0; step < 500; step++)
+        {
+            seed = seed * 1103515245 + 12345;
+            base.x += (float) ((seed >> 8) % 1000) / 1000.f * 1.6f - 0.75f;
+            seed = seed * 1103515245 + 12345;
+            base.y += (float) ((seed >> 8) % 1000) / 1000.f * 1.6f - 0.8f;
+
+            std::vector<Point> actual, result;
+            getClosestIntersectionOfRaysSweep(base, ls, actual);
+            sweep.update(base, ls, result);
+
+            same = same && result.size() == actual.size();
+            for (int i = 0; same && i < (int) actual.size(); i++)
+            {
+                same = result[i] == actual[i];
+            }
+
+            if (step > 0)
+            {
+                gaps += sweep.gaps();
+                repaired += sweep.repairedGaps();
+            }
+        }
+
+        printTest("incremental fan matches full sweep along a random walk", same);
+        printTest("small moves repair few gaps (" + std::to_string(repaired) + " of " + std::to_string(gaps) + ")", repaired * 2 < gaps);
+
+        std::vector<Point> result;
+        sweep.update(Point(-150,20), ls, result);
+        printTest("base on line segment gives empty fan", result.empty());
+
+        ls.push_back(LineSegment(Point(-140,-140), Point(-130,-145)));
+        sweep.invalidate();
+        result.clear();
+        sweep.update(base, ls, result);
+
+        std::vector<Point> actual;
+        getClosestIntersectionOfRaysSweep(base, ls, actual);
+        printTest("invalidate() after a map change sweeps again", result.size() == actual.size() && sweep.repairedGaps() == sweep.gaps());
+    }
+
+    std::cout << "Test: allocation-free queries\n";
+    {
+        std::vector<LineSegment> ls = randomLineSegments(300, 200, 4242);
+        ls.push_back(LineSegment(Point(-150,-100), Point(-150,100)));
+        ls.push_back(LineSegment(Point(-150,100), Point(150,100)));
+        ls.push_back(LineSegment(Point(150,100), Point(150,-100)));
+        ls.push_back(LineSegment(Point(150,-100), Point(-150,-100)));
+
+        SegmentStore store(ls);
+        BVH bvh(ls);
+        RayCastScratch scratch;
+        SweepScratch sweepScratch;
+        std::vector<Point> points;
+        std::vector<LineSegment> segments;
+
+        // Box only, so the sweep gets non-crossing segments
+        std::vector<LineSegment> box(ls.end() - 4, ls.end());
+
+        auto runQueries = [&](const Point base)
+        {
+            Point p;
+            getClosestIntersection(Ray(1.f, base), ls, p);
+            getClosestIntersection(Ray(1.f, base), store, p);
+            getClosestIntersection(Ray(1.f, base), bvh, p);
+
+            points.clear();
+            getClosestIntersectionsOfRays(base, 256, ls, points);
+
+            points.clear();
+            segments.clear();
+            getAllIntersectionsOfRayParametric(Ray(2.f, base), ls, points, segments);
+
+            points.clear();
+            getClosestIntersectionOfRays(base, ls, points, scratch);
+
+            points.clear();
+            getClosestIntersectionOfRaysSweep(base, box, points, sweepScratch);
+
+            points.clear();
+            getClosestIntersectionOfVertexRays(base, ls, points, scratch);
+        };
+
+        // Warm up, so every buffer has grown to size
+        runQueries(Point(1,2));
+        runQueries(Point(-3,5));
+
+        long before = allocationCount;
+        for (int i = 0; i < 10; i++)
+        {
+            runQueries(Point(i * 7.f - 30, i * 3.f - 15));
+        }
+
+        printTest("steady-state queries with reused buffers make no heap allocations (" + std::to_string(allocationCount - before) + " made)", allocationCount == before);
+    }
+
+    std::cout << "Test: parallel getClosestIntersectionsOfRays()\n";
+    {
+        std::vector<LineSegment> ls = randomLineSegments(500, 400, 99);
+
+        std::vector<Point> actual;
+        getClosestIntersectionsOfRays(Point(3,-7), 1000, ls, actual);
+
+        for (int threads : { 1, 2, 4, 7 })
+        {
+            ThreadPool pool(threads);
+
+            for (int run = 0; run < 3; run++)
+            {
+                std::vector<Point> result;
+                getClosestIntersectionsOfRays(Point(3,-7), 1000, ls, result, pool);
+
+                bool same = result.size() == actual.size();
+                for (int i = 0; same && i < (int) actual.size(); i++)
+                {
+                    same = result[i] == actual[i];
+                }
+
+                printTest("parallel rays match sequential rays, in order (" + std::to_string(threads) + " threads, run " + std::to_string(run) + ")", same);
+            }
+        }
+    }
+
+    std::cout << "Test: ThreadPool.parallelForStealing()\n";
+    {
+        ThreadPool pool(4);
+
+        const int count = 1000;
+        std::vector<std::atomic<int>> runs(count);
+        std::atomic<int> badThread(0);
+
+        pool.parallelForStealing(count, [&](const int index, const int thread)
+        {
+            // Uneven work, the first indices are much slower
+            volatile float x = 0;
+            for (int i = 0; i < (count - index) * 50; i++)
+            {
+                x = x + 1;
+            }
+
+            runs[index]++;
+            if (thread < 0 || thread >= pool.size())
+            {
+                badThread++;
+            }
+        });
+
+        bool once = true;
+        for (int i = 0; i < count; i++)
+        {
+            once = once && runs[i] == 1;
+        }
+
+        printTest("every index runs exactly once", once);
+        printTest("thread index is within pool size", badThread == 0);
+    }
+
+    std::cout << "Test: getClosestIntersectionOfRaysBatch()\n";
+    {
+        std::vector<LineSegment> ls = randomLineSegments(150, 300, 31337);
+        ls.push_back(LineSegment(Point(-150,-150), Point(-150,150)));
+        ls.push_back(LineSegment(Point(-150,150), Point(150,150)));
+        ls.push_back(LineSegment(Point(150,150), Point(150,-150)));
+        ls.push_back(LineSegment(Point(150,-150), Point(-150,-150)));
+
+        BVH bvh(ls);
+
+        std::vector<Point> lights;
+        for (int i = 0; i < 40; i++)
+        {
+            lights.push_back(Point(i * 7.1f - 140, (i % 9) * 31.3f - 140));
+        }
+
+        ThreadPool pool(3);
+        FanBatch fans;
+        getClosestIntersectionOfRaysBatch(lights.data(), lights.size(), bvh, fans, pool);
+
+        bool same = fans.size() == (int) lights.size();
+        for (int light = 0; same && light < (int) lights.size(); light++)
+        {
+            std::vector<Point> actual;
+            getClosestIntersectionOfRays(lights[light], bvh, actual);
+
+            same = fans.fanSize(light) == (int) actual.size();
+            for (int i = 0; same && i < (int) actual.size(); i++)
+            {
+                same = fans.fan(light)[i] == actual[i];
+            }
+        }
+
+        printTest("batch fans match one fan per light, in light order", same);
+    }
+
+    std::cout << "Test: getClosestIntersectionOfRays() at the origin\n";
+    {
+        // Rays that escape between the segments hit nothing
+        std::vector<LineSegment> ls;
+        ls.push_back(LineSegment(Point(5,-5), Point(5,5)));
+        ls.push_back(LineSegment(Point(-5,8), Point(5,8)));
+
+        std::vector<Point> atOrigin;
+        getClosestIntersectionOfRays(Point(0,0), ls, atOrigin);
+
+        bool onSegments = atOrigin.size() >= 6;
+        for (const Point p : atOrigin)
+        {
+            onSegments = onSegments && (std::fabs(p.x - 5) < 1e-3f || std::fabs(p.y - 8) < 1e-3f);
+        }
+
+        printTest("a ray that hits nothing does not count as the base being on a segment", onSegments);
+    }
+
+    std::cout << "Test: RayCastStats\n";
+    {
+        std::vector<LineSegment> square;
+        square.push_back(LineSegment(Point(-10,-10), Point(-10,10)));
+        square.push_back(LineSegment(Point(-10,10), Point(10,10)));
+        square.push_back(LineSegment(Point(10,10), Point(10,-10)));
+        square.push_back(LineSegment(Point(10,-10), Point(-10,-10)));
+
+        auto total = [](const RayCastStats& stats)
+        {
+#define RAYCAST_STATS_SUM(name, comment) + stats.name
+            return 0ULL RAYCAST_STATS_FIELDS(RAYCAST_STATS_SUM);
+#undef RAYCAST_STATS_SUM
+        };
+
+        resetRayCastStats();
+        std::vector<Point> points;
+        getClosestIntersectionsOfRays(Point(1,2), 8, square, points);
+        const RayCastStats rays = getRayCastStats();
+
+        resetRayCastStats();
+        points.clear();
+        getClosestIntersectionOfRays(Point(1,2), square, points);
+        const RayCastStats fan = getRayCastStats();
+
+        resetRayCastStats();
+        points.clear();
+        getClosestIntersectionOfVertexRays(Point(1,2), square, points);
+        const RayCastStats vertexRays = getRayCastStats();
+
+        resetRayCastStats();
+        Point hit;
+        getClosestIntersection(Ray(0.f, Point(0,0)), { LineSegment(Point(0,5), Point(10,5)), LineSegment(Point(5,0), Point(10,0)) }, hit);
+        const RayCastStats special = getRayCastStats();
+
+        resetRayCastStats();
+        ThreadPool pool(3);
+        points.clear();
+        getClosestIntersectionsOfRays(Point(1,2), 64, square, points, pool);
+        const RayCastStats parallel = getRayCastStats();
+
+        resetRayCastStats();
+
+        if (rayCastStatsEnabled())
+        {
+            printTest("every ray and every line segment test is counted", rays.raysCast == 8 && rays.segmentTests == 32 && rays.hits == 8);
+            printTest("fan counts its rays, one sort of all its points, and time in each phase", fan.raysCast == 12 && fan.sorts == 1 && fan.sortedPoints == 12 && fan.maxSortSize == 12 && fan.castNs > 0 && fan.sortNs > 0 && fan.vertexNs > 0 && fan.allocations > 0);
+            printTest("vertex rays fan casts one ray per vertex", vertexRays.raysCast == 4 && vertexRays.sorts == 1 && vertexRays.sortedPoints == 4);
+            printTest("parallel and collinear line segments are counted", special.parallelCases == 1 && special.collinearCases == 1 && special.hits == 1);
+            printTest("rays cast on other threads are counted", parallel.raysCast == 64 && parallel.segmentTests == 256);
+            printTest("reset sets everything back to zero", total(getRayCastStats()) == 0);
+        }
+        else
+        {
+            printTest("nothing is counted with the instrumentation compiled out", total(rays) + total(fan) + total(vertexRays) + total(special) + total(parallel) == 0);
+        }
+    }
+
+    std::cout << "Test: LightMap\n";
+    {
+        std::vector<LineSegment> box;
+        box.push_back(LineSegment(Point(-20,-10), Point(-20,10)));
+        box.push_back(LineSegment(Point(-20,10), Point(20,10)));
+        box.push_back(LineSegment(Point(20,10), Point(20,-10)));
+        box.push_back(LineSegment(Point(20,-10), Point(-20,-10)));
+
+        // 96 by 48 pixels of half a unit, box covers pixels 8 to 88 by 4 to 44
+        const Point origin(-24, -12);
+        std::vector<Point> fan;
+        getClosestIntersectionOfRays(Point(3,2), box, fan);
+
+        LightMap room(96, 48, origin, 0.5f);
+        room.addLight(Point(3,2), fan, Light(0.5f));
+
+        bool insideLit = true;
+        int lit = 0;
+        for (int y = 0; y < 48; y++)
+        {
+            for (int x = 0; x < 96; x++)
+            {
+                const bool inside = x >= 8 && x < 88 && y >= 4 && y < 44;
+                insideLit = insideLit && room.at(x, y) == (inside ? 0.5f : 0.f);
+                lit += room.at(x, y) > 0;
+            }
+        }
+        printTest("light with no falloff lights exactly the pixels inside the room", insideLit && lit == 80 * 40);
+
+        // Wall in the middle, second light on the other side
+        std::vector<LineSegment> split = box;
+        split.push_back(LineSegment(Point(0,-10), Point(0,10)));
+        std::vector<Point> leftFan, rightFan;
+        getClosestIntersectionOfRays(Point(-10,0), split, leftFan);
+        getClosestIntersectionOfRays(Point(10,0), split, rightFan);
+
+        LightMap halves(96, 48, origin, 0.5f);
+        halves.addLight(Point(-10,0), leftFan, Light(1));
+        halves.addLight(Point(10,0), rightFan, Light(1));
+        bool eachOnce = true;
+        for (int y = 4; y < 44; y++)
+        {
+            for (int x = 8; x < 88; x++)
+            {
+                eachOnce = eachOnce && halves.at(x, y) == 1.f;
+            }
+        }
+        printTest("rooms that share a wall are each lit once, no gap and no double light", eachOnce);
+
+        LightMap both(96, 48, origin, 0.5f), first(96, 48, origin, 0.5f), second(96, 48, origin, 0.5f);
+        const Light falling(2, Falloff::Linear, 15);
+        const Light soft(1, Falloff::InverseSquare, 4);
+        std::vector<Point> otherFan;
+        getClosestIntersectionOfRays(Point(-12,-5), box, otherFan);
+        both.addLight(Point(3,2), fan, falling);
+        both.addLight(Point(-12,-5), otherFan, soft);
+        first.addLight(Point(3,2), fan, falling);
+        second.addLight(Point(-12,-5), otherFan, soft);
+        bool additive = true;
+        for (int i = 0; i < 96 * 48; i++)
+        {
+            additive = additive && both.getPixels()[i] == first.getPixels()[i] + second.getPixels()[i];
+        }
+        printTest("lights add up", additive);
+
+        // Pixel (54, 28) has its center at (3.25, 2.25), next to the first light, and pixel
+        // (31, 14) at (-8.25, -4.75), about the radius from the second one
+        printTest("linear falloff is full at the light and dark past its radius", std::fabs(first.at(54, 28) - 2 * (1 - std::sqrt(0.125f) / 15)) < 1e-5f && first.at(8, 43) == 0);
+        printTest("inverse square falloff is half at its radius", std::fabs(second.at(31, 14) - 1 / (1 + (3.75f * 3.75f + 0.25f * 0.25f) / 16)) < 1e-5f);
+
+        // A radius whose inverse is not a power of two rounds differently if the kernels group differently
+        const Light softer(1, Falloff::InverseSquare, 3);
+        const Light fading(1.5f, Falloff::Linear, 7);
+        const SimdLevel level = getSimdLevel();
+        bool sameAtEveryLevel = true;
+        std::vector<float> scalarOdd;
+        for (int l = (int) SimdLevel::Scalar; l <= (int) SimdLevel::AVX2; l++)
+        {
+            setSimdLevel((SimdLevel) l);
+            LightMap m(96, 48, origin, 0.5f);
+            m.addLight(Point(3,2), fan, falling);
+            m.addLight(Point(-12,-5), otherFan, soft);
+            sameAtEveryLevel = sameAtEveryLevel && m.getPixels() == both.getPixels();
+
+            LightMap odd(96, 48, origin, 0.5f);
+            odd.addLight(Point(3,2), fan, softer);
+            odd.addLight(Point(-12,-5), otherFan, fading);
+            if (l == (int) SimdLevel::Scalar)
+            {
+                scalarOdd = odd.getPixels();
+            }
+            sameAtEveryLevel = sameAtEveryLevel && odd.getPixels() == scalarOdd;
+        }
+        setSimdLevel(level);
+        printTest("SIMD span fills match the scalar one exactly", sameAtEveryLevel);
+
+        // Only a wall to the right, rays to the left escape
+        std::vector<Point> open;
+        getClosestIntersectionOfRays(Point(0,0), { LineSegment(Point(10,-8), Point(10,8)) }, open);
+        LightMap wall(96, 48, origin, 0.5f);
+        wall.addLight(Point(0,0), open, Light(1));
+        printTest("no light where the rays escaped", wall.at(58, 24) == 1 && wall.at(78, 24) == 0 && wall.at(28, 24) == 0);
+
+        std::vector<unsigned char> gray;
+        both.toGray8(gray, 0.5f);
+        printTest("8-bit conversion scales and clamps", gray.size() == 96 * 48 && gray[0] == 0 && gray[28 * 96 + 54] == 255);
+
+        const std::string path = "./bin/testsAuto_lightmap.pgm";
+        std::ifstream written;
+        bool pgm = both.writePGM(path);
+        written.open(path, std::ios::binary | std::ios::ate);
+        printTest("PGM has a header and one byte per pixel", pgm && (int) written.tellg() == (int) std::string("P5\n96 48\n255\n").size() + 96 * 48);
+
+        long before = allocationCount;
+        for (int i = 0; i < 5; i++)
+        {
+            both.addLight(Point(3,2), fan, falling);
+        }
+        printTest("drawing more lights does not allocate once the buffers have grown", allocationCount == before);
+    }
+
+    std::cout << "Test: hasLineOfSight()\n";
+    {
+        std::vector<LineSegment> walls;
+        walls.push_back(LineSegment(Point(0,-5), Point(0,5)));
+        walls.push_back(LineSegment(Point(10,0), Point(20,0)));
+
+        printTest("wall between the points blocks", !hasLineOfSight(Point(-3,0), Point(3,1), walls));
+        printTest("wall beside the points does not block", hasLineOfSight(Point(-3,6), Point(3,7), walls));
+        printTest("wall past the end does not block", hasLineOfSight(Point(-3,0), Point(-1,0), walls));
+        printTest("points on a wall can see each other past it", hasLineOfSight(Point(0,-5), Point(10,0), walls) && hasLineOfSight(Point(15,0), Point(15,8), walls));
+        printTest("wall along the sight line blocks where they overlap", !hasLineOfSight(Point(5,0), Point(12,0), walls) && hasLineOfSight(Point(5,0), Point(9,0), walls));
+        printTest("touching a wall's endpoint blocks", !hasLineOfSight(Point(-3,5), Point(3,5), walls));
+        printTest("a point can see itself", hasLineOfSight(Point(-3,0), Point(-3,0), walls));
+
+        // Short walls, so some sight lines get through
+        std::vector<LineSegment> ls = randomLineSegments(300, 400, 4242);
+        for (LineSegment& wall : ls)
+        {
+            wall.b = Point(wall.a.x + (wall.b.x - wall.a.x) / 20, wall.a.y + (wall.b.y - wall.a.y) / 20);
+        }
+        std::vector<LineSegment> sightLines = randomLineSegments(2000, 400, 777);
+        BVH bvh(ls);
+
+        int blocked = 0;
+        bool vectorAgrees = true;
+        bool bvhAgrees = true;
+        for (const LineSegment& sight : sightLines)
+        {
+            // Reference: any hit of the ray from a to b before b
+            bool clear = true;
+            for (const LineSegment& wall : ls)
+            {
+                float t;
+                Point hit;
+                if (closestIntersectionOfRayAndLineSegment(sight.a, Point(sight.b.x - sight.a.x, sight.b.y - sight.a.y), wall, t, hit) && t > 1e-5f && t < 1 - 1e-5f)
+                {
+                    clear = false;
+                }
+            }
+
+            blocked += !clear;
+            vectorAgrees = vectorAgrees && hasLineOfSight(sight.a, sight.b, ls) == clear;
+            bvhAgrees = bvhAgrees && hasLineOfSight(sight.a, sight.b, bvh) == clear;
+        }
+        printTest("matches the closest hit of a ray cast from a to b (" + std::to_string(blocked) + " of 2000 blocked)", vectorAgrees && blocked > 0 && blocked < 2000);
+        printTest("bvh matches the line segment list", bvhAgrees);
+
+        std::vector<char> visible;
+        std::vector<char> visibleBVH;
+        hasLineOfSight(sightLines, ls, visible);
+        hasLineOfSight(sightLines, bvh, visibleBVH);
+        bool batchSame = visible.size() == sightLines.size() && visible == visibleBVH;
+        for (int i = 0; batchSame && i < (int) sightLines.size(); i++)
+        {
+            batchSame = visible[i] == hasLineOfSight(sightLines[i].a, sightLines[i].b, ls);
+        }
+        printTest("batch matches one query per sight line", batchSame);
+
+        for (int threads : { 1, 3 })
+        {
+            ThreadPool pool(threads);
+            std::vector<char> visibleParallel;
+            hasLineOfSight(sightLines, bvh, visibleParallel, pool);
+            printTest("parallel batch matches sequential batch (" + std::to_string(threads) + " threads)", visibleParallel == visible);
+        }
+
+        long before = allocationCount;
+        hasLineOfSight(sightLines, bvh, visibleBVH);
+        printTest("batch into a sized buffer makes no heap allocations", allocationCount == before);
+    }
+
+    std::cout << "Test: getClosestIntersectionOfRays() with a radius and a cone\n";
+    {
+        std::vector<LineSegment> room;
+        room.push_back(LineSegment(Point(-10,-10), Point(10,-10)));
+        room.push_back(LineSegment(Point(10,-10), Point(10,10)));
+        room.push_back(LineSegment(Point(10,10), Point(-10,10)));
+        room.push_back(LineSegment(Point(-10,10), Point(-10,-10)));
+
+        const float circle = 0.5f * 64 * 25 * std::sin(2 * PI / 64); // 64-gon of radius 5
+
+        std::vector<Point> fan;
+        getClosestIntersectionOfRays(Point(0,0), room, 5, fan);
+        bool onCircle = fan.size() == 64;
+        for (const Point p : fan)
+        {
+            onCircle = onCircle && std::fabs(std::sqrt(p.x * p.x + p.y * p.y) - 5) < 1e-4f;
+        }
+        printTest("light that reaches no wall follows its circle", onCircle && std::fabs(std::fabs(fanArea(fan)) - circle) < 1e-2f);
+
+        fan.clear();
+        getClosestIntersectionOfRays(Point(0,0), room, 100, fan);
+        printTest("light that reaches every wall lights the whole room", std::fabs(std::fabs(fanArea(fan)) - 400) < 1e-2f);
+
+        fan.clear();
+        getClosestIntersectionOfRays(Point(0,0), room, 5, -PI / 4, PI / 4, fan);
+        bool inCone = !fan.empty() && fan.back() == Point(0,0);
+        for (const Point p : fan)
+        {
+            inCone = inCone && p.x >= std::fabs(p.y) - 1e-4f;
+        }
+        printTest("cone across angle 0 stays in the cone and closes at the base", inCone && std::fabs(std::fabs(fanArea(fan)) - circle / 4) < 1e-2f);
+
+        fan.clear();
+        getClosestIntersectionOfRays(Point(0,0), room, 20, PI / 2, PI, fan);
+        printTest("cone that reaches the walls lights a quarter of the room", std::fabs(std::fabs(fanArea(fan)) - 100) < 1e-2f);
+
+        fan.clear();
+        getClosestIntersectionOfRays(Point(0,0), room, INFINITY, 0, 3 * PI / 2, fan);
+        printTest("cone wider than half a circle with no radius", std::fabs(std::fabs(fanArea(fan)) - 300) < 1e-2f);
+
+        fan.clear();
+        getClosestIntersectionOfRays(Point(-10,0), room, 5, fan);
+        printTest("base on line segment gives empty fan", fan.empty());
+
+        LineSegment clipped;
+        printTest("line segment out of range is culled", !clipToLight(Point(0,0), LineSegment(Point(6,-1), Point(6,1)), 5, 0, 2 * PI, clipped));
+        printTest("line segment behind a cone is culled", !clipToLight(Point(0,0), LineSegment(Point(-3,-1), Point(-3,1)), 5, -PI / 4, PI / 4, clipped));
+        printTest("line segment across the circle is cut at the circle", clipToLight(Point(0,0), LineSegment(Point(-10,3), Point(10,3)), 5, 0, 2 * PI, clipped) &&
+            std::fabs(clipped.a.x + 4) < 1e-4f && std::fabs(clipped.b.x - 4) < 1e-4f && clipped.a.y == 3 && clipped.b.y == 3);
+
+        std::vector<LineSegment> ls = randomLineSegments(2000, 1000, 31337);
+        for (LineSegment& wall : ls)
+        {
+            wall.b = Point(wall.a.x + (wall.b.x - wall.a.x) / 20, wall.a.y + (wall.b.y - wall.a.y) / 20);
+        }
+        BVH bvh(ls);
+        RayCastScratch scratch;
+
+        bool bvhSame = true;
+        for (int i = 0; i < 20; i++)
+        {
+            const Point base = Point(-400 + 40 * i, 300 - 30 * i);
+            const float start = 0.7f * i;
+            const float end = i % 2 ? start + 1.2f : start + 2 * PI;
+
+            std::vector<Point> actual, result;
+            getClosestIntersectionOfRays(base, ls, 60, start, end, actual, scratch);
+            getClosestIntersectionOfRays(base, bvh, 60, start, end, result, scratch);
+            bvhSame = bvhSame && result == actual;
+        }
+        printTest("bvh fan matches the line segment fan", bvhSame);
+
+        resetRayCastStats();
+        fan.clear();
+        getClosestIntersectionOfRays(Point(0,0), ls, 60, 0, PI / 3, fan, scratch);
+        if (rayCastStatsEnabled())
+        {
+            const RayCastStats stats = getRayCastStats();
+            printTest("small light culls most line segments before casting (" + std::to_string(stats.culledSegments) + " of 2000)", stats.culledSegments > 1900 && stats.segmentTests < 100 * stats.raysCast);
+        }
+        resetRayCastStats();
+
+        LightMap lit(96, 48, Point(-24,-12), 0.5f);
+        fan.clear();
+        getClosestIntersectionOfRays(Point(0,0), room, 8, -PI / 4, PI / 4, fan);
+        lit.addLight(Point(0,0), fan, Light(1));
+        bool onlyAhead = true;
+        int count = 0;
+        for (int y = 0; y < 48; y++)
+        {
+            for (int x = 0; x < 96; x++)
+            {
+                const Point center = Point(-24 + 0.5f * (x + 0.5f), -12 + 0.5f * (y + 0.5f));
+                if (lit.at(x, y) > 0)
+                {
+                    count++;
+                    onlyAhead = onlyAhead && center.x >= std::fabs(center.y) - 0.5f;
+                }
+            }
+        }
+        printTest("cone lights the pixels ahead of the light only", onlyAhead && count > 150);
+    }
+
+    std::cout << "Test: TwoLevelBVH\n";
+    {
+        const std::vector<LineSegment> walls = randomLineSegments(2000, 400, 8080);
+        std::vector<LineSegment> crates = randomLineSegments(40, 60, 4040);
+        TwoLevelBVH scene(walls);
+
+        bool hitsSame = true;
+        bool fansSame = true;
+        bool sightSame = true;
+        for (int frame = 0; frame < 40; frame++)
+        {
+            // Crates drift, and one is added every 10 frames, which needs a build instead of a refit
+            for (LineSegment& crate : crates)
+            {
+                crate.a = Point(crate.a.x + 1.5f, crate.a.y - 0.5f);
+                crate.b = Point(crate.b.x + 1.5f, crate.b.y - 0.5f);
+            }
+            if (frame % 10 == 9)
+            {
+                crates.push_back(LineSegment(Point(frame, 5), Point(frame + 3, 9)));
+            }
+            scene.setDynamic(crates);
+
+            std::vector<LineSegment> all = walls;
+            all.insert(all.end(), crates.begin(), crates.end());
+            const BVH single(all);
+
+            const Point base = Point(-20 + frame, 13 - frame / 2.f);
+            for (int i = 0; i < 64; i++)
+            {
+                const Ray r = Ray(2 * PI * i / 64, base);
+                Point expected, result;
+                const bool hit = getClosestIntersection(r, single, expected);
+                hitsSame = hitsSame && getClosestIntersection(r, scene, result) == hit && (!hit || result == expected);
+
+                const Point b = Point(base.x + 150 * std::cos(0.37f * i), base.y + 150 * std::sin(0.37f * i));
+                sightSame = sightSame && hasLineOfSight(base, b, scene) == hasLineOfSight(base, b, single);
+            }
+
+            if (frame % 8 == 0)
+            {
+                std::vector<Point> expected, result;
+                getClosestIntersectionOfRays(base, single, expected);
+                getClosestIntersectionOfRays(base, scene, result);
+                fansSame = fansSame && result == expected;
+            }
+        }
+        printTest("closest hits match one BVH over static and dynamic line segments", hitsSame);
+        printTest("lines of sight match one BVH", sightSame);
+        printTest("fans match one BVH", fansSame);
+        printTest("line segments are indexed static first", scene.size() == 2044 && scene.sizeStatic() == 2000 && scene.get(2000) == crates[0] && scene.get(5) == walls[5]);
+
+        bool bounded = true;
+        for (int i = 0; i < 64; i++)
+        {
+            const Point dir = Point(std::cos(2 * PI * i / 64), std::sin(2 * PI * i / 64));
+            float t, boundedT;
+            int index, boundedIndex;
+            if (scene.getStatic().closestHit(Point(3, 7), dir, t, index))
+            {
+                bounded = bounded && !scene.getStatic().closestHit(Point(3, 7), dir, -1, t, boundedT, boundedIndex);
+                bounded = bounded && scene.getStatic().closestHit(Point(3, 7), dir, index, t + 1, boundedT, boundedIndex) && boundedT == t && boundedIndex == index;
+            }
+        }
+        printTest("closest hits bounded by a distance only count hits before it", bounded);
+
+        const int staticNodes = scene.getStatic().nodeCount();
+        scene.setDynamic(std::vector<LineSegment>());
+        std::vector<Point> fan;
+        getClosestIntersectionOfRays(Point(3,3), scene, fan);
+        std::vector<Point> expected;
+        getClosestIntersectionOfRays(Point(3,3), BVH(walls), expected);
+        printTest("removing every dynamic line segment leaves the static tree alone", scene.getStatic().nodeCount() == staticNodes && scene.sizeDynamic() == 0 && fan == expected);
+    }
+
+    std::cout << "Test: getClosestIntersectionsOfRays() with a direction table\n";
+    {
+        const std::vector<LineSegment> ls = randomLineSegments(500, 200, 4242);
+        const SegmentStore store(ls);
+        const BVH bvh(ls);
+
+        bool tableSame = true;
+        const std::array<Point, 1024>& directions = uniformDirections<1024>();
+        for (int i = 0; i < 1024; i++)
+        {
+            tableSame = tableSame && directions[i] == Ray(2 * PI / 1024 * i, Point(0,0)).direction();
+        }
+        printTest("table holds the directions of rays cast from angles", tableSame && uniformDirections<64>()[16] == Point(0,1));
+
+        // Fan cast from angles ray by ray, as getClosestIntersectionsOfRays() did before tables
+        const Point base = Point(7,-3);
+        auto fromAngles = [&](const int rayCount)
+        {
+            std::vector<Point> fan;
+            for (int i = 0; i < rayCount; i++)
+            {
+                Point closest;
+                if (getClosestIntersection(Ray(2 * PI / rayCount * i, base), ls, closest))
+                {
+                    fan.push_back(closest);
+                }
+            }
+            return fan;
+        };
+
+        std::vector<Point> linear, fromStore, fromBVH;
+        getClosestIntersectionsOfRays<256>(base, ls, linear);
+        getClosestIntersectionsOfRays<256>(base, store, fromStore);
+        getClosestIntersectionsOfRays<256>(base, bvh, fromBVH);
+        const std::vector<Point> expected = fromAngles(256);
+        printTest("fans from the table match fans from angles, for every engine", linear == expected && fromStore == expected && fromBVH == expected);
+
+        std::vector<Point> tabled, other;
+        getClosestIntersectionsOfRays(base, 4096, bvh, tabled);
+        getClosestIntersectionsOfRays(base, 100, ls, other);
+        printTest("usual ray counts use the table, others still work", tabled == fromAngles(4096) && other == fromAngles(100));
+    }
+
+    std::cout << "Test: getClosestIntersectionsOfRays() with hints\n";
+    {
+        const std::vector<LineSegment> ls = randomLineSegments(2000, 400, 1357);
+        const BVH bvh(ls);
+        const int rays = 256;
+
+        std::vector<int> linearHints, bvhHints;
+        bool linearSame = true;
+        bool bvhSame = true;
+        unsigned long long plainTests = 0, hintedTests = 0;
+        for (int frame = 0; frame < 30; frame++)
+        {
+            const Point base = Point(-15 + 0.5f * frame, 10 - 0.25f * frame);
+
+            std::vector<Point> expected, linear, fromBVH;
+            resetRayCastStats();
+            getClosestIntersectionsOfRays(base, rays, ls, expected);
+            const unsigned long long plain = getRayCastStats().segmentTests;
+
+            resetRayCastStats();
+            getClosestIntersectionsOfRays(base, rays, ls, linear, linearHints);
+            const unsigned long long hinted = getRayCastStats().segmentTests;
+
+            // The first frame has no hints yet
+            if (frame > 0)
+            {
+                plainTests += plain;
+                hintedTests += hinted;
+            }
+
+            getClosestIntersectionsOfRays(base, rays, bvh, fromBVH, bvhHints);
+            linearSame = linearSame && linear == expected;
+            bvhSame = bvhSame && fromBVH == expected;
+        }
+        resetRayCastStats();
+        printTest("hinted rays hit the same points as unhinted ones while the light moves", linearSame);
+        printTest("hinted rays through the BVH hit the same points", bvhSame);
+        printTest("hints are kept per ray", (int) linearHints.size() == rays && linearHints == bvhHints);
+
+        std::vector<int> stale(rays);
+        for (int i = 0; i < rays; i++)
+        {
+            stale[i] = (i * 7919) % 2100 - 50;
+        }
+        std::vector<int> staleBVH = stale;
+        std::vector<Point> expected, linear, fromBVH;
+        getClosestIntersectionsOfRays(Point(30,-40), rays, ls, expected);
+        getClosestIntersectionsOfRays(Point(30,-40), rays, ls, linear, stale);
+        getClosestIntersectionsOfRays(Point(30,-40), rays, bvh, fromBVH, staleBVH);
+        printTest("stale and out of range hints do not change the hits", linear == expected && fromBVH == expected);
+
+        // 256 rays go through the direction table, 100 rays compute their directions
+        std::vector<int> untabledHints, untabledBVHHints;
+        bool untabledSame = true;
+        for (int frame = 0; frame < 3; frame++)
+        {
+            const Point base = Point(5 + 0.5f * frame, -7);
+            std::vector<Point> expected, linear, fromBVH;
+            getClosestIntersectionsOfRays(base, 100, ls, expected);
+            getClosestIntersectionsOfRays(base, 100, ls, linear, untabledHints);
+            getClosestIntersectionsOfRays(base, 100, bvh, fromBVH, untabledBVHHints);
+            untabledSame = untabledSame && linear == expected && fromBVH == expected;
+        }
+        printTest("hinted rays hit the same points at a ray count without a direction table", untabledSame);
+
+        if (rayCastStatsEnabled())
+        {
+            printTest("hints leave few line segments to test (" + std::to_string(hintedTests) + " of " + std::to_string(plainTests) + ")", hintedTests * 3 < plainTests);
+        }
+    }
+
+    std::cout << "Test: MapFile\n";
+    {
+        const std::vector<LineSegment> ls = randomLineSegments(5003, 400, 2024);
+        const std::string path = "./bin/testsAuto_map.rcmap";
+        printTest("map file is written", writeMapFile(path, ls));
+
+        MapFile file;
+        long before = allocationCount;
+        const bool opened = file.open(path);
+        printTest("opening uses the arrays in place, nothing is copied (" + std::to_string(allocationCount - before) + " allocations)", opened && allocationCount == before);
+
+        bool same = file.size() == (int) ls.size() && file.getStore().paddedSize() % SegmentStore::SEGMENT_STORE_WIDTH == 0;
+        for (int i = 0; same && i < (int) ls.size(); i++)
+        {
+            same = file.get(i) == ls[i] && file.get(i).a == ls[i].a;
+        }
+        printTest("line segments read back in order", same);
+        printTest("checksum matches", file.verify());
+
+        const SegmentStore store(ls);
+        const BVH built(ls);
+        BVH restored;
+        const bool hasTree = file.hasBVH() && file.getBVH(restored) && restored.nodeCount() == built.nodeCount();
+        bool hitsSame = true;
+        for (int i = 0; i < 200; i++)
+        {
+            const Ray r = Ray(0.031f * i, Point(3,-7));
+            Point expected, fromStore, fromTree;
+            const bool hit = getClosestIntersection(r, store, expected);
+            hitsSame = hitsSame && getClosestIntersection(r, file.getStore(), fromStore) == hit && getClosestIntersection(r, restored, fromTree) == hit;
+            hitsSame = hitsSame && (!hit || (fromStore == expected && fromTree == expected));
+        }
+        printTest("stored BVH is restored without building it", hasTree);
+        printTest("mapped store and restored BVH find the same hits as built ones", hitsSame);
+
+        file.close();
+        printTest("closed file is empty", !file.isOpen() && file.size() == 0 && !file.hasBVH());
+
+        writeMapFile(path, ls, false);
+        BVH none;
+        printTest("map file without a BVH", file.open(path, true) && !file.hasBVH() && !file.getBVH(none) && file.size() == (int) ls.size());
+        file.close();
+
+        // Damage one byte of the segment arrays
+        {
+            std::fstream damage(path, std::ios::in | std::ios::out | std::ios::binary);
+            damage.seekp(MapFile::PAGE_SIZE + 17);
+            damage.put(0x5a);
+        }
+        printTest("damaged file opens without verify, and fails the checksum", file.open(path) && !file.verify() && !file.isOpen());
+        printTest("damaged file does not open with verify", !file.open(path, true) && file.getError().find("checksum") != std::string::npos);
+
+        writeMapFile(path, std::vector<LineSegment>());
+        printTest("empty map", file.open(path, true) && file.size() == 0);
+        file.close();
+
+        {
+            std::ofstream truncated(path, std::ios::binary | std::ios::trunc);
+            truncated << "RCMAP";
+        }
+        printTest("file too short is refused", !file.open(path) && !file.getError().empty());
+        printTest("missing file is refused", !file.open("./bin/testsAuto_missing.rcmap"));
+
+        const std::string textPath = "./bin/testsAuto_map.txt";
+        {
+            std::ofstream text(textPath);
+            text << "# a room\n0 0 10 0\n10 0 10 10\n\n  10 10 0 10\n0 10 0 0\n";
+        }
+        std::string error;
+        const bool converted = convertTextMap(textPath, path, true, error);
+        printTest("text map converts", converted && file.open(path, true) && file.size() == 4 && file.get(2) == LineSegment(Point(10,10), Point(0,10)));
+        file.close();
+
+        {
+            std::ofstream text(textPath);
+            text << "0 0 10 0\n10 0 10\n";
+        }
+        std::vector<LineSegment> read;
+        printTest("bad text line is reported with its line number", !readTextMap(textPath, read, error) && error.find(":2:") != std::string::npos);
     }
 
     std::cout << "Test Ray.closestPointOnRay()\n";
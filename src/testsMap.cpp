@@ -1,6 +1,14 @@
 #include "Map.h"
+#include "MapGenerator.h"
+#include "TiledWorld.h"
+#include "FanCache.h"
 #include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <filesystem>
 
 void printTest(const std::string& testDescription, bool result)
 {
@@ -16,6 +24,19 @@ void printTest(const std::string& testDescription, bool result)
     std::cout << testDescription << "\n";
 }
 
+float fanArea(const std::vector<Point>& fan)
+{
+    float area = 0;
+    for (int i = 0; i < (int) fan.size(); i++)
+    {
+        const Point p = fan[i];
+        const Point q = fan[(i + 1) % fan.size()];
+        area += p.x * q.y - q.x * p.y;
+    }
+
+    return area / 2;
+}
+
 int main(int argc, char* argv[]) 
 {
     {
@@ -36,6 +57,44 @@ int main(int argc, char* argv[])
         printTest("check that can remove line segment", (m.removeLineSegment(LineSegment(Point(0,0), Point(10,10))) == true && m.sizeLineSegments() == 1));
         printTest("check that can remove non-exist line segment", (m.removeLineSegment(LineSegment(Point(0,0), Point(10,10))) == false && m.sizeLineSegments() == 1));
     }
+    {
+        Map m;
+
+        std::vector<LineSegment> lss;
+        lss.push_back(LineSegment(Point(0,0), Point(10,10)));
+        lss.push_back(LineSegment(Point(10,10), Point(20,0)));
+        lss.push_back(LineSegment(Point(10,10), Point(0,0)));
+        lss.push_back(LineSegment(Point(20,0), Point(0,0)));
+        lss.push_back(LineSegment(Point(0,0), Point(10,10)));
+
+        std::cout << "TEST: addLineSegments()\n";
+        printTest("check that duplicates in the same batch are skipped, in either endpoint order", m.addLineSegments(lss) == 3 && m.sizeLineSegments() == 3);
+        printTest("check that line segments already in map are skipped", m.addLineSegments(lss) == 0 && m.sizeLineSegments() == 3);
+        printTest("check that can't add reversed duplicate with addLineSegment()", m.addLineSegment(LineSegment(Point(0,0), Point(20,0))) == false);
+
+        std::vector<LineSegment> grid;
+        for (int i = 0; i < 200; i++)
+        {
+            grid.push_back(LineSegment(Point(i, 0), Point(i, 100)));
+            grid.push_back(LineSegment(Point(i, 100), Point(i, 0)));
+        }
+        printTest("check that a large batch is deduplicated", m.addLineSegments(grid) == 200 && m.sizeLineSegments() == 203);
+
+        std::cout << "TEST: removeLineSegment() with index\n";
+        bool removedAll = true;
+        for (int i = 0; i < 200; i += 2)
+        {
+            removedAll = removedAll && m.removeLineSegment(LineSegment(Point(i, 100), Point(i, 0)));
+        }
+        printTest("check that can remove line segments given with reversed endpoints", removedAll && m.sizeLineSegments() == 103);
+
+        bool rest = true;
+        for (int i = 1; i < 200; i += 2)
+        {
+            rest = rest && m.addLineSegment(LineSegment(Point(i, 0), Point(i, 100))) == false;
+        }
+        printTest("check that line segments moved by removal are still found", rest && m.removeLineSegment(LineSegment(Point(0,0), Point(10,10))) && m.sizeLineSegments() == 102);
+    }
     {
         std::cout << "TEST: moveEndPoint()\n";
         {
@@ -66,8 +125,81 @@ int main(int argc, char* argv[])
             bool result = (m.moveEndPoint(p, newEndpoint) && m.getLineSegments()[0].b == newEndpoint && m.getLineSegments()[1].a == newEndpoint);
 
             printTest("move endpoint that is endpoint of two line segments [check that it moves for both]", result);
+            printTest("moved line segments are found at their new position", m.addLineSegment(LineSegment(newEndpoint, Point(0,0))) == false && m.removeLineSegment(LineSegment(Point(20,20), newEndpoint)));
+        }
+        {
+            Map m;
+
+            m.addLineSegment(LineSegment(Point(0,0), Point(10,0)));
+            m.addLineSegment(LineSegment(Point(0,0), Point(10,10)));
+            m.addLineSegment(LineSegment(Point(5,5), Point(6,6)));
+
+            bool result = m.moveEndPoint(Point(10,10), Point(10,0)) && m.sizeLineSegments() == 2 && m.removeLineSegment(LineSegment(Point(10,0), Point(0,0))) && m.removeLineSegment(LineSegment(Point(5,5), Point(6,6)));
+
+            printTest("line segment moved onto another one is merged with it", result && m.sizeLineSegments() == 0);
         }
     }
+    {
+        std::cout << "TEST: vertex table\n";
+
+        Map m;
+
+        // Every endpoint's vertex is at the endpoint, and every vertex is used
+        auto consistent = [&m]()
+        {
+            const std::vector<LineSegment>& lss = m.getLineSegments();
+            const std::vector<Point>& vertices = m.getVertices();
+            const std::vector<int>& segmentVertices = m.getSegmentVertices();
+
+            bool ok = (int) segmentVertices.size() == 2 * m.sizeLineSegments();
+            std::vector<int> uses(vertices.size(), 0);
+            for (int i = 0; ok && i < (int) lss.size(); i++)
+            {
+                ok = vertices[segmentVertices[2 * i]] == lss[i].a && vertices[segmentVertices[2 * i + 1]] == lss[i].b;
+                uses[segmentVertices[2 * i]]++;
+                uses[segmentVertices[2 * i + 1]]++;
+            }
+
+            for (int i = 0; ok && i < (int) vertices.size(); i++)
+            {
+                ok = uses[i] > 0;
+            }
+
+            std::vector<Point> actual;
+            getVertices(lss, actual);
+
+            return ok && actual.size() == vertices.size();
+        };
+
+        std::vector<LineSegment> square;
+        square.push_back(LineSegment(Point(0,0), Point(10,0)));
+        square.push_back(LineSegment(Point(10,0), Point(10,10)));
+        square.push_back(LineSegment(Point(10,10), Point(0,10)));
+        square.push_back(LineSegment(Point(0,10), Point(0,0)));
+        m.addLineSegments(square);
+
+        printTest("shared corners are one vertex", m.sizeVertices() == 4 && consistent());
+
+        m.addLineSegment(LineSegment(Point(10,10), Point(20,20)));
+        printTest("adding a line segment adds only its new endpoint", m.sizeVertices() == 5 && consistent());
+
+        m.removeLineSegment(LineSegment(Point(10,0), Point(0,0)));
+        printTest("removing a line segment keeps vertices still in use", m.sizeVertices() == 5 && consistent());
+
+        m.removeLineSegment(LineSegment(Point(10,10), Point(20,20)));
+        printTest("removing a line segment drops vertices no longer in use", m.sizeVertices() == 4 && consistent());
+
+        m.moveEndPoint(Point(10,10), Point(12,12));
+        printTest("moving a shared vertex moves it for all its line segments", m.sizeVertices() == 4 && consistent());
+
+        m.moveEndPoint(Point(12,12), Point(0,10));
+        printTest("moving a vertex onto another merges them", m.sizeVertices() == 3 && consistent());
+
+        std::vector<Point> fromMap, fromSegments;
+        getClosestIntersectionOfRays(Point(4,3), m.getLineSegments(), m.getVertices(), fromMap);
+        getClosestIntersectionOfRays(Point(4,3), m.getLineSegments(), fromSegments);
+        printTest("fan from the vertex table has the same points as deriving the vertices", fromMap.size() == fromSegments.size() && std::is_permutation(fromMap.begin(), fromMap.end(), fromSegments.begin()));
+    }
     std::cout << "TEST: closestEndpoint()\n";
     {
         Map m;
@@ -93,5 +225,346 @@ int main(int argc, char* argv[])
         printTest("no endpoint within max distance", m.closestEndPoint(center, maxDist, pResult) == false);
     }
 
+    {
+        Map m(4);
+
+        unsigned int seed = 7;
+        auto random = [&seed](const float range)
+        {
+            seed = seed * 1103515245 + 12345;
+            return (float) ((seed >> 8) % 10000) / 10000.f * range - range / 2;
+        };
+
+        std::vector<LineSegment> lss;
+        for (int i = 0; i < 2000; i++)
+        {
+            lss.push_back(LineSegment(Point(random(400), random(400)), Point(random(400), random(400))));
+        }
+        m.addLineSegments(lss);
+
+        // Closest endpoint by checking every line segment
+        auto bruteForce = [&m](const Point p, const float maxDist, Point& result)
+        {
+            bool found = false;
+            for (const LineSegment& ls : m.getLineSegments())
+            {
+                for (const Point q : { ls.a, ls.b })
+                {
+                    if (q.distSquared(p) < maxDist * maxDist && (!found || q.distSquared(p) < result.distSquared(p)))
+                    {
+                        result = q;
+                        found = true;
+                    }
+                }
+            }
+            return found;
+        };
+
+        auto sameAsBruteForce = [&](const int queries)
+        {
+            bool same = true;
+            for (int i = 0; i < queries; i++)
+            {
+                const Point p = Point(random(440), random(440));
+                const float maxDist = i % 3 == 0 ? 1.5f : (i % 3 == 1 ? 9.f : 1000.f);
+
+                Point result, actual;
+                const bool found = m.closestEndPoint(p, maxDist, result);
+                const bool actualFound = bruteForce(p, maxDist, actual);
+
+                same = same && found == actualFound && (!found || result.distSquared(p) == actual.distSquared(p));
+            }
+            return same;
+        };
+
+        std::cout << "TEST: closestEndpoint() with grid\n";
+        printTest("same as checking every endpoint, for small and large max distances", sameAsBruteForce(300));
+
+        bool moved = true;
+        for (int i = 0; i < 200; i++)
+        {
+            const LineSegment ls = m.getLineSegments()[i * 7 % m.sizeLineSegments()];
+            moved = moved && m.moveEndPoint(ls.a, Point(random(400), random(400)));
+            m.removeLineSegment(m.getLineSegments()[i * 3 % m.sizeLineSegments()]);
+        }
+        printTest("same as checking every endpoint, after moving endpoints and removing line segments", moved && sameAsBruteForce(300));
+
+        Point result;
+        const Point far = Point(5000, 5000);
+        const LineSegment ls = m.getLineSegments()[0];
+        bool movedFar = m.moveEndPoint(ls.b, far) && m.closestEndPoint(Point(4999, 5000), 2, result) && result == far;
+        printTest("moved endpoint is found at its new position", movedFar && m.moveEndPoint(ls.b, far) == false);
+    }
+    {
+        std::cout << "TEST: map generators\n";
+
+        const MapKind kinds[] = { MapKind::Random, MapKind::Maze, MapKind::City, MapKind::Forest, MapKind::Corridors };
+        for (const MapKind kind : kinds)
+        {
+            const std::string name = mapKindName(kind);
+
+            bool exactCount = true;
+            bool noPoints = true;
+            for (const int count : { 1, 10, 97, 1000, 20000 })
+            {
+                std::vector<LineSegment> lss;
+                lss.push_back(LineSegment(Point(0,0), Point(1,1)));
+                generateMap(kind, count, 7, lss);
+                exactCount = exactCount && (int) lss.size() == count + 1;
+
+                for (const LineSegment& ls : lss)
+                {
+                    noPoints = noPoints && !(ls.a == ls.b) && std::isfinite(ls.a.x + ls.a.y + ls.b.x + ls.b.y);
+                }
+            }
+            printTest(name + ": appends exactly the number of line segments asked for", exactCount);
+            printTest(name + ": no line segment is a single point", noPoints);
+
+            std::vector<LineSegment> first, again, other;
+            generateMap(kind, 500, 7, first);
+            generateMap(kind, 500, 7, again);
+            generateMap(kind, 500, 8, other);
+            printTest(name + ": same seed gives the same map, another seed another map", first == again && first != other);
+
+            MapKind parsed;
+            printTest(name + ": name gives back the kind", mapKindFromName(name, parsed) && parsed == kind);
+        }
+
+        MapKind parsed;
+        printTest("unknown name is not a kind", mapKindFromName("castle", parsed) == false);
+
+        // A complete maze has no way out
+        std::vector<LineSegment> maze;
+        generateMaze(16 * 16, 3, maze);
+        std::vector<Point> hits;
+        getClosestIntersectionsOfRays(Point(-140, -140), 360, maze, hits);
+        printTest("maze: every ray from inside hits a wall", hits.size() == 360);
+
+        Map m;
+        printTest("maze: all walls are added to a map", generateMap(MapKind::Maze, 1000, 3, m) == 1000 && m.sizeLineSegments() == 1000);
+    }
+    {
+        std::cout << "TEST: splitIntoTiles()\n";
+
+        TileSet tiles;
+        std::vector<LineSegment> ls;
+        ls.push_back(LineSegment(Point(-5,1), Point(25,7)));
+        ls.push_back(LineSegment(Point(10,2), Point(10,8)));
+        ls.push_back(LineSegment(Point(3,3), Point(4,4)));
+        splitIntoTiles(ls, 10, tiles);
+
+        const std::vector<LineSegment>& left = tiles[TileKey(-1,0)];
+        const std::vector<LineSegment>& middle = tiles[TileKey(0,0)];
+        const std::vector<LineSegment>& right = tiles[TileKey(1,0)];
+        const std::vector<LineSegment>& farRight = tiles[TileKey(2,0)];
+        printTest("line segment is cut where it crosses a border", left.size() == 1 && middle.size() == 2 && right.size() == 2 && farRight.size() == 1);
+        printTest("pieces meet exactly and keep the original endpoints", left[0].a == Point(-5,1) && left[0].b == middle[0].a && middle[0].b == right[0].a && right[0].b == farRight[0].a && farRight[0].b == Point(25,7));
+        printTest("line segment along a border is in one tile only", right[1] == ls[1] && middle[1] == ls[2]);
+    }
+    {
+        std::cout << "TEST: TiledWorld\n";
+
+        std::vector<LineSegment> world;
+        generateMap(MapKind::Maze, 4000, 11, world);
+
+        Point low = world[0].a;
+        Point high = world[0].a;
+        for (const LineSegment& ls : world)
+        {
+            low = Point(std::min({ low.x, ls.a.x, ls.b.x }), std::min({ low.y, ls.a.y, ls.b.y }));
+            high = Point(std::max({ high.x, ls.a.x, ls.b.x }), std::max({ high.y, ls.a.y, ls.b.y }));
+        }
+        const float tileSize = (high.x - low.x) / 8;
+        const float radius = tileSize / 2;
+
+        TileSet tiles;
+        splitIntoTiles(world, tileSize, tiles);
+
+        std::atomic<int> loads(0);
+        TileLoader loader = [&](const TileKey key, std::vector<LineSegment>& lineSegments)
+        {
+            loads++;
+            auto tile = tiles.find(key);
+            if (tile != tiles.end())
+            {
+                lineSegments = tile->second;
+            }
+        };
+
+        // Light bases off the walls, in the middle of maze cells
+        std::vector<Point> bases;
+        for (int i = 0; i < 6; i++)
+        {
+            bases.push_back(Point(low.x + (high.x - low.x) * (0.13f + 0.13f * i) + 0.37f, low.y + (high.y - low.y) * (0.81f - 0.11f * i) + 0.61f));
+        }
+
+        TiledWorld streamed(tileSize, loader, 16);
+        bool sameFans = true;
+        for (const Point base : bases)
+        {
+            std::vector<Point> expected, result;
+            getClosestIntersectionOfRays(base, world, radius, expected);
+            streamed.getClosestIntersectionOfRays(base, radius, result);
+            sameFans = sameFans && !expected.empty() && std::fabs(fanArea(result) - fanArea(expected)) < 1e-3f * std::fabs(fanArea(expected));
+        }
+        printTest("fans over the tiles a light touches match fans over the whole world", sameFans);
+        printTest("queries load the tiles they need themselves when not asked for", streamed.getBlockingLoads() > 0 && streamed.getBackgroundLoads() == 0);
+
+        TiledWorld prefetched(tileSize, loader, 16);
+        prefetched.update(bases, radius);
+        prefetched.waitForLoads();
+        std::vector<Point> fan;
+        for (const Point base : bases)
+        {
+            fan.clear();
+            prefetched.getClosestIntersectionOfRays(base, radius, fan);
+        }
+        printTest("tiles asked for in update() are loaded in the background", prefetched.getBackgroundLoads() > 0 && prefetched.getBlockingLoads() == 0);
+
+        // Walk one light across the whole world
+        TiledWorld walked(tileSize, loader, 12);
+        bool bounded = true;
+        bool mapMatches = true;
+        loads = 0;
+        for (int step = 0; step <= 100; step++)
+        {
+            const Point base = Point(low.x + (high.x - low.x) * step / 100.f, low.y + (high.y - low.y) * (step % 10) / 10.f);
+            walked.update({ base }, radius);
+            fan.clear();
+            walked.getClosestIntersectionOfRays(base, radius, fan);
+            bounded = bounded && walked.residentTiles() <= 12 + 4;
+        }
+        walked.waitForLoads();
+        walked.update({}, radius);
+
+        int residentSegments = 0;
+        for (const auto& tile : tiles)
+        {
+            if (walked.isResident(tile.first))
+            {
+                residentSegments += tile.second.size();
+            }
+        }
+        mapMatches = walked.getMap().sizeLineSegments() == residentSegments;
+        printTest("resident tiles stay bounded while a light crosses the world (" + std::to_string(loads) + " loads)", bounded && walked.residentTiles() <= 12);
+        printTest("map holds the line segments of the resident tiles", mapMatches && residentSegments > 0);
+
+        // A loader that puts the same line segment in two tiles
+        const LineSegment shared(Point(1,0), Point(1,1));
+        TiledWorld overlapping(1, [&](const TileKey key, std::vector<LineSegment>& lineSegments)
+        {
+            if (key == TileKey(0,0) || key == TileKey(1,0))
+            {
+                lineSegments = { shared, LineSegment(Point(key.x + 0.2f, 0.5f), Point(key.x + 0.8f, 0.5f)) };
+            }
+        }, 1);
+        for (const float x : { 0.5f, 1.5f, 1.5f })
+        {
+            overlapping.update({ Point(x, 0.5f) }, 0.1f);
+            overlapping.waitForLoads();
+        }
+        const bool keptShared = !overlapping.isResident(TileKey(0,0)) && overlapping.getMap().sizeLineSegments() == 2 && std::count(overlapping.getMap().getLineSegments().begin(), overlapping.getMap().getLineSegments().end(), shared) == 1;
+        for (const float x : { 2.5f, 2.5f })
+        {
+            overlapping.update({ Point(x, 0.5f) }, 0.1f);
+            overlapping.waitForLoads();
+        }
+        printTest("line segment in two tiles stays in the map until both are evicted", keptShared && overlapping.getMap().sizeLineSegments() == 0);
+
+        const std::string directory = "./bin/testsMap_tiles";
+        std::filesystem::create_directories(directory);
+        const bool written = writeTiles(world, tileSize, directory);
+        TiledWorld fromFiles(tileSize, mapFileTileLoader(directory), 16);
+        bool sameFromFiles = written;
+        for (const Point base : bases)
+        {
+            std::vector<Point> expected, result;
+            streamed.getClosestIntersectionOfRays(base, radius, expected);
+            fromFiles.getClosestIntersectionOfRays(base, radius, result);
+            sameFromFiles = sameFromFiles && result == expected;
+        }
+        printTest("tiles written as map files load back the same", sameFromFiles);
+        std::filesystem::remove_all(directory);
+    }
+
+    {
+        std::cout << "TEST: FanCache\n";
+
+        Map m;
+        generateMap(MapKind::City, 400, 5, m);
+        FanCache cache(0.5);
+
+        const Point base(3.1, 4.2);
+        const auto uncached = [&]()
+        {
+            std::vector<Point> fan;
+            getClosestIntersectionOfRays(cache.quantize(base), m.getLineSegments(), m.getVertices(), fan);
+            return fan;
+        };
+        const std::vector<Point> first = cache.getFan(base, m);
+        printTest("first query is a miss and casts the fan from the snapped position", cache.getMisses() == 1 && cache.getHits() == 0 && first == uncached());
+        printTest("repeated query is a hit with the same fan", cache.getFan(base, m) == first && cache.getHits() == 1 && cache.getMisses() == 1);
+        printTest("light moved within its cell shares the fan", cache.getFan(Point(3.2, 4.1), m) == first && cache.getHits() == 2);
+        cache.getFan(Point(3.4, 4.2), m);
+        printTest("light moved to the next cell casts its own fan", cache.getMisses() == 2 && cache.size() == 2);
+
+        m.addLineSegment(LineSegment(Point(2,3), Point(4,3)));
+        printTest("adding a line segment drops the cached fans", cache.getFan(base, m) == uncached() && cache.getMisses() == 3 && cache.size() == 1);
+        m.moveEndPoint(Point(4,3), Point(4,5));
+        cache.getFan(base, m);
+        printTest("moving an endpoint drops the cached fans", cache.getMisses() == 4 && cache.size() == 1);
+        m.removeLineSegment(LineSegment(Point(2,3), Point(4,5)));
+        printTest("removing a line segment drops the cached fans", cache.getFan(base, m) == uncached() && cache.getMisses() == 5);
+
+        // A copy gets its own version, so after one edit each the two maps differ
+        Map other;
+        generateMap(MapKind::Forest, 400, 6, other);
+        Map copy = other;
+        other.addLineSegment(LineSegment(Point(2,3), Point(4,3)));
+        copy.addLineSegment(LineSegment(Point(2,5), Point(4,5)));
+        std::vector<Point> expectedOther, expectedCopy;
+        getClosestIntersectionOfRays(cache.quantize(base), other.getLineSegments(), other.getVertices(), expectedOther);
+        getClosestIntersectionOfRays(cache.quantize(base), copy.getLineSegments(), copy.getVertices(), expectedCopy);
+        FanCache shared(0.5);
+        const bool ownFans = shared.getFan(base, other) == expectedOther && shared.getFan(base, copy) == expectedCopy && shared.getFan(base, other) == expectedOther;
+        printTest("fans of another map or of a copy are not returned", ownFans && other.getVersion() != copy.getVersion() && expectedCopy != expectedOther && shared.getMisses() == 3);
+
+        // A new level loaded into the same map object, with as many edits as the last one
+        Map level;
+        generateMap(MapKind::City, 400, 7, level);
+        FanCache reloaded(0.5);
+        reloaded.getFan(base, level);
+        const unsigned long long firstVersion = level.getVersion();
+        level = Map();
+        generateMap(MapKind::City, 400, 8, level);
+        std::vector<Point> expectedLevel;
+        getClosestIntersectionOfRays(reloaded.quantize(base), level.getLineSegments(), level.getVertices(), expectedLevel);
+        printTest("map assigned over in place does not return the fans of the old one", level.getVersion() != firstVersion && reloaded.getFan(base, level) == expectedLevel && reloaded.getMisses() == 2);
+
+        // Fans of equal size, so the budget holds exactly 3 of them
+        const auto compute = [](const Point base, std::vector<Point>& fan) { fan.assign(16, base); };
+        FanCache measure(1);
+        measure.getFan(Point(0,0), 0, compute);
+        FanCache small(1, measure.memoryUsed() * 3);
+        for (int i = 0; i < 3; i++)
+        {
+            small.getFan(Point(i,0), 0, compute);
+        }
+        small.getFan(Point(0,0), 0, compute);
+        small.getFan(Point(3,0), 0, compute);
+        printTest("least recently used fan is evicted first", small.size() == 3 && small.getEvictions() == 1 && small.getHits() == 1);
+        small.getFan(Point(0,0), 0, compute);
+        small.getFan(Point(1,0), 0, compute);
+        printTest("fans used again are kept, evicted ones are cast again", small.getHits() == 2 && small.getMisses() == 5);
+
+        bool withinBudget = true;
+        for (int i = 0; i < 100; i++)
+        {
+            small.getFan(Point(i % 7, i % 5), 0, compute);
+            withinBudget = withinBudget && small.memoryUsed() <= measure.memoryUsed() * 3;
+        }
+        printTest("memory stays within the budget", withinBudget && small.size() == 3);
+    }
+
     return 0;
-}
\ No newline at end of file
+}
@@ -3,6 +3,8 @@
 #include <vector>
 #include "RayCasting.h"
 #include "Map.h"
+#include "VisibilitySweep.h"
+#include "MapGenerator.h"
 #include <cmath>
 
 class Controller
@@ -12,6 +14,10 @@ private:
     Point base = Point(7,5);
     int rayCount = 25;
     Map map;
+    FanEngine engine = FanEngine::ThreeRays;
+    IncrementalSweep sweep;
+    RayCastScratch scratch;
+    int generated = 0; // generated maps loaded so far
 
 public:
 
@@ -86,23 +92,61 @@ public:
         // map.addLineSegment(scale(lj,1400));
 
 
-        getClosestIntersectionOfRays(base, getMap(), fan);
+        computeFan();
     };
 
+    void computeFan()
+    {
+        fan.clear();
+        if (engine == FanEngine::Sweep)
+        {
+            // Light moves a little between frames, keep the sweep from the last position
+            sweep.update(base, getMap(), fan);
+        }
+        else if (engine == FanEngine::VertexRays)
+        {
+            getClosestIntersectionOfVertexRays(base, getMap(), fan, scratch);
+        }
+        else
+        {
+            // Map keeps its vertices, no need to find them again every frame
+            getClosestIntersectionOfRays(base, getMap(), map.getVertices(), fan);
+        }
+    }
+
     void moveBase(Point newBase)
     {
         base = newBase;
 
-        fan.clear();
-        getClosestIntersectionOfRays(base, getMap(), fan);
+        computeFan();
     }
 
     void changeRayCount(int newRayCount)
     {
         newRayCount = rayCount;
 
-        fan.clear();
-        getClosestIntersectionOfRays(base, getMap(), fan);
+        computeFan();
+    }
+
+    void toggleEngine()
+    {
+        engine = engine == FanEngine::ThreeRays ? FanEngine::Sweep : engine == FanEngine::Sweep ? FanEngine::VertexRays : FanEngine::ThreeRays;
+
+        computeFan();
+    }
+
+    void loadGeneratedMap()
+    {
+        const MapKind kinds[] = { MapKind::Random, MapKind::Maze, MapKind::City, MapKind::Forest, MapKind::Corridors };
+        const MapKind kind = kinds[generated % 5];
+
+        map = Map();
+        generateMap(kind, 400, generated, map);
+        sweep.invalidate();
+        generated++;
+
+        std::cout << "Loaded generated map: " << mapKindName(kind) << "\n";
+        computeFan();
     }
 
     const std::vector<LineSegment> & getMap()
@@ -118,6 +162,7 @@ public:
     void addLineSegment(LineSegment ls)
     {
         map.addLineSegment(ls);
+        sweep.invalidate();
     }
 
     Point getBase()
@@ -127,8 +172,7 @@ public:
 
     void update()
     {
-        fan.clear();
-        getClosestIntersectionOfRays(base, getMap(), fan);
+        computeFan();
     }
 
     LineSegment translate(LineSegment ls, float dx, float dy)
@@ -342,6 +386,14 @@ private:
                         m_scale = 0.01f;
                     }
                 }
+                if (event.key.code == sf::Keyboard::E)
+                {
+                    ctrl.toggleEngine();
+                }
+                if (event.key.code == sf::Keyboard::G)
+                {
+                    ctrl.loadGeneratedMap();
+                }
                 if (event.key.code == sf::Keyboard::Space)
                 {
                     if (endPointsClickedByUser == 1)